@@ -22,6 +22,7 @@
 #endif
 
 #include "abagnale.h"
+#include "archive.h"
 #include "config.h"
 #include "database.h"
 #include "exchange.h"
@@ -33,6 +34,7 @@
 #include "thread.h"
 #include "time.h"
 #include "version.h"
+#include "wal.h"
 
 #include <errno.h>
 #include <inttypes.h>
@@ -45,6 +47,14 @@
 #define DEFAULT_ABAG_ORDER_WORKERS 1
 #endif
 
+#ifndef DEFAULT_ABAG_SUBMIT_WORKERS
+#define DEFAULT_ABAG_SUBMIT_WORKERS 2
+#endif
+
+#ifndef DEFAULT_ABAG_CANCEL_BATCH_MILLIS
+#define DEFAULT_ABAG_CANCEL_BATCH_MILLIS 250L
+#endif
+
 #ifndef DEFAULT_ABAG_TRADE_WORKERS
 #define DEFAULT_ABAG_TRADE_WORKERS 6
 #endif
@@ -53,10 +63,64 @@
 #define DEFAULT_ABAG_TICKER_WORKERS 12
 #endif
 
+#ifndef DEFAULT_ABAG_STATISTICS_REFRESH_SECONDS
+#define DEFAULT_ABAG_STATISTICS_REFRESH_SECONDS 60
+#endif
+
+#ifndef DEFAULT_ABAG_STATE_FLUSH_MILLIS
+#define DEFAULT_ABAG_STATE_FLUSH_MILLIS 1000L
+#endif
+
+#ifndef DEFAULT_ABAG_STATE_WAL
+#define DEFAULT_ABAG_STATE_WAL ""
+#endif
+
+#ifndef DEFAULT_ABAG_STATE_WAL_SIZE
+#define DEFAULT_ABAG_STATE_WAL_SIZE 16777216L
+#endif
+
+#ifndef DEFAULT_ABAG_STATE_WAL_SYNC_MILLIS
+#define DEFAULT_ABAG_STATE_WAL_SYNC_MILLIS 100L
+#endif
+
+#ifndef DEFAULT_ABAG_DB_TRADING_CONNECTIONS
+#define DEFAULT_ABAG_DB_TRADING_CONNECTIONS 4
+#endif
+
+#ifndef DEFAULT_ABAG_DB_INGEST_CONNECTIONS
+#define DEFAULT_ABAG_DB_INGEST_CONNECTIONS 2
+#endif
+
+#ifndef DEFAULT_ABAG_DB_ANALYTIC_CONNECTIONS
+#define DEFAULT_ABAG_DB_ANALYTIC_CONNECTIONS 4
+#endif
+
+#ifndef DEFAULT_ABAG_SAMPLES_WARMUP_WORKERS
+#define DEFAULT_ABAG_SAMPLES_WARMUP_WORKERS 4
+#endif
+
+#ifndef DEFAULT_ABAG_SAMPLES_ARCHIVE
+#define DEFAULT_ABAG_SAMPLES_ARCHIVE ""
+#endif
+
+#ifndef DEFAULT_ABAG_SAMPLES_ARCHIVE_GAP_MILLIS
+#define DEFAULT_ABAG_SAMPLES_ARCHIVE_GAP_MILLIS 3600000L
+#endif
+
+#ifndef DEFAULT_ABAG_ORDERS_RECONCILE_WORKERS
+#define DEFAULT_ABAG_ORDERS_RECONCILE_WORKERS 4
+#endif
+
+#ifndef DEFAULT_ABAG_LEDGER_REFRESH_MILLIS
+#define DEFAULT_ABAG_LEDGER_REFRESH_MILLIS 60000L
+#endif
+
 #ifndef nitems
 #define nitems(_a) (sizeof((_a)) / sizeof((_a)[0]))
 #endif
 
+#define STATE_WAL_RECORD_MAX 4096
+
 #define TRADE_IS_READY(t) (Numeric_cmp((t)->tp_pc, zero) > 0)
 #define TRADE_SET_READY(t, tp_pc) (Numeric_copy_to((tp_pc), (t)->tp_pc))
 #define TRADE_IS_DELETED(t) (Numeric_cmp((t)->tp_pc, n_one) == 0)
@@ -64,14 +128,31 @@
 #define TRADE_IS_ENQUEUED(t) (Numeric_cmp((t)->tp_pc, n_two) == 0)
 #define TRADE_SET_ENQUEUED(t) (Numeric_copy_to(n_two, (t)->tp_pc))
 #define TRADE_UNSET_ENQUEUED(t) (Numeric_copy_to(zero, (t)->tp_pc))
+#define TRADE_IS_PENDING(t) ((t)->p_long.pending || (t)->p_short.pending)
 
 #define PRODUCTS_MAP_CAPACITY 2048
 #define PRODUCTS_QUEUE_CAPACITY 2048
+#define ORDERS_MAP_CAPACITY 4096
+#define ORDERS_CANCEL_CAPACITY 64
+
+/*
+ * Orders of an exchange to cancel. Requests are collected for a while and
+ * then cancelled together.
+ */
+struct order_cancels {
+  const struct Exchange *restrict e;
+  struct Array *restrict orders;
+  mtx_t mtx;
+  cnd_t cnd;
+};
 
 struct worker_ctx {
-  void *restrict db;
   const struct Exchange *restrict e;
   struct Queue *restrict trades_queue;
+  struct Queue *restrict orders_queue;
+  struct Array *restrict orders_queues;
+  struct Queue *restrict submit_queue;
+  struct order_cancels *restrict cancels;
   struct Market *restrict m;
   const struct MarketConfig *restrict m_cnf;
 };
@@ -83,16 +164,10 @@ struct abag_tls {
   struct position_state_load_vars {
     struct db_position_state_rec *restrict p_state;
   } position_state_load;
-  struct position_state_save_vars {
-    struct db_position_state_rec *restrict p_state;
-  } position_state_save;
   struct trade_state_load_vars {
     struct Numeric *restrict r0;
     struct db_trade_state_rec *restrict t_state;
   } trade_state_load;
-  struct trade_state_save_vars {
-    struct db_trade_state_rec *restrict t_state;
-  } trade_state_save;
   struct samples_per_nano_vars {
     struct Numeric *restrict size;
     struct Numeric *restrict duration;
@@ -106,7 +181,7 @@ struct abag_tls {
   struct samples_load_vars {
     struct Numeric *restrict now;
     struct Numeric *restrict filter;
-    struct db_sample_rec *restrict sample;
+    struct db_sample_rec *restrict samples;
   } samples_load;
   struct quote_return_vars {
     struct Numeric *restrict r0;
@@ -150,6 +225,8 @@ struct abag_tls {
   struct position_trade_vars {
     struct Numeric *restrict o_pr;
     struct Numeric *restrict r0;
+    struct Numeric *restrict q_avail;
+    struct Numeric *restrict b_avail;
   } position_trade;
   struct trade_create_vars {
     struct db_stats_rec *restrict stats;
@@ -173,11 +250,14 @@ struct abag_tls {
     struct Numeric *restrict q_ordered;
     struct Numeric *restrict q_fees;
     struct Numeric *restrict r0;
-    struct db_balance_rec *restrict hold;
   } trade_bet;
   struct trades_load_vars {
     struct db_trade_rec *restrict trade;
   } trades_load;
+  struct state_wal_vars {
+    char rec[STATE_WAL_RECORD_MAX];
+    size_t len;
+  } state_wal;
 };
 
 extern const struct String *restrict const progname;
@@ -206,6 +286,42 @@ static struct Map *restrict market_samples;
 static struct Map *restrict market_prices;
 static struct Map *restrict market_trades;
 static struct Map *restrict market_configs;
+static struct Map *restrict market_stats;
+static struct Map *restrict market_stats_missing;
+static struct Map *restrict market_stats_pending;
+static struct Map *restrict market_graphs;
+static struct Map *restrict market_last_prices;
+static struct Map *restrict order_trades;
+static struct Map *restrict order_strays;
+static struct Map *restrict order_preloads;
+static uintmax_t orders_submitting;
+static unsigned long cancel_batch_millis;
+static struct Map *restrict market_ledgers;
+static unsigned long ledger_refresh_millis;
+static unsigned long stats_refresh_secs;
+static unsigned long state_flush_millis;
+static mtx_t state_mtx;
+static mtx_t state_flush_mtx;
+static cnd_t state_flush_cnd;
+static struct Map *restrict state_trades;
+static struct Map *restrict state_positions;
+static struct Array *restrict state_entries;
+static struct Map *restrict state_flushing_trades;
+static struct Map *restrict state_flushing_positions;
+static size_t state_trade_flushes;
+static struct db_pool *restrict db_trading;
+static struct db_pool *restrict db_ingest;
+static struct db_pool *restrict db_analytic;
+static const char *restrict samples_archive;
+static struct Numeric *restrict samples_archive_gap;
+static struct Map *restrict market_archives;
+static mtx_t plot_mtx;
+static cnd_t plot_cnd;
+static struct Map *restrict plot_jobs;
+static struct Wal *restrict state_wals[2];
+static size_t state_wal;
+static bool state_wal_full;
+static unsigned long state_wal_sync_millis;
 static tss_t abag_tls_key;
 
 static struct Numeric *restrict ninety_percent_factor;
@@ -319,38 +435,22 @@ static struct abag_tls *const abag_tls(void) {
     tls->position_state_load.p_state->tp_price = Numeric_new();
     tls->position_state_load.p_state->tp_nanos = Numeric_new();
     tls->position_state_load.p_state->tp_samples = Numeric_new();
-    tls->position_state_save.p_state =
-        heap_malloc(sizeof(struct db_position_state_rec));
-    tls->position_state_save.p_state->sl_cnt = Numeric_new();
-    tls->position_state_save.p_state->sl_price = Numeric_new();
-    tls->position_state_save.p_state->sl_nanos = Numeric_new();
-    tls->position_state_save.p_state->sl_samples = Numeric_new();
-    tls->position_state_save.p_state->tl_cnt = Numeric_new();
-    tls->position_state_save.p_state->tl_price = Numeric_new();
-    tls->position_state_save.p_state->tl_nanos = Numeric_new();
-    tls->position_state_save.p_state->tl_samples = Numeric_new();
-    tls->position_state_save.p_state->tp_cnt = Numeric_new();
-    tls->position_state_save.p_state->tp_price = Numeric_new();
-    tls->position_state_save.p_state->tp_nanos = Numeric_new();
-    tls->position_state_save.p_state->tp_samples = Numeric_new();
     tls->trade_state_load.r0 = Numeric_new();
     tls->trade_state_load.t_state =
         heap_malloc(sizeof(struct db_trade_state_rec));
     tls->trade_state_load.t_state->fee_pc = Numeric_new();
     tls->trade_state_load.t_state->tp_pc = Numeric_new();
     tls->trade_state_load.t_state->pr_samples = Numeric_new();
-    tls->trade_state_save.t_state =
-        heap_malloc(sizeof(struct db_trade_state_rec));
-    tls->trade_state_save.t_state->fee_pc = Numeric_new();
-    tls->trade_state_save.t_state->tp_pc = Numeric_new();
-    tls->trade_state_save.t_state->pr_samples = Numeric_new();
     tls->samples_per_nano.size = Numeric_new();
     tls->samples_per_nano.duration = Numeric_new();
     tls->samples_per_second.n = Numeric_new();
     tls->samples_per_minute.s = Numeric_new();
-    tls->samples_load.sample = heap_malloc(sizeof(struct db_sample_rec));
-    tls->samples_load.sample->nanos = Numeric_new();
-    tls->samples_load.sample->price = Numeric_new();
+    tls->samples_load.samples =
+        heap_calloc(DATABASE_SAMPLES_FETCH_ROWS, sizeof(struct db_sample_rec));
+    for (size_t i = 0; i < DATABASE_SAMPLES_FETCH_ROWS; i++) {
+      tls->samples_load.samples[i].nanos = Numeric_new();
+      tls->samples_load.samples[i].price = Numeric_new();
+    }
     tls->samples_load.now = Numeric_new();
     tls->samples_load.filter = Numeric_new();
     tls->quote_return.r0 = Numeric_new();
@@ -384,6 +484,8 @@ static struct abag_tls *const abag_tls(void) {
     tls->position_trigger.r0 = Numeric_new();
     tls->position_trade.o_pr = Numeric_new();
     tls->position_trade.r0 = Numeric_new();
+    tls->position_trade.q_avail = Numeric_new();
+    tls->position_trade.b_avail = Numeric_new();
     tls->trade_create.stats = heap_malloc(sizeof(struct db_stats_rec));
     tls->trade_create.stats->bd_min = Numeric_new();
     tls->trade_create.stats->bd_max = Numeric_new();
@@ -399,9 +501,6 @@ static struct abag_tls *const abag_tls(void) {
     tls->trade_timeout.r0 = Numeric_new();
     tls->trade_pricing.ef_pc = Numeric_new();
     tls->trade_pricing.r0 = Numeric_new();
-    tls->trade_bet.hold = heap_malloc(sizeof(struct db_balance_rec));
-    tls->trade_bet.hold->b = Numeric_new();
-    tls->trade_bet.hold->q = Numeric_new();
     tls->trade_bet.b_avail = Numeric_new();
     tls->trade_bet.q_avail = Numeric_new();
     tls->trade_bet.q_costs = Numeric_new();
@@ -445,35 +544,20 @@ static void abag_tls_dtor(void *e) {
   Numeric_delete(tls->position_state_load.p_state->tp_nanos);
   Numeric_delete(tls->position_state_load.p_state->tp_samples);
   heap_free(tls->position_state_load.p_state);
-  Numeric_delete(tls->position_state_save.p_state->sl_cnt);
-  Numeric_delete(tls->position_state_save.p_state->sl_price);
-  Numeric_delete(tls->position_state_save.p_state->sl_nanos);
-  Numeric_delete(tls->position_state_save.p_state->sl_samples);
-  Numeric_delete(tls->position_state_save.p_state->tl_cnt);
-  Numeric_delete(tls->position_state_save.p_state->tl_price);
-  Numeric_delete(tls->position_state_save.p_state->tl_nanos);
-  Numeric_delete(tls->position_state_save.p_state->tl_samples);
-  Numeric_delete(tls->position_state_save.p_state->tp_cnt);
-  Numeric_delete(tls->position_state_save.p_state->tp_price);
-  Numeric_delete(tls->position_state_save.p_state->tp_nanos);
-  Numeric_delete(tls->position_state_save.p_state->tp_samples);
-  heap_free(tls->position_state_save.p_state);
   Numeric_delete(tls->trade_state_load.r0);
   Numeric_delete(tls->trade_state_load.t_state->fee_pc);
   Numeric_delete(tls->trade_state_load.t_state->tp_pc);
   Numeric_delete(tls->trade_state_load.t_state->pr_samples);
   heap_free(tls->trade_state_load.t_state);
-  Numeric_delete(tls->trade_state_save.t_state->fee_pc);
-  Numeric_delete(tls->trade_state_save.t_state->tp_pc);
-  Numeric_delete(tls->trade_state_save.t_state->pr_samples);
-  heap_free(tls->trade_state_save.t_state);
   Numeric_delete(tls->samples_per_nano.size);
   Numeric_delete(tls->samples_per_nano.duration);
   Numeric_delete(tls->samples_per_second.n);
   Numeric_delete(tls->samples_per_minute.s);
-  Numeric_delete(tls->samples_load.sample->nanos);
-  Numeric_delete(tls->samples_load.sample->price);
-  heap_free(tls->samples_load.sample);
+  for (size_t i = 0; i < DATABASE_SAMPLES_FETCH_ROWS; i++) {
+    Numeric_delete(tls->samples_load.samples[i].nanos);
+    Numeric_delete(tls->samples_load.samples[i].price);
+  }
+  heap_free(tls->samples_load.samples);
   Numeric_delete(tls->samples_load.now);
   Numeric_delete(tls->samples_load.filter);
   Numeric_delete(tls->quote_return.r0);
@@ -507,6 +591,8 @@ static void abag_tls_dtor(void *e) {
   Numeric_delete(tls->position_trigger.r0);
   Numeric_delete(tls->position_trade.o_pr);
   Numeric_delete(tls->position_trade.r0);
+  Numeric_delete(tls->position_trade.q_avail);
+  Numeric_delete(tls->position_trade.b_avail);
   Numeric_delete(tls->trade_create.stats->bd_min);
   Numeric_delete(tls->trade_create.stats->bd_max);
   Numeric_delete(tls->trade_create.stats->bd_avg);
@@ -522,9 +608,6 @@ static void abag_tls_dtor(void *e) {
   Numeric_delete(tls->trade_timeout.r0);
   Numeric_delete(tls->trade_pricing.ef_pc);
   Numeric_delete(tls->trade_pricing.r0);
-  Numeric_delete(tls->trade_bet.hold->b);
-  Numeric_delete(tls->trade_bet.hold->q);
-  heap_free(tls->trade_bet.hold);
   Numeric_delete(tls->trade_bet.b_avail);
   Numeric_delete(tls->trade_bet.q_avail);
   Numeric_delete(tls->trade_bet.q_costs);
@@ -697,6 +780,7 @@ static char *candle_string(const struct Candle *restrict const c,
 static inline void position_init(struct Position *restrict const p) {
   p->done = false;
   p->filled = false;
+  p->pending = false;
   p->id = NULL;
   p->cnanos = Numeric_copy(zero);
   p->dnanos = Numeric_copy(zero);
@@ -721,6 +805,7 @@ static inline void position_init(struct Position *restrict const p) {
 static inline void position_reset(struct Position *restrict const p) {
   p->done = false;
   p->filled = false;
+  p->pending = false;
 
   String_delete(p->id);
   p->id = NULL;
@@ -866,39 +951,494 @@ static void position_state_load(const void *restrict const db,
   }
 }
 
-static void position_state_save(const void *restrict const db,
-                                const struct Trade *restrict const t,
-                                const struct Position *restrict const p) {
-  const struct abag_tls *restrict const tls = abag_tls();
-  struct db_position_state_rec *restrict const p_state =
-      tls->position_state_save.p_state;
+/*
+ * State changes are journaled in memory, coalesced per trade and position,
+ * and written in first-changed order by state_flush. A flush writes one
+ * transaction and flushes are serialized, so the database never sees an
+ * older state of a position after a newer one.
+ *
+ * With ABAG_STATE_WAL set, every change is also appended to one of two
+ * memory mapped logs. A flush switches logs and empties the previous one
+ * once the database committed, so after a crash the logs hold exactly the
+ * changes the database is missing and are replayed at startup.
+ *
+ * state_trade_flush writes the entries of a single trade ahead of the rest.
+ * Entries being written are marked flushing, and an entry of the same trade
+ * or position is not written before those have been committed.
+ *
+ * state_discard drops the entries of a trade or position about to be deleted
+ * and logs a tombstone, so a replay does not resurrect them either.
+ */
+struct state_entry {
+  struct String *restrict t_id;
+  struct String *restrict e_id;
+  struct String *restrict m_id;
+  struct String *restrict p_id;
+  struct db_trade_state_rec *restrict t_state;
+  struct db_position_state_rec *restrict p_state;
+};
+
+static void state_entry_delete(void *restrict const e) {
+  if (e == NULL)
+    return;
+
+  struct state_entry *restrict const entry = e;
+  String_delete(entry->t_id);
+  String_delete(entry->e_id);
+  String_delete(entry->m_id);
+  String_delete(entry->p_id);
+
+  if (entry->t_state != NULL) {
+    Numeric_delete(entry->t_state->fee_pc);
+    Numeric_delete(entry->t_state->tp_pc);
+    Numeric_delete(entry->t_state->pr_samples);
+    heap_free(entry->t_state);
+  }
+
+  if (entry->p_state != NULL) {
+    Numeric_delete(entry->p_state->sl_cnt);
+    Numeric_delete(entry->p_state->sl_price);
+    Numeric_delete(entry->p_state->sl_nanos);
+    Numeric_delete(entry->p_state->sl_samples);
+    Numeric_delete(entry->p_state->tl_cnt);
+    Numeric_delete(entry->p_state->tl_price);
+    Numeric_delete(entry->p_state->tl_nanos);
+    Numeric_delete(entry->p_state->tl_samples);
+    Numeric_delete(entry->p_state->tp_cnt);
+    Numeric_delete(entry->p_state->tp_price);
+    Numeric_delete(entry->p_state->tp_nanos);
+    Numeric_delete(entry->p_state->tp_samples);
+    heap_free(entry->p_state);
+  }
+
+  heap_free(entry);
+}
+
+static struct state_entry *
+state_trade_entry(struct String *restrict const t_id) {
+  struct state_entry *restrict e = Map_get(state_trades, t_id);
+
+  if (e == NULL) {
+    e = heap_calloc(1, sizeof(struct state_entry));
+    e->t_id = String_copy(t_id);
+    e->t_state = heap_malloc(sizeof(struct db_trade_state_rec));
+    e->t_state->fee_pc = Numeric_new();
+    e->t_state->tp_pc = Numeric_new();
+    e->t_state->pr_samples = Numeric_new();
+    Map_put(state_trades, t_id, e);
+    Array_add_tail(state_entries, e);
+  }
+
+  return e;
+}
+
+static struct state_entry *
+state_position_entry(struct String *restrict const e_id,
+                     struct String *restrict const m_id,
+                     struct String *restrict const p_id) {
+  struct state_entry *restrict e = Map_get(state_positions, p_id);
+
+  if (e == NULL) {
+    e = heap_calloc(1, sizeof(struct state_entry));
+    e->e_id = String_copy(e_id);
+    e->m_id = String_copy(m_id);
+    e->p_id = String_copy(p_id);
+    e->p_state = heap_malloc(sizeof(struct db_position_state_rec));
+    e->p_state->sl_cnt = Numeric_new();
+    e->p_state->sl_price = Numeric_new();
+    e->p_state->sl_nanos = Numeric_new();
+    e->p_state->sl_samples = Numeric_new();
+    e->p_state->tl_cnt = Numeric_new();
+    e->p_state->tl_price = Numeric_new();
+    e->p_state->tl_nanos = Numeric_new();
+    e->p_state->tl_samples = Numeric_new();
+    e->p_state->tp_cnt = Numeric_new();
+    e->p_state->tp_price = Numeric_new();
+    e->p_state->tp_nanos = Numeric_new();
+    e->p_state->tp_samples = Numeric_new();
+    Map_put(state_positions, p_id, e);
+    Array_add_tail(state_entries, e);
+  }
+
+  return e;
+}
+
+static bool state_wal_put(struct state_wal_vars *restrict const r,
+                          const char *restrict const v) {
+  const size_t len = strlen(v) + 1;
+
+  if (len > sizeof(r->rec) - r->len)
+    return false;
+
+  memcpy(r->rec + r->len, v, len);
+  r->len += len;
+  return true;
+}
+
+static bool state_wal_put_numeric(struct state_wal_vars *restrict const r,
+                                  const struct Numeric *restrict const n) {
+  const size_t len =
+      Numeric_to_buf(n, -1, r->rec + r->len, sizeof(r->rec) - r->len);
+
+  if (len == 0)
+    return false;
+
+  r->len += len + 1;
+  return true;
+}
+
+static bool state_wal_put_cnt(struct state_wal_vars *restrict const r,
+                              const uintmax_t cnt) {
+  // XXX: uintmax_t -> long
+  const int len = snprintf(r->rec + r->len, sizeof(r->rec) - r->len, "%ld",
+                           (long)cnt);
+
+  if (len < 0 || (size_t)len >= sizeof(r->rec) - r->len)
+    return false;
+
+  r->len += (size_t)len + 1;
+  return true;
+}
+
+static bool
+state_wal_put_trigger(struct state_wal_vars *restrict const r,
+                      const struct Trigger *restrict const trg,
+                      const struct Numeric *restrict const samples) {
+  return state_wal_put_cnt(r, trg->cnt) &&
+         state_wal_put_numeric(r, trg->price) &&
+         state_wal_put_numeric(r, trg->nanos) &&
+         state_wal_put_numeric(r, samples);
+}
+
+static struct state_wal_vars *
+state_wal_record(struct state_wal_vars *restrict const r, const bool ok) {
+  if (ok)
+    return r;
+
+  werr("%s: State log record too long; change is not crash safe until "
+       "flushed\n",
+       String_chars(progname));
+
+  return NULL;
+}
+
+/*
+ * Records are NUL terminated fields. They are built in a buffer of the calling
+ * thread before taking state_mtx, so that holding it costs a copy into the
+ * log. Returns NULL without a log or if the record does not fit.
+ */
+static struct state_wal_vars *
+state_wal_position(const struct Trade *restrict const t,
+                   const struct Position *restrict const p) {
+  if (state_wals[0] == NULL)
+    return NULL;
+
+  struct state_wal_vars *restrict const r = &abag_tls()->state_wal;
+  r->len = 0;
+
+  return state_wal_record(
+      r, state_wal_put(r, "P") && state_wal_put(r, String_chars(t->e_id)) &&
+             state_wal_put(r, String_chars(t->m_id)) &&
+             state_wal_put(r, String_chars(p->id)) &&
+             state_wal_put_trigger(r, &p->sl_trg, p->sl_samples) &&
+             state_wal_put_trigger(r, &p->tl_trg, p->tl_samples) &&
+             state_wal_put_trigger(r, &p->tp_trg, p->tp_samples) &&
+             state_wal_put(r, p->sl_trg.set ? "1" : "0") &&
+             state_wal_put(r, p->tl_trg.set ? "1" : "0") &&
+             state_wal_put(r, p->tp_trg.set ? "1" : "0"));
+}
+
+static struct state_wal_vars *
+state_wal_trade(const struct Trade *restrict const t) {
+  if (state_wals[0] == NULL)
+    return NULL;
+
+  struct state_wal_vars *restrict const r = &abag_tls()->state_wal;
+  r->len = 0;
+
+  return state_wal_record(
+      r, state_wal_put(r, "T") && state_wal_put(r, String_chars(t->id)) &&
+             state_wal_put_numeric(r, t->fee_pc) &&
+             state_wal_put_numeric(r, TRADE_IS_READY(t) ? t->tp_pc : zero) &&
+             state_wal_put_numeric(r, t->pr_samples));
+}
+
+// Tombstone of a trade and positions removed from the journal.
+static struct state_wal_vars *
+state_wal_discard(const struct String *restrict const t_id,
+                  const struct String *restrict const l_id,
+                  const struct String *restrict const s_id) {
+  if (state_wals[0] == NULL)
+    return NULL;
+
+  struct state_wal_vars *restrict const r = &abag_tls()->state_wal;
+  r->len = 0;
+
+  return state_wal_record(
+      r, state_wal_put(r, "D") &&
+             state_wal_put(r, t_id != NULL ? String_chars(t_id) : "") &&
+             state_wal_put(r, l_id != NULL ? String_chars(l_id) : "") &&
+             state_wal_put(r, s_id != NULL ? String_chars(s_id) : ""));
+}
+
+// Called with state_mtx held. Returns the log to pass to state_wal_sync once
+// state_mtx is released, so concurrent writers share a single sync.
+static struct Wal *
+state_wal_append(const struct state_wal_vars *restrict const r) {
+  if (r == NULL)
+    return NULL;
+
+  if (!Wal_append(state_wals[state_wal], r->rec, r->len)) {
+    if (!state_wal_full)
+      werr("%s: State log full; changes are not crash safe until flushed\n",
+           String_chars(progname));
+
+    state_wal_full = true;
+  } else if (state_wal_sync_millis == 0)
+    return state_wals[state_wal];
+
+  return NULL;
+}
+
+static void state_wal_sync(struct Wal *restrict const w) {
+  if (w != NULL)
+    Wal_sync(w);
+}
+
+static void state_numeric_set(const char *restrict const v,
+                              struct Numeric *restrict const n) {
+  struct Numeric *restrict const r = Numeric_from_char(v);
+  Numeric_copy_to(r, n);
+  Numeric_delete(r);
+}
+
+static void state_entry_take(struct Array *restrict const entries,
+                             struct Map *restrict const map,
+                             struct String *restrict const id) {
+  struct state_entry *restrict const e =
+      id != NULL ? Map_remove(map, id) : NULL;
+
+  if (e == NULL)
+    return;
+
+  void *const *restrict const items = Array_items(state_entries);
+  for (size_t i = Array_size(state_entries); i-- > 0;)
+    if (items[i] == e) {
+      Array_remove_idx(state_entries, i);
+      break;
+    }
+
+  Array_add_tail(entries, e);
+}
+
+// Replays a logged record into the journal before any worker is started.
+static void state_wal_apply(const char *restrict const data, const size_t len,
+                            void *restrict const arg) {
+  (void)arg;
+  const char *f[19];
+  size_t cnt = 0;
+
+  for (size_t i = 0; i < len && cnt < nitems(f); i += strlen(data + i) + 1)
+    f[cnt++] = data + i;
+
+  if (cnt == 19 && strcmp(f[0], "P") == 0) {
+    struct String *restrict const e_id = String_cnew(f[1]);
+    struct String *restrict const m_id = String_cnew(f[2]);
+    struct String *restrict const p_id = String_cnew(f[3]);
+    struct db_position_state_rec *restrict const p_state =
+        state_position_entry(e_id, m_id, p_id)->p_state;
+
+    state_numeric_set(f[4], p_state->sl_cnt);
+    state_numeric_set(f[5], p_state->sl_price);
+    state_numeric_set(f[6], p_state->sl_nanos);
+    state_numeric_set(f[7], p_state->sl_samples);
+    state_numeric_set(f[8], p_state->tl_cnt);
+    state_numeric_set(f[9], p_state->tl_price);
+    state_numeric_set(f[10], p_state->tl_nanos);
+    state_numeric_set(f[11], p_state->tl_samples);
+    state_numeric_set(f[12], p_state->tp_cnt);
+    state_numeric_set(f[13], p_state->tp_price);
+    state_numeric_set(f[14], p_state->tp_nanos);
+    state_numeric_set(f[15], p_state->tp_samples);
+    p_state->sl = f[16][0] == '1';
+    p_state->tl = f[17][0] == '1';
+    p_state->tp = f[18][0] == '1';
+
+    String_delete(e_id);
+    String_delete(m_id);
+    String_delete(p_id);
+  } else if (cnt == 5 && strcmp(f[0], "T") == 0) {
+    struct String *restrict const t_id = String_cnew(f[1]);
+    struct db_trade_state_rec *restrict const t_state =
+        state_trade_entry(t_id)->t_state;
+
+    state_numeric_set(f[2], t_state->fee_pc);
+    state_numeric_set(f[3], t_state->tp_pc);
+    state_numeric_set(f[4], t_state->pr_samples);
+
+    String_delete(t_id);
+  } else if (cnt == 4 && strcmp(f[0], "D") == 0) {
+    struct Array *restrict const entries = Array_new(3);
+
+    for (size_t i = 1; i < cnt; i++) {
+      if (*f[i] == '\0')
+        continue;
+
+      struct String *restrict const id = String_cnew(f[i]);
+      state_entry_take(entries, i == 1 ? state_trades : state_positions, id);
+      String_delete(id);
+    }
+
+    Array_delete(entries, state_entry_delete);
+  } else
+    werr("%s: Ignoring malformed state log record\n", String_chars(progname));
+}
+
+static bool state_entry_flushing(const struct state_entry *restrict const e) {
+  return e->p_state != NULL
+             ? Map_get(state_flushing_positions, e->p_id) != NULL
+             : Map_get(state_flushing_trades, e->t_id) != NULL;
+}
+
+static bool
+state_entries_flushing(const struct Array *restrict const entries) {
+  void *const *restrict const items = Array_items(entries);
+
+  for (size_t i = Array_size(entries); i-- > 0;)
+    if (state_entry_flushing(items[i]))
+      return true;
+
+  return false;
+}
+
+// Called with state_mtx held.
+static void state_entries_mark(const struct Array *restrict const entries,
+                               const bool flushing) {
+  void *const *restrict const items = Array_items(entries);
+
+  for (size_t i = Array_size(entries); i-- > 0;) {
+    struct state_entry *restrict const e = items[i];
+
+    if (e->p_state != NULL) {
+      if (flushing)
+        Map_put(state_flushing_positions, e->p_id, e);
+      else
+        Map_remove(state_flushing_positions, e->p_id);
+    } else if (flushing)
+      Map_put(state_flushing_trades, e->t_id, e);
+    else
+      Map_remove(state_flushing_trades, e->t_id);
+  }
+
+  if (!flushing)
+    condition_broadcast(&state_flush_cnd);
+}
 
-  if (p->id != NULL) {
-    // XXX: uintmax_t -> long
-    Numeric_from_long_to(p->sl_trg.cnt, p_state->sl_cnt);
-    Numeric_copy_to(p->sl_trg.price, p_state->sl_price);
-    Numeric_copy_to(p->sl_trg.nanos, p_state->sl_nanos);
-    Numeric_copy_to(p->sl_samples, p_state->sl_samples);
-    p_state->sl = p->sl_trg.set;
+static void state_entries_persist(const void *restrict const db,
+                                  const struct Array *restrict const entries) {
+  void *const *restrict const items = Array_items(entries);
 
-    // XXX: uintmax_t -> long
-    Numeric_from_long_to(p->tl_trg.cnt, p_state->tl_cnt);
-    Numeric_copy_to(p->tl_trg.price, p_state->tl_price);
-    Numeric_copy_to(p->tl_trg.nanos, p_state->tl_nanos);
-    Numeric_copy_to(p->tl_samples, p_state->tl_samples);
-    p_state->tl = p->tl_trg.set;
+  if (Array_size(entries) == 0)
+    return;
+
+  db_tx_begin(db);
+
+  for (size_t i = 0; i < Array_size(entries); i++) {
+    const struct state_entry *restrict const e = items[i];
+
+    if (e->p_state != NULL)
+      db_tx_position_state_persist(db, String_chars(process_id),
+                                   String_chars(e->e_id),
+                                   String_chars(e->m_id),
+                                   String_chars(e->p_id), e->p_state);
+    else
+      db_tx_trade_state_persist(db, String_chars(process_id),
+                                String_chars(e->t_id), e->t_state);
+  }
 
-    // XXX: uintmax_t -> long
-    Numeric_from_long_to(p->tp_trg.cnt, p_state->tp_cnt);
-    Numeric_copy_to(p->tp_trg.price, p_state->tp_price);
-    Numeric_copy_to(p->tp_trg.nanos, p_state->tp_nanos);
-    Numeric_copy_to(p->tp_samples, p_state->tp_samples);
-    p_state->tp = p->tp_trg.set;
+  db_tx_commit(db);
+}
 
-    db_position_state_persist(db, String_chars(process_id),
-                              String_chars(t->e_id), String_chars(t->m_id),
-                              String_chars(p->id), p_state);
+static void state_flush(const void *restrict const db) {
+  mutex_lock(&state_flush_mtx);
+
+  mutex_lock(&state_mtx);
+  struct Array *restrict const entries = state_entries;
+  state_entries = Array_new(PRODUCTS_MAP_CAPACITY);
+  Map_delete(state_trades, NULL);
+  Map_delete(state_positions, NULL);
+  state_trades = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  state_positions = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+
+  struct Wal *restrict wal = NULL;
+  if (state_wals[0] != NULL && Array_size(entries) > 0) {
+    wal = state_wals[state_wal];
+    state_wal ^= 1;
+    Wal_reset(state_wals[state_wal], Wal_seq(wal) + 1);
+    state_wal_full = false;
   }
+
+  while (state_entries_flushing(entries))
+    condition_wait(&state_flush_cnd, &state_mtx);
+
+  state_entries_mark(entries, true);
+  mutex_unlock(&state_mtx);
+
+  state_entries_persist(db, entries);
+
+  mutex_lock(&state_mtx);
+  state_entries_mark(entries, false);
+
+  // Trades flushed ahead may have taken entries logged before the switch.
+  while (wal != NULL && state_trade_flushes > 0)
+    condition_wait(&state_flush_cnd, &state_mtx);
+  mutex_unlock(&state_mtx);
+
+  if (wal != NULL)
+    Wal_reset(wal, Wal_seq(wal));
+
+  mutex_unlock(&state_flush_mtx);
+  Array_delete(entries, state_entry_delete);
+}
+
+static void position_state_save(const struct Trade *restrict const t,
+                                const struct Position *restrict const p) {
+  if (p->id == NULL)
+    return;
+
+  const struct state_wal_vars *restrict const r = state_wal_position(t, p);
+
+  mutex_lock(&state_mtx);
+
+  struct state_entry *restrict const e =
+      state_position_entry(t->e_id, t->m_id, p->id);
+
+  struct db_position_state_rec *restrict const p_state = e->p_state;
+
+  // XXX: uintmax_t -> long
+  Numeric_from_long_to(p->sl_trg.cnt, p_state->sl_cnt);
+  Numeric_copy_to(p->sl_trg.price, p_state->sl_price);
+  Numeric_copy_to(p->sl_trg.nanos, p_state->sl_nanos);
+  Numeric_copy_to(p->sl_samples, p_state->sl_samples);
+  p_state->sl = p->sl_trg.set;
+
+  // XXX: uintmax_t -> long
+  Numeric_from_long_to(p->tl_trg.cnt, p_state->tl_cnt);
+  Numeric_copy_to(p->tl_trg.price, p_state->tl_price);
+  Numeric_copy_to(p->tl_trg.nanos, p_state->tl_nanos);
+  Numeric_copy_to(p->tl_samples, p_state->tl_samples);
+  p_state->tl = p->tl_trg.set;
+
+  // XXX: uintmax_t -> long
+  Numeric_from_long_to(p->tp_trg.cnt, p_state->tp_cnt);
+  Numeric_copy_to(p->tp_trg.price, p_state->tp_price);
+  Numeric_copy_to(p->tp_trg.nanos, p_state->tp_nanos);
+  Numeric_copy_to(p->tp_samples, p_state->tp_samples);
+  p_state->tp = p->tp_trg.set;
+
+  struct Wal *restrict const w = state_wal_append(r);
+  mutex_unlock(&state_mtx);
+  state_wal_sync(w);
 }
 
 static void trade_state_load(const void *restrict const db,
@@ -926,23 +1466,98 @@ static void trade_state_load(const void *restrict const db,
   position_state_load(db, t, &t->p_short);
 }
 
-static void trade_state_save(const void *restrict const db,
-                             const struct Trade *restrict const t) {
-  const struct abag_tls *restrict const tls = abag_tls();
-  struct db_trade_state_rec *restrict const t_state =
-      tls->trade_state_save.t_state;
-
+static void trade_state_save(const struct Trade *restrict const t) {
   if (t->id != NULL) {
-    Numeric_copy_to(t->fee_pc, t_state->fee_pc);
-    Numeric_copy_to(TRADE_IS_READY(t) ? t->tp_pc : zero, t_state->tp_pc);
-    Numeric_copy_to(t->pr_samples, t_state->pr_samples);
+    const struct state_wal_vars *restrict const r = state_wal_trade(t);
+
+    mutex_lock(&state_mtx);
+
+    struct state_entry *restrict const e = state_trade_entry(t->id);
+
+    Numeric_copy_to(t->fee_pc, e->t_state->fee_pc);
+    Numeric_copy_to(TRADE_IS_READY(t) ? t->tp_pc : zero, e->t_state->tp_pc);
+    Numeric_copy_to(t->pr_samples, e->t_state->pr_samples);
 
-    db_trade_state_persist(db, String_chars(process_id), String_chars(t->id),
-                           t_state);
+    struct Wal *restrict const w = state_wal_append(r);
+    mutex_unlock(&state_mtx);
+    state_wal_sync(w);
   }
 
-  position_state_save(db, t, &t->p_long);
-  position_state_save(db, t, &t->p_short);
+  position_state_save(t, &t->p_long);
+  position_state_save(t, &t->p_short);
+}
+
+/*
+ * Writes the journaled state of a trade and its positions, but nothing else,
+ * so that orders of different markets are placed without waiting for each
+ * other or for the whole journal.
+ */
+static void state_trade_flush(const void *restrict const db,
+                              struct Trade *restrict const t) {
+  struct Array *restrict const entries = Array_new(3);
+
+  mutex_lock(&t->mtx);
+  trade_state_save(t);
+  struct String *restrict const t_id = t->id ? String_copy(t->id) : NULL;
+  struct String *restrict const l_id =
+      t->p_long.id ? String_copy(t->p_long.id) : NULL;
+  struct String *restrict const s_id =
+      t->p_short.id ? String_copy(t->p_short.id) : NULL;
+  mutex_unlock(&t->mtx);
+
+  mutex_lock(&state_mtx);
+  state_trade_flushes++;
+  state_entry_take(entries, state_trades, t_id);
+  state_entry_take(entries, state_positions, l_id);
+  state_entry_take(entries, state_positions, s_id);
+
+  while (state_entries_flushing(entries))
+    condition_wait(&state_flush_cnd, &state_mtx);
+
+  state_entries_mark(entries, true);
+  mutex_unlock(&state_mtx);
+
+  state_entries_persist(db, entries);
+
+  mutex_lock(&state_mtx);
+  state_entries_mark(entries, false);
+  state_trade_flushes--;
+  condition_broadcast(&state_flush_cnd);
+  mutex_unlock(&state_mtx);
+
+  Array_delete(entries, state_entry_delete);
+  String_delete(t_id);
+  String_delete(l_id);
+  String_delete(s_id);
+}
+
+/*
+ * Drops the journaled state of a trade or positions whose rows are deleted, and
+ * logs a tombstone so that neither a flush nor a replay writes it back. Called
+ * before deleting the rows, waiting for any write of the state in progress.
+ */
+static void state_discard(struct String *restrict const t_id,
+                          struct String *restrict const l_id,
+                          struct String *restrict const s_id) {
+  struct Array *restrict const entries = Array_new(3);
+  const struct state_wal_vars *restrict const r =
+      state_wal_discard(t_id, l_id, s_id);
+
+  mutex_lock(&state_mtx);
+  while ((t_id != NULL && Map_get(state_flushing_trades, t_id) != NULL) ||
+         (l_id != NULL && Map_get(state_flushing_positions, l_id) != NULL) ||
+         (s_id != NULL && Map_get(state_flushing_positions, s_id) != NULL))
+    condition_wait(&state_flush_cnd, &state_mtx);
+
+  state_entry_take(entries, state_trades, t_id);
+  state_entry_take(entries, state_positions, l_id);
+  state_entry_take(entries, state_positions, s_id);
+
+  struct Wal *restrict const w = state_wal_append(r);
+  mutex_unlock(&state_mtx);
+  state_wal_sync(w);
+
+  Array_delete(entries, state_entry_delete);
 }
 
 static inline struct Trade *trade_new(struct String *restrict const e_id,
@@ -991,6 +1606,77 @@ static inline void trade_delete(void *restrict const t) {
   heap_free(trade);
 }
 
+struct Trade *Trade_new(struct String *restrict const e_id,
+                        struct String *restrict const m_id) {
+  return trade_new(e_id, m_id);
+}
+
+void Trade_delete(void *restrict const t) { trade_delete(t); }
+
+/*
+ * Deletes a trade removed from the trades of its market, unless an order is
+ * being submitted for it, in which case the submit worker deletes it. Called
+ * with the lock of the trade held, which is released.
+ */
+static void trade_release(struct Trade *restrict const t) {
+  if (TRADE_IS_PENDING(t)) {
+    TRADE_UNSET_ENQUEUED(t);
+    mutex_unlock(&t->mtx);
+  } else {
+    mutex_unlock(&t->mtx);
+    trade_delete(t);
+  }
+}
+
+/*
+ * Index of the trades by the ids of the orders of their positions. Entries
+ * are added whenever an exchange hands out an order id and removed before
+ * the id is cleared or the trade is removed from the trades of its market,
+ * both while holding the lock of those trades.
+ */
+static inline void order_index_put(struct String *restrict const o_id,
+                                   struct Trade *restrict const t) {
+  Map_lock(order_trades);
+  Map_put(order_trades, o_id, t);
+  Map_unlock(order_trades);
+}
+
+static inline void order_index_remove(struct String *restrict const o_id,
+                                      const struct Trade *restrict const t) {
+  if (o_id == NULL)
+    return;
+
+  Map_lock(order_trades);
+  if (Map_get(order_trades, o_id) == t)
+    Map_remove(order_trades, o_id);
+  Map_unlock(order_trades);
+}
+
+static inline void order_index_trade_remove(struct Trade *restrict const t) {
+  order_index_remove(t->p_long.id, t);
+  order_index_remove(t->p_short.id, t);
+}
+
+static inline struct Trade *
+order_index_get(struct String *restrict const o_id) {
+  Map_lock(order_trades);
+  struct Trade *restrict const t = Map_get(order_trades, o_id);
+  Map_unlock(order_trades);
+  return t;
+}
+
+/*
+ * Orders fetched in bulk at startup, handed out once to the position they
+ * have been placed for. Order events received meanwhile supersede them.
+ */
+static inline struct Order *
+order_preload_take(const struct String *restrict const o_id) {
+  Map_lock(order_preloads);
+  struct Order *restrict const o = Map_remove(order_preloads, (void *)o_id);
+  Map_unlock(order_preloads);
+  return o;
+}
+
 void samples_per_nano(struct Numeric *restrict const ret,
                       const struct Array *restrict const samples) {
   const struct abag_tls *restrict const tls = abag_tls();
@@ -1032,12 +1718,65 @@ void samples_per_minute(struct Numeric *restrict const ret,
   Numeric_mul_to(s, minute_nanos, ret);
 }
 
+static void
+samples_archive_path(char *restrict const path, const size_t len,
+                     const struct worker_ctx *restrict const w_ctx) {
+  const int r =
+      snprintf(path, len, "%s/%s-%s.samples", samples_archive,
+               String_chars(w_ctx->e->id), String_chars(w_ctx->m->id));
+
+  if (r < 0 || (size_t)r >= len)
+    panic();
+}
+
+static void
+samples_archive_append(const struct worker_ctx *restrict const w_ctx,
+                       const struct Sample *restrict const sample) {
+  Map_lock(market_archives);
+  struct Archive *restrict archive = Map_get(market_archives, w_ctx->m->id);
+
+  if (archive == NULL) {
+    char path[BUFSIZ] = {0};
+    samples_archive_path(path, sizeof(path), w_ctx);
+    archive = Archive_new(path);
+    Map_put(market_archives, w_ctx->m->id, archive);
+  }
+  Map_unlock(market_archives);
+
+  if (!Archive_append(archive, sample->nanos, sample->price)) {
+    char *restrict const price = Numeric_to_char(sample->price, -1);
+
+    werr("%s: %s: Archive: Price not representable: %s\n",
+         String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm), price);
+
+    Numeric_char_free(price);
+  }
+}
+
+struct samples_archive_ctx {
+  struct Array *restrict a;
+  struct String *restrict m_id;
+};
+
+static void samples_archived(struct Numeric *restrict const nanos,
+                             struct Numeric *restrict const price,
+                             void *restrict const arg) {
+  const struct samples_archive_ctx *restrict const ctx = arg;
+  struct Sample *restrict const s = Sample_new();
+
+  s->m_id = String_copy(ctx->m_id);
+  s->nanos = nanos;
+  s->price = price;
+  Array_add_tail(ctx->a, s);
+}
+
 static void samples_load(struct Array *restrict const a,
                          const struct worker_ctx *restrict const w_ctx) {
   const struct abag_tls *restrict const tls = abag_tls();
   struct Numeric *restrict const now = tls->samples_load.now;
   struct Numeric *restrict const filter = tls->samples_load.filter;
-  struct db_sample_rec *restrict const sample = tls->samples_load.sample;
+  struct db_sample_rec *restrict const recs = tls->samples_load.samples;
+  size_t cnt;
 
   if (w_ctx->m_cnf == NULL || w_ctx->m_cnf->wnanos == NULL)
     return;
@@ -1045,20 +1784,46 @@ static void samples_load(struct Array *restrict const a,
   nanos_now(now);
   Numeric_sub_to(now, w_ctx->m_cnf->wnanos, filter);
 
-  db_samples_open(w_ctx->db, String_chars(w_ctx->e->id),
-                  String_chars(w_ctx->m->id), filter);
+  // The archive is used only if it covers the whole window up to now. An
+  // archive with a gap, e.g. from downtime, is left to the database, which
+  // has been fed by other processes meanwhile.
+  if (*samples_archive) {
+    char path[BUFSIZ] = {0};
+    struct samples_archive_ctx ctx = {
+        .a = a,
+        .m_id = w_ctx->m->id,
+    };
+
+    samples_archive_path(path, sizeof(path), w_ctx);
 
-  while (!terminated && db_samples_next(sample, w_ctx->db)) {
-    struct Sample *restrict const s = Sample_new();
-    s->m_id = String_copy(w_ctx->m->id);
-    s->nanos = Numeric_copy(sample->nanos);
-    s->price = Numeric_copy(sample->price);
+    if (Archive_load(path, filter, now, samples_archive_gap, samples_archived,
+                     &ctx) >= 0)
+      goto ret;
 
-    Array_add_tail(a, s);
+    Array_clear(a, Sample_delete);
   }
 
-  db_samples_close(w_ctx->db);
+  void *restrict const db = db_pool_acquire(db_analytic);
+
+  db_samples_open(db, String_chars(w_ctx->e->id), String_chars(w_ctx->m->id),
+                  filter);
+
+  while (!terminated && (cnt = db_samples_fetch(recs, db)) > 0)
+    for (size_t i = 0; i < cnt; i++) {
+      struct Sample *restrict const s = Sample_new();
+      s->m_id = String_copy(w_ctx->m->id);
+      // Hand the fetched numbers over instead of copying them.
+      s->nanos = recs[i].nanos;
+      s->price = recs[i].price;
+      recs[i].nanos = Numeric_new();
+      recs[i].price = Numeric_new();
+
+      Array_add_tail(a, s);
+    }
 
+  db_samples_close(db);
+  db_pool_release(db_analytic, db);
+ret:
   if (verbose && !terminated && Array_size(a) > 1) {
     const struct Sample *restrict const s_head = Array_head(a);
     const struct Sample *restrict const s_tail = Array_tail(a);
@@ -1073,68 +1838,287 @@ static void samples_load(struct Array *restrict const a,
   }
 }
 
-static bool quote_return(struct Numeric *restrict const q_return,
-                         const struct worker_ctx *restrict const w_ctx) {
-  const struct abag_tls *restrict const tls = abag_tls();
-  struct Numeric *restrict const r0 = tls->quote_return.r0;
-  void *const *restrict items;
-
-  if (w_ctx->m_cnf == NULL)
-    return false;
-
-  if (!String_equals(w_ctx->m->q_id, w_ctx->m_cnf->r_id)) {
-    struct Market *restrict q_m = NULL;
-    struct Market *restrict b_m = NULL;
-    struct Array *restrict const markets = w_ctx->e->markets();
+struct samples_warmup_ctx {
+  struct Array *restrict jobs;
+  size_t next;
+  size_t done;
+  size_t cnt;
+  mtx_t mtx;
+};
 
-    items = Array_items(markets);
-    for (size_t i = Array_size(markets); i-- > 0;) {
-      struct Market *restrict const needle = items[i];
+static int samples_warmup_worker(void *restrict const arg) {
+  struct samples_warmup_ctx *restrict const ctx = arg;
+  void *const *restrict const items = Array_items(ctx->jobs);
 
-      if (String_equals(needle->q_id, w_ctx->m_cnf->r_id) &&
-          String_equals(needle->b_id, w_ctx->m->q_id))
-        q_m = needle;
+  while (!terminated) {
+    mutex_lock(&ctx->mtx);
 
-      if (String_equals(needle->b_id, w_ctx->m_cnf->r_id) &&
-          String_equals(needle->q_id, w_ctx->m->q_id))
-        b_m = needle;
+    if (ctx->next == Array_size(ctx->jobs)) {
+      mutex_unlock(&ctx->mtx);
+      break;
     }
 
-    struct String *restrict q_m_id = q_m != NULL ? String_copy(q_m->id) : NULL;
-    struct String *restrict b_m_id = b_m != NULL ? String_copy(b_m->id) : NULL;
-    q_m = NULL;
-    b_m = NULL;
-    Array_unlock(markets);
+    const struct worker_ctx *restrict const w_ctx = items[ctx->next++];
+    mutex_unlock(&ctx->mtx);
 
-    if (q_m_id == NULL && b_m_id == NULL) {
-      werr("%s: %s: Markets: Not available: %s@%s %s@%s\n",
-           String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
-           String_chars(w_ctx->m->q_id), String_chars(w_ctx->m_cnf->r_id),
-           String_chars(w_ctx->m_cnf->r_id), String_chars(w_ctx->m->q_id));
+    Map_lock(market_samples);
+    struct Array *restrict const samples =
+        Map_get(market_samples, w_ctx->m->id);
+    Map_unlock(market_samples);
 
-      return false;
-    }
+    Array_lock(samples);
+    samples_load(samples, w_ctx);
+    const size_t s_cnt = Array_size(samples);
+    Array_unlock(samples);
+
+    mutex_lock(&ctx->mtx);
+    ctx->cnt += s_cnt;
+    const size_t done = ++ctx->done;
+    const size_t cnt = ctx->cnt;
+    mutex_unlock(&ctx->mtx);
+
+    if (verbose && (done * 10 / Array_size(ctx->jobs) !=
+                    (done - 1) * 10 / Array_size(ctx->jobs)))
+      wout("Warm-up: %zu/%zu markets, %zu tickers\n", done,
+           Array_size(ctx->jobs), cnt);
+  }
+
+  return 0;
+}
+
+static void worker_ctx_delete(void *restrict const w_ctx) {
+  if (w_ctx == NULL)
+    return;
+
+  Market_delete(((struct worker_ctx *)w_ctx)->m);
+  heap_free(w_ctx);
+}
+
+/*
+ * Loads the sample windows of all configured markets before any ticker
+ * worker runs, so that the first tick of a market does not stall on the
+ * database. Markets not known at this point are still loaded on first tick.
+ */
+static void samples_warmup(const size_t workers) {
+  if (workers == 0)
+    return;
+
+  struct Array *restrict const jobs = Array_new(PRODUCTS_MAP_CAPACITY);
+  void *const *restrict const items = Array_items(exchanges);
 
-    struct Array *restrict q_samples = NULL;
-    struct Array *restrict b_samples = NULL;
+  for (size_t i = Array_size(exchanges); i-- > 0;) {
+    const struct Exchange *restrict const e = items[i];
+    struct Array *restrict const markets = e->markets();
+    void *const *restrict const m_items = Array_items(markets);
 
     Map_lock(market_samples);
+    for (size_t j = Array_size(markets); j-- > 0;) {
+      const struct Market *restrict const m = m_items[j];
 
-    if (q_m_id != NULL)
-      q_samples = Map_get(market_samples, q_m_id);
+      if (!m->is_tradeable || Map_get(market_samples, m->id) != NULL)
+        continue;
 
-    if (b_m_id != NULL)
-      b_samples = Map_get(market_samples, b_m_id);
+      const struct MarketConfig *restrict const m_cnf =
+          marketconfig(e->nm, m->nm);
+
+      if (m_cnf == NULL || m_cnf->wnanos == NULL)
+        continue;
+
+      struct worker_ctx *restrict const w_ctx =
+          heap_calloc(1, sizeof(struct worker_ctx));
 
+      w_ctx->e = e;
+      w_ctx->m = Market_copy(m);
+      w_ctx->m_cnf = m_cnf;
+      Map_put(market_samples, w_ctx->m->id, Array_new(524288));
+      Array_add_tail(jobs, w_ctx);
+    }
     Map_unlock(market_samples);
 
-    String_delete(q_m_id);
-    String_delete(b_m_id);
-    q_m_id = NULL;
-    b_m_id = NULL;
+    Array_unlock(markets);
+  }
 
-    if (q_samples == NULL && b_samples == NULL) {
-      werr("%s: %s: Tickers: Not available: %s@%s %s@%s\n",
+  if (Array_size(jobs) > 0) {
+    const size_t t_cnt =
+        workers < Array_size(jobs) ? workers : Array_size(jobs);
+    thrd_t *restrict const thrds = heap_calloc(t_cnt, sizeof(thrd_t));
+    struct samples_warmup_ctx ctx = {.jobs = jobs};
+
+    mutex_init(&ctx.mtx);
+
+    if (verbose)
+      wout("Warm-up: %zu markets, %zu workers\n", Array_size(jobs), t_cnt);
+
+    for (size_t i = 0; i < t_cnt; i++)
+      thread_create(&thrds[i], samples_warmup_worker, &ctx);
+
+    for (size_t i = 0; i < t_cnt; i++)
+      thread_join(thrds[i], NULL);
+
+    mutex_destroy(&ctx.mtx);
+    heap_free(thrds);
+  }
+
+  Array_delete(jobs, worker_ctx_delete);
+}
+
+struct market_bridge {
+  struct String *restrict q_m_id;
+  struct String *restrict b_m_id;
+};
+
+struct market_graph {
+  uintmax_t version;
+  struct Map *restrict bridges;
+};
+
+static void market_bridge_delete(void *restrict const e) {
+  if (e == NULL)
+    return;
+
+  struct market_bridge *restrict const b = e;
+  String_delete(b->q_m_id);
+  String_delete(b->b_m_id);
+  heap_free(b);
+}
+
+static void market_graph_delete(void *restrict const e) {
+  if (e == NULL)
+    return;
+
+  struct market_graph *restrict const g = e;
+  Map_delete(g->bridges, market_bridge_delete);
+  heap_free(g);
+}
+
+static struct String *
+market_bridge_key(const struct String *restrict const q_id,
+                  const struct String *restrict const r_id) {
+  char key[BUFSIZ] = {0};
+  const int r = snprintf(key, sizeof(key), "%s/%s", String_chars(q_id),
+                         String_chars(r_id));
+
+  if (r < 0 || (size_t)r >= sizeof(key))
+    panic();
+
+  return String_cnew(key);
+}
+
+static struct market_bridge *
+market_graph_bridge(struct market_graph *restrict const g,
+                    const struct String *restrict const q_id,
+                    const struct String *restrict const r_id) {
+  struct String *restrict const key = market_bridge_key(q_id, r_id);
+  struct market_bridge *restrict b = Map_get(g->bridges, key);
+
+  if (b == NULL) {
+    b = heap_calloc(1, sizeof(struct market_bridge));
+    Map_put(g->bridges, key, b);
+  }
+
+  String_delete(key);
+  return b;
+}
+
+/*
+ * Builds the graph of the markets of an exchange. Getting the markets may
+ * reload them, so graphs are built without holding market_graphs.
+ */
+static struct market_graph *
+market_graph_new(const struct Exchange *restrict const e) {
+  struct market_graph *restrict const g =
+      heap_calloc(1, sizeof(struct market_graph));
+  void *const *restrict items;
+
+  g->version = e->markets_version();
+  g->bridges = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+
+  struct Array *restrict const markets = e->markets();
+
+  /*
+   * A market trading base for quote converts an amount of its base into its
+   * quote by multiplying with its price and the other way round by dividing.
+   */
+  items = Array_items(markets);
+  for (size_t i = 0; i < Array_size(markets); i++) {
+    const struct Market *restrict const m = items[i];
+    struct market_bridge *restrict b = market_graph_bridge(g, m->b_id, m->q_id);
+
+    if (b->q_m_id == NULL)
+      b->q_m_id = String_copy(m->id);
+
+    b = market_graph_bridge(g, m->q_id, m->b_id);
+
+    if (b->b_m_id == NULL)
+      b->b_m_id = String_copy(m->id);
+  }
+
+  Array_unlock(markets);
+  return g;
+}
+
+// Called with market_graphs locked.
+static void market_graph_find(const struct market_graph *restrict const g,
+                              const struct String *restrict const key,
+                              struct String *restrict *restrict const q_m_id,
+                              struct String *restrict *restrict const b_m_id) {
+  const struct market_bridge *restrict const b = Map_get(g->bridges, key);
+
+  if (b != NULL) {
+    *q_m_id = b->q_m_id != NULL ? String_copy(b->q_m_id) : NULL;
+    *b_m_id = b->b_m_id != NULL ? String_copy(b->b_m_id) : NULL;
+  }
+}
+
+static bool quote_return(struct Numeric *restrict const q_return,
+                         const struct worker_ctx *restrict const w_ctx) {
+  const struct abag_tls *restrict const tls = abag_tls();
+  struct Numeric *restrict const r0 = tls->quote_return.r0;
+
+  if (w_ctx->m_cnf == NULL)
+    return false;
+
+  if (!String_equals(w_ctx->m->q_id, w_ctx->m_cnf->r_id)) {
+    struct String *restrict q_m_id = NULL;
+    struct String *restrict b_m_id = NULL;
+
+    struct String *restrict const key =
+        market_bridge_key(w_ctx->m->q_id, w_ctx->m_cnf->r_id);
+
+    Map_lock(market_graphs);
+    const struct market_graph *restrict g =
+        Map_get(market_graphs, w_ctx->e->id);
+    const bool stale = g == NULL || g->version != w_ctx->e->markets_version();
+
+    if (!stale)
+      market_graph_find(g, key, &q_m_id, &b_m_id);
+
+    Map_unlock(market_graphs);
+
+    if (stale) {
+      struct market_graph *restrict n = market_graph_new(w_ctx->e);
+
+      Map_lock(market_graphs);
+      g = Map_get(market_graphs, w_ctx->e->id);
+
+      // Another worker may have swapped in a graph at least as recent.
+      if (g == NULL || g->version < n->version) {
+        struct market_graph *restrict const old =
+            Map_put(market_graphs, w_ctx->e->id, n);
+
+        g = n;
+        n = old;
+      }
+
+      market_graph_find(g, key, &q_m_id, &b_m_id);
+      Map_unlock(market_graphs);
+      market_graph_delete(n);
+    }
+
+    String_delete(key);
+
+    if (q_m_id == NULL && b_m_id == NULL) {
+      werr("%s: %s: Markets: Not available: %s@%s %s@%s\n",
            String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
            String_chars(w_ctx->m->q_id), String_chars(w_ctx->m_cnf->r_id),
            String_chars(w_ctx->m_cnf->r_id), String_chars(w_ctx->m->q_id));
@@ -1142,35 +2126,34 @@ static bool quote_return(struct Numeric *restrict const q_return,
       return false;
     }
 
-    const struct Sample *restrict q_sample = NULL;
-    const struct Sample *restrict b_sample = NULL;
+    const struct Numeric *restrict q_price = NULL;
+    const struct Numeric *restrict b_price = NULL;
 
-    if (q_samples != NULL) {
-      Array_lock(q_samples);
-      q_sample = Array_tail(q_samples);
+    Map_lock(market_last_prices);
 
-      if (q_sample != NULL) {
-        Numeric_div_to(one, q_sample->price, r0);
-        Numeric_mul_to(r0, w_ctx->m_cnf->r_amount, q_return);
-        Numeric_scale(q_return, w_ctx->m->q_sc);
-      }
+    if (q_m_id != NULL)
+      q_price = Map_get(market_last_prices, q_m_id);
+
+    if (b_m_id != NULL)
+      b_price = Map_get(market_last_prices, b_m_id);
 
-      Array_unlock(q_samples);
+    if (q_price != NULL) {
+      Numeric_div_to(one, q_price, r0);
+      Numeric_mul_to(r0, w_ctx->m_cnf->r_amount, q_return);
+      Numeric_scale(q_return, w_ctx->m->q_sc);
     }
 
-    if (b_samples != NULL) {
-      Array_lock(b_samples);
-      b_sample = Array_tail(b_samples);
+    if (b_price != NULL) {
+      Numeric_mul_to(w_ctx->m_cnf->r_amount, b_price, q_return);
+      Numeric_scale(q_return, w_ctx->m->q_sc);
+    }
 
-      if (b_sample != NULL) {
-        Numeric_mul_to(w_ctx->m_cnf->r_amount, b_sample->price, q_return);
-        Numeric_scale(q_return, w_ctx->m->q_sc);
-      }
+    Map_unlock(market_last_prices);
 
-      Array_unlock(b_samples);
-    }
+    String_delete(q_m_id);
+    String_delete(b_m_id);
 
-    if (q_sample == NULL && b_sample == NULL) {
+    if (q_price == NULL && b_price == NULL) {
       werr("%s: %s: Tickers: Not available: %s@%s %s@%s\n",
            String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
            String_chars(w_ctx->m->q_id), String_chars(w_ctx->m_cnf->r_id),
@@ -1527,34 +2510,190 @@ static void position_pricing(const struct worker_ctx *restrict const w_ctx,
   }
 }
 
+/*
+ * Balances available to a market. The balances of the accounts of a market
+ * less the amounts held by its trades are cached until a position of any
+ * market sharing a currency changes or ABAG_LEDGER_REFRESH_MILLIS elapsed.
+ */
+struct ledger {
+  struct String *restrict e_id;
+  struct String *restrict q_id;
+  struct String *restrict b_id;
+  struct Numeric *restrict q_avail;
+  struct Numeric *restrict b_avail;
+  struct timespec refreshed;
+  uintmax_t gen;
+  bool is_ready;
+  bool is_valid;
+};
+
+static struct ledger *
+ledger_new(const struct worker_ctx *restrict const w_ctx) {
+  struct ledger *restrict const l = heap_calloc(1, sizeof(struct ledger));
+  l->e_id = String_copy(w_ctx->e->id);
+  l->q_id = String_copy(w_ctx->m->q_id);
+  l->b_id = String_copy(w_ctx->m->b_id);
+  l->q_avail = Numeric_copy(zero);
+  l->b_avail = Numeric_copy(zero);
+  return l;
+}
+
+static void ledger_delete(void *restrict const e) {
+  struct ledger *restrict const l = e;
+  String_delete(l->e_id);
+  String_delete(l->q_id);
+  String_delete(l->b_id);
+  Numeric_delete(l->q_avail);
+  Numeric_delete(l->b_avail);
+  heap_free(l);
+}
+
+static inline bool ledger_current(const struct ledger *restrict const l,
+                                  const struct timespec *restrict const now) {
+  const intmax_t millis =
+      ((intmax_t)now->tv_sec - (intmax_t)l->refreshed.tv_sec) * 1000 +
+      (now->tv_nsec - l->refreshed.tv_nsec) / 1000000L;
+
+  return l->is_valid && millis >= 0 &&
+         (uintmax_t)millis < (uintmax_t)ledger_refresh_millis;
+}
+
+/*
+ * Marks the balances of all markets sharing a currency with the market of a
+ * worker outdated.
+ */
+static void ledger_invalidate(const struct worker_ctx *restrict const w_ctx) {
+  Map_lock(market_ledgers);
+  struct MapIterator *restrict const it = MapIterator_new(market_ledgers);
+  while (MapIterator_next(it)) {
+    struct ledger *restrict const l = (struct ledger *)MapIterator_value(it);
+
+    if (String_equals(l->e_id, w_ctx->e->id) &&
+        (String_equals(l->q_id, w_ctx->m->q_id) ||
+         String_equals(l->q_id, w_ctx->m->b_id) ||
+         String_equals(l->b_id, w_ctx->m->q_id) ||
+         String_equals(l->b_id, w_ctx->m->b_id))) {
+      l->gen++;
+      l->is_valid = false;
+    }
+  }
+  MapIterator_delete(it);
+  Map_unlock(market_ledgers);
+}
+
+/*
+ * Provides the quote and base balances available to the market of a worker,
+ * querying the exchange and the database only if the cached balances are
+ * outdated. Returns false, if the accounts could not be synced.
+ */
+static bool ledger_balances(const struct worker_ctx *restrict const w_ctx,
+                            struct Numeric *restrict const q_avail,
+                            struct Numeric *restrict const b_avail,
+                            bool *restrict const is_ready) {
+  struct timespec now;
+  time_now(&now);
+
+  Map_lock(market_ledgers);
+  struct ledger *restrict l = Map_get(market_ledgers, w_ctx->m->id);
+
+  if (l == NULL) {
+    l = ledger_new(w_ctx);
+    Map_put(market_ledgers, w_ctx->m->id, l);
+  }
+
+  if (ledger_current(l, &now)) {
+    Numeric_copy_to(l->q_avail, q_avail);
+    Numeric_copy_to(l->b_avail, b_avail);
+    *is_ready = l->is_ready;
+    Map_unlock(market_ledgers);
+    return true;
+  }
+
+  const uintmax_t gen = l->gen;
+  Map_unlock(market_ledgers);
+
+  struct Account *restrict const qa = w_ctx->e->account(w_ctx->m->qa_id);
+
+  if (qa == NULL) {
+    werr("%s: %s: Account: Failure syncing quote account: %s\n",
+         String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
+         String_chars(w_ctx->m->qa_id));
+
+    return false;
+  }
+
+  struct Account *restrict const ba = w_ctx->e->account(w_ctx->m->ba_id);
+
+  if (ba == NULL) {
+    werr("%s: %s: Account: Failure syncing base account: %s\n",
+         String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
+         String_chars(w_ctx->m->ba_id));
+
+    Account_delete(qa);
+    return false;
+  }
+
+  struct db_balance_rec hold = {
+      .q = Numeric_new(),
+      .b = Numeric_new(),
+  };
+
+  void *restrict const db = db_pool_acquire(db_trading);
+  db_trades_hold(&hold, db, String_chars(w_ctx->e->id),
+                 String_chars(w_ctx->m->q_id), String_chars(w_ctx->m->b_id));
+  db_pool_release(db_trading, db);
+
+  Numeric_sub_to(qa->avail, hold.q, q_avail);
+  Numeric_sub_to(ba->avail, hold.b, b_avail);
+  *is_ready = qa->is_active && qa->is_ready && ba->is_active && ba->is_ready;
+
+  // Balances outdated while querying are not cached.
+  Map_lock(market_ledgers);
+  if (l->gen == gen) {
+    Numeric_copy_to(q_avail, l->q_avail);
+    Numeric_copy_to(b_avail, l->b_avail);
+    l->is_ready = *is_ready;
+    l->refreshed = now;
+    l->is_valid = true;
+  }
+  Map_unlock(market_ledgers);
+
+  Numeric_delete(hold.q);
+  Numeric_delete(hold.b);
+  Account_delete(qa);
+  Account_delete(ba);
+  return true;
+}
+
 static void position_create(const struct worker_ctx *restrict const w_ctx,
                             struct Trade *restrict const t,
                             struct Position *restrict const p) {
   char t_id[DATABASE_UUID_MAX_LENGTH + 1] = {0};
+  void *restrict const db = db_pool_acquire(db_trading);
 
   switch (p->type) {
   case POSITION_TYPE_LONG:
     if (t->id == NULL) {
-      db_trade_bcreate(t_id, w_ctx->db, String_chars(w_ctx->e->id),
+      db_trade_bcreate(t_id, db, String_chars(w_ctx->e->id),
                        String_chars(w_ctx->m->id), String_chars(w_ctx->m->b_id),
                        String_chars(w_ctx->m->q_id), String_chars(p->id),
                        t->q_return, p->b_ordered, p->price);
       t->id = String_cnew(t_id);
     } else
-      db_trade_bupdate(w_ctx->db, String_chars(t->id), String_chars(p->id),
+      db_trade_bupdate(db, String_chars(t->id), String_chars(p->id),
                        p->b_ordered, p->price);
 
     t->status = TRADE_STATUS_BUYING;
     break;
   case POSITION_TYPE_SHORT:
     if (t->id == NULL) {
-      db_trade_screate(t_id, w_ctx->db, String_chars(w_ctx->e->id),
+      db_trade_screate(t_id, db, String_chars(w_ctx->e->id),
                        String_chars(w_ctx->m->id), String_chars(w_ctx->m->b_id),
                        String_chars(w_ctx->m->q_id), String_chars(p->id),
                        t->q_return, p->b_ordered, p->price);
       t->id = String_cnew(t_id);
     } else
-      db_trade_supdate(w_ctx->db, String_chars(t->id), String_chars(p->id),
+      db_trade_supdate(db, String_chars(t->id), String_chars(p->id),
                        p->b_ordered, p->price);
 
     t->status = TRADE_STATUS_SELLING;
@@ -1567,6 +2706,9 @@ static void position_create(const struct worker_ctx *restrict const w_ctx,
   p->filled = false;
   position_pricing(w_ctx, t, p, false);
   nanos_now(p->cnanos);
+
+  db_pool_release(db_trading, db);
+  ledger_invalidate(w_ctx);
 }
 
 static void position_open(const struct worker_ctx *restrict const w_ctx,
@@ -1575,6 +2717,7 @@ static void position_open(const struct worker_ctx *restrict const w_ctx,
                           const struct Order *restrict const order) {
   const struct abag_tls *restrict const tls = abag_tls();
   struct Numeric *restrict const csecs = tls->position_open.csecs;
+  void *restrict const db = db_pool_acquire(db_trading);
 
   Numeric_copy_to(order->cnanos, p->cnanos);
   Numeric_copy_to(order->b_filled, p->b_filled);
@@ -1586,18 +2729,218 @@ static void position_open(const struct worker_ctx *restrict const w_ctx,
 
   switch (p->type) {
   case POSITION_TYPE_LONG:
-    db_trade_bopen(w_ctx->db, String_chars(w_ctx->e->id),
+    db_trade_bopen(db, String_chars(w_ctx->e->id),
                    String_chars(w_ctx->m->id), String_chars(order->id), csecs,
                    order->b_filled, order->q_filled, order->q_fees);
     break;
   case POSITION_TYPE_SHORT:
-    db_trade_sopen(w_ctx->db, String_chars(w_ctx->e->id),
+    db_trade_sopen(db, String_chars(w_ctx->e->id),
                    String_chars(w_ctx->m->id), String_chars(order->id), csecs,
                    order->b_filled, order->q_filled, order->q_fees);
     break;
   default:
     panic();
   }
+
+  db_pool_release(db_trading, db);
+  ledger_invalidate(w_ctx);
+}
+
+static struct db_stats_rec *stats_new(void) {
+  struct db_stats_rec *restrict const st =
+      heap_calloc(1, sizeof(struct db_stats_rec));
+  st->bd_min = Numeric_new();
+  st->bd_max = Numeric_new();
+  st->bd_avg = Numeric_new();
+  st->sd_min = Numeric_new();
+  st->sd_max = Numeric_new();
+  st->sd_avg = Numeric_new();
+  st->bcl_factor = Numeric_new();
+  st->scl_factor = Numeric_new();
+  return st;
+}
+
+static void stats_delete(void *restrict const e) {
+  if (e == NULL)
+    return;
+
+  struct db_stats_rec *restrict const st = e;
+  Numeric_delete(st->bd_min);
+  Numeric_delete(st->bd_max);
+  Numeric_delete(st->bd_avg);
+  Numeric_delete(st->sd_min);
+  Numeric_delete(st->sd_max);
+  Numeric_delete(st->sd_avg);
+  Numeric_delete(st->bcl_factor);
+  Numeric_delete(st->scl_factor);
+  heap_free(st);
+}
+
+static void stats_copy_to(const struct db_stats_rec *restrict const src,
+                          struct db_stats_rec *restrict const dst) {
+  dst->bd_min_null = src->bd_min_null;
+  dst->bd_max_null = src->bd_max_null;
+  dst->bd_avg_null = src->bd_avg_null;
+  dst->sd_min_null = src->sd_min_null;
+  dst->sd_max_null = src->sd_max_null;
+  dst->sd_avg_null = src->sd_avg_null;
+  Numeric_copy_to(src->bd_min, dst->bd_min);
+  Numeric_copy_to(src->bd_max, dst->bd_max);
+  Numeric_copy_to(src->bd_avg, dst->bd_avg);
+  Numeric_copy_to(src->sd_min, dst->sd_min);
+  Numeric_copy_to(src->sd_max, dst->sd_max);
+  Numeric_copy_to(src->sd_avg, dst->sd_avg);
+  Numeric_copy_to(src->bcl_factor, dst->bcl_factor);
+  Numeric_copy_to(src->scl_factor, dst->scl_factor);
+}
+
+/*
+ * Statistics are cached by exchange and market, as they are keyed in the
+ * database. Statistics not cached are loaded by the stats_refresh thread, so
+ * that workers never wait for the database, and markets without statistics
+ * are looked up once per refresh.
+ */
+static struct String *stats_key(const char *restrict const e_id,
+                                const char *restrict const m_id) {
+  char key[2 * DATABASE_UUID_MAX_LENGTH + 2] = {0};
+  const int r = snprintf(key, sizeof(key), "%s/%s", e_id, m_id);
+
+  if (r < 0 || (size_t)r >= sizeof(key))
+    panic();
+
+  return String_cnew(key);
+}
+
+// Called with market_stats locked.
+static void stats_put(struct String *restrict const key,
+                      const struct db_stats_rec *restrict const rec) {
+  struct db_stats_rec *restrict st = Map_get(market_stats, key);
+
+  if (st == NULL) {
+    st = stats_new();
+    Map_put(market_stats, key, st);
+  }
+
+  stats_copy_to(rec, st);
+  String_delete(Map_remove(market_stats_missing, key));
+}
+
+static void stats_load(const void *restrict const db,
+                       struct db_stats_rec *restrict const rec) {
+  db_stats_open(db);
+
+  while (!terminated && db_stats_next(rec, db)) {
+    struct String *restrict const key = stats_key(rec->e_id, rec->m_id);
+
+    Map_lock(market_stats);
+    stats_put(key, rec);
+    Map_unlock(market_stats);
+
+    String_delete(key);
+  }
+
+  db_stats_close(db);
+
+  Map_lock(market_stats);
+  Map_delete(market_stats_missing, String_delete);
+  market_stats_missing = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  Map_unlock(market_stats);
+}
+
+static void stats_fetch(const void *restrict const db,
+                        struct db_stats_rec *restrict const stats,
+                        struct String *restrict const key) {
+  char e_id[DATABASE_UUID_MAX_LENGTH + 1] = {0};
+  const char *restrict const k = String_chars(key);
+  const char *restrict const m_id = strchr(k, '/');
+
+  if (m_id == NULL || (size_t)(m_id - k) >= sizeof(e_id))
+    panic();
+
+  memcpy(e_id, k, (size_t)(m_id - k));
+
+  const bool found = db_stats(stats, db, e_id, m_id + 1);
+
+  Map_lock(market_stats);
+
+  if (found)
+    stats_put(key, stats);
+  else
+    String_delete(Map_put(market_stats_missing, key, String_copy(key)));
+
+  Map_unlock(market_stats);
+}
+
+// Loads the statistics workers asked for since the last call.
+static void stats_fetch_pending(const void *restrict const db,
+                                struct db_stats_rec *restrict const rec) {
+  Map_lock(market_stats);
+  struct Map *restrict const pending = market_stats_pending;
+  market_stats_pending = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  Map_unlock(market_stats);
+
+  struct MapIterator *restrict const it = MapIterator_new(pending);
+
+  while (!terminated && MapIterator_next(it))
+    stats_fetch(db, rec, (struct String *)MapIterator_value(it));
+
+  MapIterator_delete(it);
+  Map_delete(pending, String_delete);
+}
+
+// Called with market_stats locked.
+static void stats_request(struct String *restrict const key) {
+  if (Map_get(market_stats_missing, key) == NULL &&
+      Map_get(market_stats_pending, key) == NULL)
+    Map_put(market_stats_pending, key, String_copy(key));
+}
+
+static bool stats_get(struct db_stats_rec *restrict const stats,
+                      const struct String *restrict const e_id,
+                      const struct String *restrict const m_id) {
+  struct String *restrict const key =
+      stats_key(String_chars(e_id), String_chars(m_id));
+
+  Map_lock(market_stats);
+  const struct db_stats_rec *restrict const st = Map_get(market_stats, key);
+  if (st != NULL)
+    stats_copy_to(st, stats);
+  else
+    stats_request(key);
+  Map_unlock(market_stats);
+
+  String_delete(key);
+  return st != NULL;
+}
+
+static void stats_cl_factor(const struct String *restrict const e_id,
+                            const struct String *restrict const m_id,
+                            const enum position_type type,
+                            const struct Numeric *restrict const factor) {
+  struct String *restrict const key =
+      stats_key(String_chars(e_id), String_chars(m_id));
+
+  Map_lock(market_stats);
+  struct db_stats_rec *restrict const st = Map_get(market_stats, key);
+  if (st != NULL)
+    switch (type) {
+    case POSITION_TYPE_LONG:
+      Numeric_copy_to(factor, st->bcl_factor);
+      break;
+    case POSITION_TYPE_SHORT:
+      Numeric_copy_to(factor, st->scl_factor);
+      break;
+    default:
+      panic();
+    }
+  else {
+    // The factor has just been written, so the statistics now exist.
+    String_delete(Map_remove(market_stats_missing, key));
+    stats_request(key);
+  }
+  Map_unlock(market_stats);
+
+  String_delete(key);
 }
 
 static void position_fill(const struct worker_ctx *restrict const w_ctx,
@@ -1607,6 +2950,7 @@ static void position_fill(const struct worker_ctx *restrict const w_ctx,
   const struct abag_tls *restrict const tls = abag_tls();
   struct Numeric *restrict const csecs = tls->position_fill.csecs;
   struct Numeric *restrict const dsecs = tls->position_fill.dsecs;
+  void *restrict const db = db_pool_acquire(db_trading);
 
   Numeric_copy_to(order->cnanos, p->cnanos);
   Numeric_copy_to(order->b_filled, p->b_filled);
@@ -1630,14 +2974,16 @@ static void position_fill(const struct worker_ctx *restrict const w_ctx,
 
   switch (p->type) {
   case POSITION_TYPE_LONG:
-    db_trade_bfill(w_ctx->db, String_chars(w_ctx->e->id),
+    db_trade_bfill(db, String_chars(w_ctx->e->id),
                    String_chars(w_ctx->m->id), String_chars(order->id), csecs,
                    order->settled ? dsecs : NULL, order->b_filled,
                    order->q_filled, order->q_fees, t_done);
 
-    if (order->settled)
-      db_stats_bcl_factor(w_ctx->db, String_chars(w_ctx->e->id),
+    if (order->settled) {
+      db_stats_bcl_factor(db, String_chars(w_ctx->e->id),
                           String_chars(w_ctx->m->id), p->cl_factor);
+      stats_cl_factor(w_ctx->e->id, w_ctx->m->id, p->type, p->cl_factor);
+    }
 
     if (t_done)
       t->status = TRADE_STATUS_DONE;
@@ -1646,14 +2992,16 @@ static void position_fill(const struct worker_ctx *restrict const w_ctx,
 
     break;
   case POSITION_TYPE_SHORT:
-    db_trade_sfill(w_ctx->db, String_chars(w_ctx->e->id),
+    db_trade_sfill(db, String_chars(w_ctx->e->id),
                    String_chars(w_ctx->m->id), String_chars(order->id), csecs,
                    order->settled ? dsecs : NULL, order->b_filled,
                    order->q_filled, order->q_fees, t_done);
 
-    if (order->settled)
-      db_stats_scl_factor(w_ctx->db, String_chars(w_ctx->e->id),
+    if (order->settled) {
+      db_stats_scl_factor(db, String_chars(w_ctx->e->id),
                           String_chars(w_ctx->m->id), p->cl_factor);
+      stats_cl_factor(w_ctx->e->id, w_ctx->m->id, p->type, p->cl_factor);
+    }
 
     if (t_done)
       t->status = TRADE_STATUS_DONE;
@@ -1664,6 +3012,9 @@ static void position_fill(const struct worker_ctx *restrict const w_ctx,
   default:
     panic();
   }
+
+  db_pool_release(db_trading, db);
+  ledger_invalidate(w_ctx);
 }
 
 static void position_cancel(const struct worker_ctx *restrict const w_ctx,
@@ -1671,6 +3022,12 @@ static void position_cancel(const struct worker_ctx *restrict const w_ctx,
                             struct Position *restrict const p) {
   const struct abag_tls *restrict const tls = abag_tls();
   struct Numeric *restrict const r0 = tls->position_cancel.r0;
+  void *restrict const db = db_pool_acquire(db_trading);
+
+  // The trade is deleted together with its last position.
+  state_discard(t->p_long.id == NULL || t->p_short.id == NULL ? t->id : NULL,
+                p->type == POSITION_TYPE_LONG ? p->id : NULL,
+                p->type == POSITION_TYPE_SHORT ? p->id : NULL);
 
   Numeric_mul_to(p->cl_factor, four, r0);
   Numeric_copy_to(r0, p->cl_factor);
@@ -1678,34 +3035,35 @@ static void position_cancel(const struct worker_ctx *restrict const w_ctx,
   switch (p->type) {
   case POSITION_TYPE_LONG:
     if (t->p_short.id != NULL) {
-      db_trade_breset(w_ctx->db, String_chars(w_ctx->e->id),
+      db_trade_breset(db, String_chars(w_ctx->e->id),
                       String_chars(w_ctx->m->id), String_chars(p->id));
       t->status = TRADE_STATUS_SOLD;
     }
 
-    db_stats_bcl_factor(w_ctx->db, String_chars(w_ctx->e->id),
+    db_stats_bcl_factor(db, String_chars(w_ctx->e->id),
                         String_chars(w_ctx->m->id), p->cl_factor);
-
+    stats_cl_factor(w_ctx->e->id, w_ctx->m->id, p->type, p->cl_factor);
     break;
   case POSITION_TYPE_SHORT:
     if (t->p_long.id != NULL) {
-      db_trade_sreset(w_ctx->db, String_chars(w_ctx->e->id),
+      db_trade_sreset(db, String_chars(w_ctx->e->id),
                       String_chars(w_ctx->m->id), String_chars(p->id));
       t->status = TRADE_STATUS_BOUGHT;
     }
 
-    db_stats_scl_factor(w_ctx->db, String_chars(w_ctx->e->id),
+    db_stats_scl_factor(db, String_chars(w_ctx->e->id),
                         String_chars(w_ctx->m->id), p->cl_factor);
-
+    stats_cl_factor(w_ctx->e->id, w_ctx->m->id, p->type, p->cl_factor);
     break;
   default:
     panic();
   }
 
+  order_index_remove(p->id, t);
   position_reset(p);
 
   if (t->p_long.id == NULL && t->p_short.id == NULL) {
-    db_trade_delete(w_ctx->db, String_chars(t->id));
+    db_trade_delete(db, String_chars(t->id));
 
     if (verbose)
       wout("%s: %s: Position: Cancelled: %s\n", String_chars(w_ctx->e->nm),
@@ -1715,6 +3073,9 @@ static void position_cancel(const struct worker_ctx *restrict const w_ctx,
     t->id = NULL;
     t->status = TRADE_STATUS_CANCELLED;
   }
+
+  db_pool_release(db_trading, db);
+  ledger_invalidate(w_ctx);
 }
 
 static void position_timeout(const struct worker_ctx *restrict const w_ctx,
@@ -1729,8 +3090,7 @@ static void position_timeout(const struct worker_ctx *restrict const w_ctx,
   struct Numeric *restrict const total_to = tls->position_timeout.total_to;
   struct Numeric *restrict const r0 = tls->position_timeout.r0;
   struct db_stats_rec *restrict const stats = tls->position_timeout.stats;
-  const bool db = db_stats(stats, w_ctx->db, String_chars(w_ctx->e->id),
-                           String_chars(w_ctx->m->id));
+  const bool db = stats_get(stats, w_ctx->e->id, w_ctx->m->id);
 
   switch (p->type) {
   case POSITION_TYPE_LONG:
@@ -1785,17 +3145,71 @@ static void position_timeout(const struct worker_ctx *restrict const w_ctx,
     Numeric_copy_to(zero, p->cl_samples);
 }
 
-static void position_maintain(const struct worker_ctx *restrict const w_ctx,
-                              struct Trade *restrict const t,
-                              struct Position *restrict const p,
-                              const struct Array *restrict const samples,
-                              const struct Sample *restrict const sample,
-                              struct Order *restrict order) {
-  const struct abag_tls *restrict const tls = abag_tls();
-  struct Numeric *restrict const m = tls->position_maintain.m;
-  const bool poll = Numeric_cmp(sample->nanos, p->pnanos) > 0;
-  const bool free_order = order == NULL;
-  bool cancel = false;
+/*
+ * Request to cancel an order, with what is needed to report the outcome for
+ * the position the order has been placed for.
+ */
+struct order_cancel {
+  struct Order *restrict o;
+  struct String *restrict m_nm;
+  struct String *restrict t_id;
+  char *restrict info;
+};
+
+static void order_cancel_delete(void *restrict const entry) {
+  if (entry == NULL)
+    return;
+
+  struct order_cancel *restrict const c = entry;
+  Order_delete(c->o);
+  String_delete(c->m_nm);
+  String_delete(c->t_id);
+  heap_free(c->info);
+  heap_free(c);
+}
+
+static void order_cancel_request(const struct worker_ctx *restrict const w_ctx,
+                                 const struct String *restrict const t_id,
+                                 const struct String *restrict const o_id,
+                                 const char *restrict const info) {
+  struct order_cancels *restrict const c = w_ctx->cancels;
+  const size_t info_len = strlen(info);
+
+  mutex_lock(&c->mtx);
+
+  void *const *restrict const items = Array_items(c->orders);
+  for (size_t i = Array_size(c->orders); i-- > 0;)
+    if (String_equals(((struct order_cancel *)items[i])->o->id, o_id))
+      goto ret;
+
+  struct order_cancel *restrict const r =
+      heap_calloc(1, sizeof(struct order_cancel));
+
+  r->o = Order_new();
+  r->o->id = String_copy((void *)o_id);
+  r->o->m_id = String_copy(w_ctx->m->id);
+  r->o->status = ORDER_STATUS_UNKNOWN;
+  r->m_nm = String_copy(w_ctx->m->nm);
+  r->t_id = t_id != NULL ? String_copy((void *)t_id) : NULL;
+  r->info = heap_malloc(info_len + 1);
+  memcpy(r->info, info, info_len + 1);
+  Array_add_tail(c->orders, r);
+  condition_signal(&c->cnd);
+ret:
+  mutex_unlock(&c->mtx);
+}
+
+static void position_maintain(const struct worker_ctx *restrict const w_ctx,
+                              struct Trade *restrict const t,
+                              struct Position *restrict const p,
+                              const struct Array *restrict const samples,
+                              const struct Sample *restrict const sample,
+                              struct Order *restrict order) {
+  const struct abag_tls *restrict const tls = abag_tls();
+  struct Numeric *restrict const m = tls->position_maintain.m;
+  const bool poll = Numeric_cmp(sample->nanos, p->pnanos) > 0;
+  const bool free_order = order == NULL;
+  bool cancel = false;
 
   Numeric_dec(p->cl_samples);
 
@@ -1813,9 +3227,11 @@ static void position_maintain(const struct worker_ctx *restrict const w_ctx,
       panic();
     }
 
-    if (cancel && t->a != NULL)
-      cancel = t->a->position_close(w_ctx->db, w_ctx->e, w_ctx->m, t, p);
-    else
+    if (cancel && t->a != NULL) {
+      void *restrict const db = db_pool_acquire(db_trading);
+      cancel = t->a->position_close(db, w_ctx->e, w_ctx->m, t, p);
+      db_pool_release(db_trading, db);
+    } else
       cancel = false;
 
     if (Numeric_cmp(p->cl_samples, zero) <= 0) {
@@ -1836,6 +3252,9 @@ static void position_maintain(const struct worker_ctx *restrict const w_ctx,
   }
 
   if (cancel || poll || order != NULL) {
+    if (order == NULL)
+      order = order_preload_take(p->id);
+
     if (order == NULL)
       order = w_ctx->e->order(w_ctx->m, p->id);
 
@@ -1967,19 +3386,12 @@ static void position_maintain(const struct worker_ctx *restrict const w_ctx,
 
     // Recheck after reload.
     if (cancel && p->id != NULL && !(p->done || p->filled)) {
-      const bool cancelled = w_ctx->e->order_cancel(w_ctx->m, p->id);
       char *restrict const p_info = position_string(w_ctx, t, p);
 
-      if (!cancelled) {
-        werr("%s: %s: Position: Failure cancelling order: %s\n",
-             String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
-             String_chars(t->id));
-
-        werr("%s: %s: %s\n", String_chars(w_ctx->e->nm),
-             String_chars(w_ctx->m->nm), p_info);
+      order_cancel_request(w_ctx, t->id, p->id, p_info);
 
-      } else if (verbose) {
-        wout("%s: %s: Position: Order cancelled: %s\n",
+      if (verbose) {
+        wout("%s: %s: Position: Order cancel requested: %s\n",
              String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
              String_chars(t->id));
 
@@ -1988,6 +3400,7 @@ static void position_maintain(const struct worker_ctx *restrict const w_ctx,
       }
 
       heap_free(p_info);
+
       position_timeout(w_ctx, t, p, samples, sample);
     }
   free:
@@ -2029,8 +3442,14 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
     panic();
   }
 
-  if (t->a != NULL && t->a->position_close(w_ctx->db, w_ctx->e, w_ctx->m, t, p))
-    tl = true;
+  if (t->a != NULL) {
+    void *restrict const db = db_pool_acquire(db_trading);
+
+    if (t->a->position_close(db, w_ctx->e, w_ctx->m, t, p))
+      tl = true;
+
+    db_pool_release(db_trading, db);
+  }
 
   if (sl) {
     if (!p->sl_trg.set) {
@@ -2045,7 +3464,7 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
       } else
         Numeric_copy_to(zero, p->sl_samples);
 
-      position_state_save(w_ctx->db, t, p);
+      position_state_save(t, p);
 
       if (verbose) {
         char *restrict const p_info = position_string(w_ctx, t, p);
@@ -2076,7 +3495,7 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
     Numeric_copy_to(zero, p->sl_trg.nanos);
     Numeric_copy_to(zero, p->sl_trg.price);
 
-    position_state_save(w_ctx->db, t, p);
+    position_state_save(t, p);
 
     if (verbose) {
       char *restrict const p_info = position_string(w_ctx, t, p);
@@ -2113,7 +3532,7 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
       } else
         Numeric_copy_to(zero, p->tp_samples);
 
-      position_state_save(w_ctx->db, t, p);
+      position_state_save(t, p);
 
       if (verbose) {
         char *restrict const p_info = position_string(w_ctx, t, p);
@@ -2144,7 +3563,7 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
     Numeric_copy_to(zero, p->tp_trg.nanos);
     Numeric_copy_to(zero, p->tp_trg.price);
 
-    position_state_save(w_ctx->db, t, p);
+    position_state_save(t, p);
 
     if (verbose) {
       char *restrict const p_info = position_string(w_ctx, t, p);
@@ -2178,7 +3597,7 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
       } else
         Numeric_copy_to(zero, p->sl_samples);
 
-      position_state_save(w_ctx->db, t, p);
+      position_state_save(t, p);
 
       if (verbose) {
         char *restrict const p_info = position_string(w_ctx, t, p);
@@ -2216,7 +3635,7 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
       } else
         Numeric_copy_to(zero, p->tl_samples);
 
-      position_state_save(w_ctx->db, t, p);
+      position_state_save(t, p);
 
       if (verbose) {
         char *restrict const p_info = position_string(w_ctx, t, p);
@@ -2247,7 +3666,7 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
     Numeric_copy_to(zero, p->tl_trg.nanos);
     Numeric_copy_to(zero, p->tl_trg.price);
 
-    position_state_save(w_ctx->db, t, p);
+    position_state_save(t, p);
 
     if (verbose) {
       char *restrict const p_info = position_string(w_ctx, t, p);
@@ -2281,7 +3700,7 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
       } else
         Numeric_copy_to(zero, p->sl_samples);
 
-      position_state_save(w_ctx->db, t, p);
+      position_state_save(t, p);
 
       if (verbose) {
         char *restrict const p_info = position_string(w_ctx, t, p);
@@ -2316,7 +3735,7 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
       } else
         Numeric_copy_to(zero, p->tp_samples);
 
-      position_state_save(w_ctx->db, t, p);
+      position_state_save(t, p);
 
       if (verbose) {
         char *restrict const p_info = position_string(w_ctx, t, p);
@@ -2342,6 +3761,119 @@ static void position_trigger(const struct worker_ctx *restrict const w_ctx,
   }
 }
 
+static inline void order_strays_delete(void *restrict const entry) {
+  Array_delete(entry, Order_delete);
+}
+
+/*
+ * Keeps an order not matching any position while orders are being submitted.
+ * Exchanges may report an order before the request placing it returns.
+ */
+static bool order_stray_put(struct Order *restrict const order) {
+  bool kept = false;
+
+  Map_lock(order_strays);
+
+  if (orders_submitting > 0) {
+    struct Array *restrict strays = Map_get(order_strays, order->id);
+
+    if (strays == NULL) {
+      strays = Array_new(4);
+      Map_put(order_strays, order->id, strays);
+    }
+
+    Array_add_tail(strays, order);
+    kept = true;
+  }
+
+  Map_unlock(order_strays);
+  return kept;
+}
+
+/*
+ * Ends a submission and hands out the orders kept for the order id it got
+ * from the exchange. Orders kept are discarded once nothing is submitted.
+ */
+static struct Array *
+order_strays_take(const struct String *restrict const o_id) {
+  struct Array *restrict strays = NULL;
+
+  Map_lock(order_strays);
+
+  if (o_id != NULL)
+    strays = Map_remove(order_strays, (void *)o_id);
+
+  if (--orders_submitting == 0) {
+    struct MapIterator *restrict const it = MapIterator_new(order_strays);
+
+    while (MapIterator_next(it))
+      order_strays_delete(MapIterator_remove(it));
+
+    MapIterator_delete(it);
+  }
+
+  Map_unlock(order_strays);
+  return strays;
+}
+
+/*
+ * Order to be placed at an exchange on behalf of a pending position. Orders
+ * are placed by the submit workers of an exchange, so that the workers
+ * deciding to trade do not wait for the exchange to respond.
+ */
+struct order_submission {
+  struct Trade *restrict t;
+  struct Position *restrict p;
+  struct String *restrict m_id;
+  struct Numeric *restrict price;
+  struct Numeric *restrict b_ordered;
+  const char *restrict info;
+};
+
+static void order_submission_delete(void *restrict const entry) {
+  if (entry == NULL)
+    return;
+
+  struct order_submission *restrict const s = entry;
+  String_delete(s->m_id);
+  Numeric_delete(s->price);
+  Numeric_delete(s->b_ordered);
+  heap_free(s);
+}
+
+static void order_submit(const struct worker_ctx *restrict const w_ctx,
+                         struct Trade *restrict const t,
+                         struct Position *restrict const p,
+                         const struct Numeric *restrict const price,
+                         const struct Numeric *restrict const b_ordered,
+                         const char *restrict const info) {
+  struct order_submission *restrict const s =
+      heap_malloc(sizeof(struct order_submission));
+
+  s->t = t;
+  s->p = p;
+  s->m_id = String_copy(t->m_id);
+  s->price = Numeric_copy(price);
+  s->b_ordered = Numeric_copy(b_ordered);
+  s->info = info;
+  p->pending = true;
+
+  Map_lock(order_strays);
+  orders_submitting++;
+  Map_unlock(order_strays);
+
+  // Callers hold locks the submit workers need, so a full queue must not be
+  // waited on. The position is submitted again the next time it is traded.
+  if (!Queue_enqueue(w_ctx->submit_queue, s)) {
+    werr("%s: %s: %s: Submission queue full\n", String_chars(w_ctx->e->nm),
+         String_chars(w_ctx->m->nm), info);
+
+    p->pending = false;
+    order_strays_take(NULL);
+    order_submission_delete(s);
+  }
+}
+
 static void position_trade(const struct worker_ctx *restrict const w_ctx,
                            struct Trade *restrict const t,
                            struct Position *restrict const p,
@@ -2350,6 +3882,8 @@ static void position_trade(const struct worker_ctx *restrict const w_ctx,
   const struct abag_tls *restrict const tls = abag_tls();
   struct Numeric *restrict const o_pr = tls->position_trade.o_pr;
   struct Numeric *restrict const r0 = tls->position_trade.r0;
+  struct Numeric *restrict const q_avail = tls->position_trade.q_avail;
+  struct Numeric *restrict const b_avail = tls->position_trade.b_avail;
   void *const *items;
 
   position_pricing(w_ctx, t, p, false);
@@ -2489,35 +4023,10 @@ trade:
   Numeric_mul_to(r0, w_ctx->m->p_inc, o_pr);
   Numeric_scale(o_pr, w_ctx->m->p_sc);
 
-  struct Account *restrict const qa = w_ctx->e->account(w_ctx->m->qa_id);
-
-  if (qa == NULL) {
-    werr("%s: %s: Account: Failure syncing quote account: %s\n",
-         String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
-         String_chars(w_ctx->m->qa_id));
-
-    return;
-  }
-
-  struct Account *restrict const ba = w_ctx->e->account(w_ctx->m->ba_id);
-
-  if (ba == NULL) {
-    werr("%s: %s: Account: Failure syncing base account: %s\n",
-         String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
-         String_chars(w_ctx->m->ba_id));
-
-    Account_delete(qa);
-    return;
-  }
+  bool is_ready;
 
-  if (!(qa->is_active && qa->is_ready) || !(ba->is_active && ba->is_ready)) {
-    Account_delete(qa);
-    Account_delete(ba);
+  if (!ledger_balances(w_ctx, q_avail, b_avail, &is_ready) || !is_ready)
     return;
-  }
-
-  Account_delete(qa);
-  Account_delete(ba);
 
   char *restrict const b = Numeric_to_char(p->b_filled, w_ctx->m->b_sc);
   char *restrict const pr = Numeric_to_char(o_pr, w_ctx->m->p_sc);
@@ -2539,52 +4048,17 @@ trade:
     heap_free(p_info);
   }
 
-  struct String *restrict o_id;
-  struct Position *restrict o_p;
   switch (p->type) {
   case POSITION_TYPE_LONG:
-    o_id = w_ctx->e->order_supply(w_ctx->m, b, pr);
-    if (o_id == NULL) {
-      werr("%s: %s: Position: %s: %s: Failure creating sell order: %s\n",
-           String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm), ac_info,
-           tr_info, String_chars(t->id));
-
-      goto ret;
-    }
-    t->p_short.id = o_id;
-    Numeric_copy_to(o_pr, t->p_short.price);
-    Numeric_copy_to(p->b_filled, t->p_short.b_ordered);
-    position_create(w_ctx, t, &t->p_short);
-    position_timeout(w_ctx, t, &t->p_short, samples, sample);
-    o_p = &t->p_short;
+    order_submit(w_ctx, t, &t->p_short, o_pr, p->b_filled, ac_info);
     break;
   case POSITION_TYPE_SHORT:
-    o_id = w_ctx->e->order_demand(w_ctx->m, b, pr);
-    if (o_id == NULL) {
-      werr("%s: %s: Position: %s: %s: Failure creating buy order: %s\n",
-           String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm), ac_info,
-           tr_info, String_chars(t->id));
-
-      goto ret;
-    }
-    t->p_long.id = o_id;
-    Numeric_copy_to(o_pr, t->p_long.price);
-    Numeric_copy_to(p->b_filled, t->p_long.b_ordered);
-    position_create(w_ctx, t, &t->p_long);
-    position_timeout(w_ctx, t, &t->p_long, samples, sample);
-    o_p = &t->p_long;
+    order_submit(w_ctx, t, &t->p_long, o_pr, p->b_filled, ac_info);
     break;
   default:
     panic();
   }
 
-  if (verbose) {
-    char *restrict const o_info = position_string(w_ctx, t, o_p);
-    wout("%s: %s: %s\n", String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
-         o_info);
-    heap_free(o_info);
-  }
-ret:
   Numeric_char_free(b);
   Numeric_char_free(pr);
 }
@@ -2626,9 +4100,7 @@ static void trade_create(const struct worker_ctx *restrict const w_ctx,
 
   trade_timeout(w_ctx, t, samples, sample);
 
-  if (db_stats(stats, w_ctx->db, String_chars(w_ctx->e->id),
-               String_chars(w_ctx->m->id))) {
-
+  if (stats_get(stats, w_ctx->e->id, w_ctx->m->id)) {
     Numeric_copy_to(stats->bcl_factor, t->p_long.cl_factor);
     Numeric_copy_to(stats->scl_factor, t->p_short.cl_factor);
   } else {
@@ -2636,7 +4108,6 @@ static void trade_create(const struct worker_ctx *restrict const w_ctx,
     Numeric_copy_to(one, t->p_short.cl_factor);
   }
 
-  // XXX: Calls db_stats(...) again.
   position_timeout(w_ctx, t, &t->p_long, samples, sample);
   position_timeout(w_ctx, t, &t->p_short, samples, sample);
 }
@@ -2712,17 +4183,45 @@ ret:
   String_delete(pr_nm);
 }
 
+struct plot_job {
+  const struct Exchange *restrict e;
+  const struct Algorithm *restrict a;
+  struct Market *restrict m;
+  char fn[BUFSIZ];
+};
+
+static void plot_job_delete(void *restrict const arg) {
+  struct plot_job *restrict const job = arg;
+
+  if (job == NULL)
+    return;
+
+  Market_delete(job->m);
+  heap_free(job);
+}
+
+/*
+ * Plots are written by the plots thread. A market has at most one pending
+ * job; a newer one replaces it, so a slow export never queues up work.
+ */
 static void trade_plot(const struct worker_ctx *restrict const w_ctx,
                        struct Trade *restrict const t) {
-  char plot_fn[BUFSIZ] = {0};
-  int r = snprintf(plot_fn, sizeof(plot_fn), "%s/%s/%s/%s.m",
+  struct plot_job *restrict const job = heap_calloc(1, sizeof(struct plot_job));
+  int r = snprintf(job->fn, sizeof(job->fn), "%s/%s/%s/%s.m",
                    String_chars(cnf->plts_dir), String_chars(w_ctx->e->nm),
                    String_chars(t->a->nm), String_chars(w_ctx->m->nm));
 
-  if (r < 0 || (size_t)r >= sizeof(plot_fn))
+  if (r < 0 || (size_t)r >= sizeof(job->fn))
     panic();
 
-  t->a->market_plot(w_ctx->db, w_ctx->e, w_ctx->m, plot_fn);
+  job->e = w_ctx->e;
+  job->a = t->a;
+  job->m = Market_copy(w_ctx->m);
+
+  mutex_lock(&plot_mtx);
+  plot_job_delete(Map_put(plot_jobs, job->m->id, job));
+  condition_signal(&plot_cnd);
+  mutex_unlock(&plot_mtx);
 }
 
 static void trade_bet(const struct worker_ctx *restrict const w_ctx,
@@ -2736,7 +4235,6 @@ static void trade_bet(const struct worker_ctx *restrict const w_ctx,
   struct Numeric *restrict const q_ordered = tls->trade_bet.q_ordered;
   struct Numeric *restrict const q_fees = tls->trade_bet.q_fees;
   struct Numeric *restrict const r0 = tls->trade_bet.r0;
-  struct db_balance_rec *restrict const hold = tls->trade_bet.hold;
   bool pr_changed = false;
 
   Map_lock(market_prices);
@@ -2754,10 +4252,13 @@ static void trade_bet(const struct worker_ctx *restrict const w_ctx,
   if (!pr_changed)
     return;
 
-  struct Position *restrict const p =
-      t->a != NULL ? t->a->position_open(w_ctx->db, w_ctx->e, w_ctx->m, t,
-                                         samples, sample)
-                   : NULL;
+  struct Position *restrict p = NULL;
+
+  if (t->a != NULL) {
+    void *restrict const db = db_pool_acquire(db_trading);
+    p = t->a->position_open(db, w_ctx->e, w_ctx->m, t, samples, sample);
+    db_pool_release(db_trading, db);
+  }
 
   if (p != NULL) {
     if (!t->open_trg.set) {
@@ -2802,29 +4303,12 @@ static void trade_bet(const struct worker_ctx *restrict const w_ctx,
   if (cnf->plts_dir != NULL)
     trade_plot(w_ctx, t);
 
-  struct Account *restrict const q_acct = w_ctx->e->account(w_ctx->m->qa_id);
+  bool is_ready;
 
-  if (q_acct == NULL) {
-    werr("%s: %s: Account: Failure syncing quote account: %s\n",
-         String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
-         String_chars(w_ctx->m->qa_id));
-
-    return;
-  }
-
-  struct Account *restrict const b_acct = w_ctx->e->account(w_ctx->m->ba_id);
-
-  if (b_acct == NULL) {
-    werr("%s: %s: Account: Failure syncing base account: %s\n",
-         String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
-         String_chars(w_ctx->m->ba_id));
-
-    Account_delete(q_acct);
+  if (!ledger_balances(w_ctx, q_avail, b_avail, &is_ready))
     return;
-  }
 
-  if (!(q_acct->is_active && q_acct->is_ready) ||
-      !(b_acct->is_active && b_acct->is_ready)) {
+  if (!is_ready) {
 
     if (verbose) {
       char *restrict const s_pr =
@@ -2838,23 +4322,12 @@ static void trade_bet(const struct worker_ctx *restrict const w_ctx,
       Numeric_char_free(s_pr);
     }
 
-    Account_delete(q_acct);
-    Account_delete(b_acct);
     trigger_reset(&t->open_trg);
     return;
   }
 
   position_pricing(w_ctx, t, p, true);
 
-  db_trades_hold(hold, w_ctx->db, String_chars(w_ctx->e->id),
-                 String_chars(w_ctx->m->q_id), String_chars(w_ctx->m->b_id));
-
-  Numeric_sub_to(b_acct->avail, hold->b, b_avail);
-  Numeric_sub_to(q_acct->avail, hold->q, q_avail);
-
-  Account_delete(q_acct);
-  Account_delete(b_acct);
-
   Numeric_mul_to(p->b_ordered, p->price, q_ordered);
   Numeric_scale(q_ordered, w_ctx->m->q_sc);
   Numeric_sub_to(t->fee_pf, one, r0);
@@ -2946,17 +4419,7 @@ static void trade_bet(const struct worker_ctx *restrict const w_ctx,
       heap_free(c);
     }
 
-    struct String *restrict const o_id =
-        w_ctx->e->order_demand(w_ctx->m, b, pr);
-
-    if (o_id == NULL) {
-      werr("%s: %s: Open long: Failure creating buy order\n",
-           String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm));
-
-      goto ret;
-    }
-
-    p->id = o_id;
+    order_submit(w_ctx, t, p, p->price, p->b_ordered, "Open long");
     break;
   }
   case POSITION_TYPE_SHORT: {
@@ -3016,33 +4479,12 @@ static void trade_bet(const struct worker_ctx *restrict const w_ctx,
       heap_free(c);
     }
 
-    struct String *restrict const o_id =
-        w_ctx->e->order_supply(w_ctx->m, b, pr);
-
-    if (o_id == NULL) {
-      werr("%s: %s: Open short: Failure creating sell order\n",
-           String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm));
-
-      goto ret;
-    }
-
-    p->id = o_id;
+    order_submit(w_ctx, t, p, p->price, p->b_ordered, "Open short");
     break;
   }
   default:
     panic();
   }
-
-  position_create(w_ctx, t, p);
-  position_timeout(w_ctx, t, p, samples, sample);
-
-  if (verbose) {
-    char *restrict const p_info = position_string(w_ctx, t, p);
-    wout("%s: %s: %s\n", String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm),
-         p_info);
-
-    heap_free(p_info);
-  }
 ret:
   Numeric_char_free(b);
   Numeric_char_free(pr);
@@ -3139,12 +4581,13 @@ static struct Array *trades_load(const struct worker_ctx *restrict const w_ctx,
   struct db_trade_rec *restrict const trade = tls->trades_load.trade;
   void *const *items;
 
-  db_trades_open(w_ctx->db, String_chars(w_ctx->e->id),
-                 String_chars(w_ctx->m->id));
+  void *restrict const db = db_pool_acquire(db_trading);
+
+  db_trades_open(db, String_chars(w_ctx->e->id), String_chars(w_ctx->m->id));
 
   struct Array *restrict const trades = Array_new(128);
 
-  while (db_trades_next(trade, w_ctx->db)) {
+  while (db_trades_next(trade, db)) {
     struct Trade *restrict const t = trade_new(w_ctx->e->id, w_ctx->m->id);
 
     t->id = String_cnew(trade->id);
@@ -3156,6 +4599,9 @@ static struct Array *trades_load(const struct worker_ctx *restrict const w_ctx,
 
     t->p_long.id = trade->bo_id_null ? NULL : String_cnew(trade->bo_id);
 
+    if (t->p_long.id != NULL)
+      order_index_put(t->p_long.id, t);
+
     if (!trade->b_cnanos_null)
       Numeric_copy_to(trade->b_cnanos, t->p_long.cnanos);
     else
@@ -3187,6 +4633,9 @@ static struct Array *trades_load(const struct worker_ctx *restrict const w_ctx,
 
     t->p_short.id = trade->so_id_null ? NULL : String_cnew(trade->so_id);
 
+    if (t->p_short.id != NULL)
+      order_index_put(t->p_short.id, t);
+
     if (!trade->s_cnanos_null)
       Numeric_copy_to(trade->s_cnanos, t->p_short.cnanos);
     else
@@ -3247,12 +4696,17 @@ static struct Array *trades_load(const struct worker_ctx *restrict const w_ctx,
     Array_add_tail(trades, t);
   }
 
-  db_trades_close(w_ctx->db);
+  db_trades_close(db);
 
   items = Array_items(trades);
+  for (size_t i = Array_size(trades); i-- > 0;)
+    trade_state_load(db, items[i]);
+
+  // Creating trades acquires connections of its own.
+  db_pool_release(db_trading, db);
+
   for (size_t i = Array_size(trades); i-- > 0;) {
     struct Trade *restrict const t = items[i];
-    trade_state_load(w_ctx->db, t);
     Numeric_copy_to(zero, t->p_long.pnanos);
     Numeric_copy_to(zero, t->p_short.pnanos);
     if (w_ctx->m_cnf != NULL)
@@ -3262,127 +4716,630 @@ static struct Array *trades_load(const struct worker_ctx *restrict const w_ctx,
   return trades;
 }
 
-static int orders_process(void *restrict const arg) {
-  struct worker_ctx *restrict const w_ctx = arg;
+struct orders_reconcile_ctx {
+  struct Array *restrict jobs;
+  size_t next;
+  size_t done;
+  size_t cnt;
+  mtx_t mtx;
+};
 
-  while (!terminated) {
-    struct Trade *restrict t = NULL;
-    struct Position *restrict p = NULL;
-    struct Array *restrict trades = NULL;
-    struct Array *restrict samples = NULL;
-    size_t i;
-    void *const *restrict items;
-    struct Order *restrict const order = w_ctx->e->order_await();
+/*
+ * Lists the orders of a market placed since the oldest position still
+ * awaiting its order and keeps those of such positions for their first
+ * maintenance. Returns the number of orders kept.
+ */
+static size_t
+orders_reconcile_market(const struct worker_ctx *restrict const w_ctx) {
+  const struct abag_tls *restrict const tls = abag_tls();
+  struct db_trade_rec *restrict const trade = tls->trades_load.trade;
+  struct Array *restrict const o_ids = Array_new(128);
+  struct Numeric *restrict since = NULL;
+  size_t cnt = 0;
 
-    if (order == NULL)
-      continue;
+  void *restrict const db = db_pool_acquire(db_trading);
 
-    struct Market *restrict const market = w_ctx->e->market(order->m_id);
+  db_trades_open(db, String_chars(w_ctx->e->id), String_chars(w_ctx->m->id));
 
-    if (market == NULL) {
-      werr("%s: Market: Not available: %s\n", String_chars(w_ctx->e->nm),
-           String_chars(order->m_id));
+  while (db_trades_next(trade, db)) {
+    const char *restrict o_id;
+    const struct Numeric *restrict cnanos;
 
-      Order_delete(order);
+    switch (trade_status(trade->status)) {
+    case TRADE_STATUS_BUYING:
+      if (trade->bo_id_null || trade->b_cnanos_null)
+        continue;
+
+      o_id = trade->bo_id;
+      cnanos = trade->b_cnanos;
+      break;
+    case TRADE_STATUS_SELLING:
+      if (trade->so_id_null || trade->s_cnanos_null)
+        continue;
+
+      o_id = trade->so_id;
+      cnanos = trade->s_cnanos;
+      break;
+    default:
       continue;
     }
 
-    w_ctx->m = Market_copy(market);
-    w_ctx->m_cnf = marketconfig(w_ctx->e->nm, w_ctx->m->nm);
+    Array_add_tail(o_ids, String_cnew(o_id));
 
-    mutex_unlock(market->mtx);
+    if (since == NULL)
+      since = Numeric_copy(cnanos);
+    else if (Numeric_cmp(cnanos, since) < 0)
+      Numeric_copy_to(cnanos, since);
+  }
 
-    Map_lock(market_samples);
-    samples = Map_get(market_samples, order->m_id);
-    Map_unlock(market_samples);
+  db_trades_close(db);
+  db_pool_release(db_trading, db);
 
-    if (samples == NULL) {
-      Order_delete(order);
-      Market_delete(w_ctx->m);
-      continue;
-    }
+  if (since == NULL)
+    goto ret;
 
-    Array_lock(samples);
+  // Tolerate clocks of the exchange running behind.
+  struct Numeric *restrict const start = Numeric_sub(since, minute_nanos);
+  struct Array *restrict const orders = w_ctx->e->orders(w_ctx->m, start);
+  Numeric_delete(start);
 
-    if (Array_size(samples) < 2) {
-      Array_unlock(samples);
-      Market_delete(w_ctx->m);
-      Order_delete(order);
-      continue;
-    }
+  if (orders == NULL) {
+    werr("%s: %s: Reconcile: Failure listing orders\n",
+         String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm));
+    goto ret;
+  }
 
-    Map_lock(market_trades);
-    trades = Map_get(market_trades, order->m_id);
-    Map_unlock(market_trades);
+  void *const *restrict const items = Array_items(orders);
+  void *const *restrict const id_items = Array_items(o_ids);
+  for (size_t i = Array_size(orders); i-- > 0;) {
+    struct Order *restrict const o = items[i];
+    bool found = false;
 
-    if (trades == NULL) {
-      Array_unlock(samples);
-      Market_delete(w_ctx->m);
-      Order_delete(order);
+    for (size_t j = Array_size(o_ids); j-- > 0 && !found;)
+      found = String_equals(o->id, id_items[j]);
+
+    if (!found) {
+      Order_delete(o);
       continue;
     }
 
-    Array_unlock(samples);
+    Map_lock(order_preloads);
+    Order_delete(Map_put(order_preloads, o->id, o));
+    Map_unlock(order_preloads);
+    cnt++;
+  }
 
-    Array_lock(trades);
-    items = Array_items(trades);
-    for (i = Array_size(trades); i-- > 0;) {
-      struct Trade *restrict const trade = items[i];
+  Array_delete(orders, NULL);
+ret:
+  Numeric_delete(since);
+  Array_delete(o_ids, String_delete);
+  return cnt;
+}
 
-      if (trade->p_long.id != NULL &&
-          String_equals(trade->p_long.id, order->id)) {
-        t = trade;
-        p = &trade->p_long;
-        break;
-      }
-      if (trade->p_short.id != NULL &&
-          String_equals(trade->p_short.id, order->id)) {
-        t = trade;
-        p = &trade->p_short;
-        break;
-      }
+static int orders_reconcile_worker(void *restrict const arg) {
+  struct orders_reconcile_ctx *restrict const ctx = arg;
+  void *const *restrict const items = Array_items(ctx->jobs);
+
+  while (!terminated) {
+    mutex_lock(&ctx->mtx);
+
+    if (ctx->next == Array_size(ctx->jobs)) {
+      mutex_unlock(&ctx->mtx);
+      break;
     }
 
-    if (t != NULL) {
-      if (t->status == TRADE_STATUS_BUYING ||
-          t->status == TRADE_STATUS_SELLING) {
-        t->a = algorithm(w_ctx->m_cnf->a_nm);
-        Array_lock(samples);
-        if (Array_size(samples) > 1) {
-          const struct Sample *restrict const s = Array_tail(samples);
-          mutex_lock(&t->mtx);
-          trade_pricing(w_ctx, t, samples, s);
-          if (TRADE_IS_READY(t)) {
-            position_maintain(w_ctx, t, p, samples, s, order);
-            trade_maintain(w_ctx, t, samples, s);
-          }
-          mutex_unlock(&t->mtx);
-        }
-        Array_unlock(samples);
-      }
+    const struct worker_ctx *restrict const w_ctx = items[ctx->next++];
+    mutex_unlock(&ctx->mtx);
 
-      if (t->status == TRADE_STATUS_CANCELLED ||
-          t->status == TRADE_STATUS_DONE) {
-        mutex_lock(&t->mtx);
+    const size_t o_cnt = orders_reconcile_market(w_ctx);
 
-        if (!TRADE_IS_ENQUEUED(t) && !TRADE_IS_DELETED(t)) {
-          mutex_unlock(&t->mtx);
-          trade_delete(t);
-        } else {
-          TRADE_SET_DELETED(t);
-          mutex_unlock(&t->mtx);
-        }
+    mutex_lock(&ctx->mtx);
+    ctx->cnt += o_cnt;
+    const size_t done = ++ctx->done;
+    const size_t cnt = ctx->cnt;
+    mutex_unlock(&ctx->mtx);
 
-        Array_remove_idx(trades, i);
+    if (verbose && (done * 10 / Array_size(ctx->jobs) !=
+                    (done - 1) * 10 / Array_size(ctx->jobs)))
+      wout("Reconcile: %zu/%zu markets, %zu orders\n", done,
+           Array_size(ctx->jobs), cnt);
+  }
+
+  return 0;
+}
+
+/*
+ * Fetches the orders of the positions restored from the database in bulk
+ * before any worker runs, so that the first maintenance of those positions
+ * does not have to query the exchange order by order. Exchanges not
+ * providing order listings are skipped.
+ */
+static void orders_reconcile(const size_t workers) {
+  if (workers == 0)
+    return;
+
+  struct Array *restrict const jobs = Array_new(PRODUCTS_MAP_CAPACITY);
+  void *const *restrict const items = Array_items(exchanges);
+
+  for (size_t i = Array_size(exchanges); i-- > 0;) {
+    const struct Exchange *restrict const e = items[i];
+
+    if (e->orders == NULL)
+      continue;
+
+    struct Array *restrict const markets = e->markets();
+    void *const *restrict const m_items = Array_items(markets);
+
+    for (size_t j = Array_size(markets); j-- > 0;) {
+      const struct Market *restrict const m = m_items[j];
+      const struct MarketConfig *restrict const m_cnf =
+          marketconfig(e->nm, m->nm);
+
+      if (m_cnf == NULL)
+        continue;
+
+      struct worker_ctx *restrict const w_ctx =
+          heap_calloc(1, sizeof(struct worker_ctx));
+
+      w_ctx->e = e;
+      w_ctx->m = Market_copy(m);
+      w_ctx->m_cnf = m_cnf;
+      Array_add_tail(jobs, w_ctx);
+    }
+
+    Array_unlock(markets);
+  }
+
+  if (Array_size(jobs) > 0) {
+    const size_t t_cnt =
+        workers < Array_size(jobs) ? workers : Array_size(jobs);
+    thrd_t *restrict const thrds = heap_calloc(t_cnt, sizeof(thrd_t));
+    struct orders_reconcile_ctx ctx = {.jobs = jobs};
+
+    mutex_init(&ctx.mtx);
+
+    if (verbose)
+      wout("Reconcile: %zu markets, %zu workers\n", Array_size(jobs), t_cnt);
+
+    for (size_t i = 0; i < t_cnt; i++)
+      thread_create(&thrds[i], orders_reconcile_worker, &ctx);
+
+    for (size_t i = 0; i < t_cnt; i++)
+      thread_join(thrds[i], NULL);
+
+    mutex_destroy(&ctx.mtx);
+    heap_free(thrds);
+  }
+
+  Array_delete(jobs, worker_ctx_delete);
+}
+
+/*
+ * Applies an order to the position it has been placed for. Expects the trades
+ * of the market of the order to be locked. Returns true, if the trade got
+ * removed from those trades.
+ */
+static bool order_apply(const struct worker_ctx *restrict const w_ctx,
+                        struct Array *restrict const trades,
+                        struct Array *restrict const samples,
+                        struct Trade *restrict const t,
+                        struct Position *restrict const p,
+                        struct Order *restrict const order) {
+  void *const *restrict items;
+
+  Order_delete(order_preload_take(order->id));
+
+  if (t->status == TRADE_STATUS_BUYING || t->status == TRADE_STATUS_SELLING) {
+    t->a = algorithm(w_ctx->m_cnf->a_nm);
+    Array_lock(samples);
+    if (Array_size(samples) > 1) {
+      const struct Sample *restrict const s = Array_tail(samples);
+      mutex_lock(&t->mtx);
+      trade_pricing(w_ctx, t, samples, s);
+      if (TRADE_IS_READY(t)) {
+        position_maintain(w_ctx, t, p, samples, s, order);
+        trade_maintain(w_ctx, t, samples, s);
       }
+      mutex_unlock(&t->mtx);
+    }
+    Array_unlock(samples);
+  }
+
+  if (t->status != TRADE_STATUS_CANCELLED && t->status != TRADE_STATUS_DONE)
+    return false;
+
+  order_index_trade_remove(t);
+  mutex_lock(&t->mtx);
+
+  if (!TRADE_IS_ENQUEUED(t) && !TRADE_IS_DELETED(t))
+    trade_release(t);
+  else {
+    TRADE_SET_DELETED(t);
+    mutex_unlock(&t->mtx);
+  }
+
+  items = Array_items(trades);
+  for (size_t i = Array_size(trades); i-- > 0;)
+    if (items[i] == t) {
+      Array_remove_idx(trades, i);
+      break;
+    }
+
+  return true;
+}
+
+static int orders_process(void *restrict const arg) {
+  struct worker_ctx *restrict const w_ctx = arg;
+
+  while (!terminated) {
+    struct Trade *restrict t = NULL;
+    struct Position *restrict p = NULL;
+    struct Array *restrict trades = NULL;
+    struct Array *restrict samples = NULL;
+    struct Order *restrict order =
+        w_ctx->orders_queue != NULL ? Queue_dequeue_await(w_ctx->orders_queue)
+                                    : w_ctx->e->order_await();
+
+    if (order == NULL)
+      continue;
+
+    struct Market *restrict const market = w_ctx->e->market(order->m_id);
+
+    if (market == NULL) {
+      werr("%s: Market: Not available: %s\n", String_chars(w_ctx->e->nm),
+           String_chars(order->m_id));
+
+      Order_delete(order);
+      continue;
+    }
+
+    w_ctx->m = Market_copy(market);
+    w_ctx->m_cnf = marketconfig(w_ctx->e->nm, w_ctx->m->nm);
+
+    mutex_unlock(market->mtx);
+
+    Map_lock(market_samples);
+    samples = Map_get(market_samples, order->m_id);
+    Map_unlock(market_samples);
+
+    if (samples == NULL) {
+      Order_delete(order);
+      Market_delete(w_ctx->m);
+      continue;
+    }
+
+    Array_lock(samples);
+
+    if (Array_size(samples) < 2) {
+      Array_unlock(samples);
+      Market_delete(w_ctx->m);
+      Order_delete(order);
+      continue;
     }
 
+    Map_lock(market_trades);
+    trades = Map_get(market_trades, order->m_id);
+    Map_unlock(market_trades);
+
+    if (trades == NULL) {
+      Array_unlock(samples);
+      Market_delete(w_ctx->m);
+      Order_delete(order);
+      continue;
+    }
+
+    Array_unlock(samples);
+
+    Array_lock(trades);
+    t = order_index_get(order->id);
+
+    if (t != NULL && String_equals(t->m_id, order->m_id)) {
+      if (t->p_long.id != NULL && String_equals(t->p_long.id, order->id))
+        p = &t->p_long;
+      else if (t->p_short.id != NULL &&
+               String_equals(t->p_short.id, order->id))
+        p = &t->p_short;
+    }
+
+    if (p != NULL)
+      order_apply(w_ctx, trades, samples, t, p, order);
+    else if (t == NULL && order_stray_put(order))
+      order = NULL;
+
     Array_unlock(trades);
     Market_delete(w_ctx->m);
     Order_delete(order);
   }
 
-  db_disconnect(w_ctx->db);
+  heap_free(w_ctx);
+  thread_exit(EXIT_SUCCESS);
+}
+
+/*
+ * Distributes the orders of an exchange to the order workers by market, so
+ * that the orders of a market are processed by the same worker in the order
+ * received.
+ */
+static int orders_dispatch(void *restrict const arg) {
+  struct worker_ctx *restrict const w_ctx = arg;
+  void *const *restrict const items = Array_items(w_ctx->orders_queues);
+  const size_t nqueues = Array_size(w_ctx->orders_queues);
+
+  while (!terminated) {
+    struct Order *restrict const order = w_ctx->e->order_await();
+
+    if (order == NULL)
+      continue;
+
+    Queue_enqueue_await(items[String_hash(order->m_id) % nqueues], order);
+  }
+
+  heap_free(w_ctx);
+  thread_exit(EXIT_SUCCESS);
+}
+
+// Expects the trades to be locked.
+static bool trade_find(const struct Array *restrict const trades,
+                       const struct Trade *restrict const t) {
+  void *const *restrict const items = Array_items(trades);
+
+  for (size_t i = Array_size(trades); i-- > 0;)
+    if (items[i] == t)
+      return true;
+
+  return false;
+}
+
+/*
+ * Places the orders submitted for the positions of an exchange and completes
+ * those positions with the outcome. Orders reported by the exchange before
+ * completion are applied afterwards, in the order received.
+ */
+static int orders_submit(void *restrict const arg) {
+  struct worker_ctx *restrict const w_ctx = arg;
+  void *const *restrict items;
+
+  while (!terminated) {
+    struct order_submission *restrict const s =
+        Queue_dequeue_await(w_ctx->submit_queue);
+
+    if (s == NULL)
+      continue;
+
+    struct Trade *restrict const t = s->t;
+    struct Position *restrict const p = s->p;
+    struct String *restrict o_id = NULL;
+
+    Map_lock(market_samples);
+    struct Array *restrict const samples = Map_get(market_samples, s->m_id);
+    Map_unlock(market_samples);
+
+    Map_lock(market_trades);
+    struct Array *restrict const trades = Map_get(market_trades, s->m_id);
+    Map_unlock(market_trades);
+
+    if (samples == NULL || trades == NULL)
+      panic();
+
+    // A pending trade is not deleted, but may have been removed meanwhile.
+    Array_lock(trades);
+    bool found = trade_find(trades, t);
+    Array_unlock(trades);
+
+    struct Market *restrict const m =
+        found ? w_ctx->e->market(s->m_id) : NULL;
+
+    if (m != NULL) {
+      w_ctx->m = Market_copy(m);
+      mutex_unlock(m->mtx);
+      w_ctx->m_cnf = marketconfig(w_ctx->e->nm, w_ctx->m->nm);
+    } else if (found)
+      werr("%s: %s: Market: Not available\n", String_chars(w_ctx->e->nm),
+           String_chars(s->m_id));
+
+    if (w_ctx->m != NULL && w_ctx->m_cnf != NULL) {
+      char *restrict const b = Numeric_to_char(s->b_ordered, w_ctx->m->b_sc);
+      char *restrict const pr = Numeric_to_char(s->price, w_ctx->m->p_sc);
+
+      // Journaled state must not lag behind orders placed at the exchange.
+      void *restrict const db = db_pool_acquire(db_trading);
+      state_trade_flush(db, t);
+      db_pool_release(db_trading, db);
+
+      o_id = p->type == POSITION_TYPE_LONG
+                 ? w_ctx->e->order_demand(w_ctx->m, b, pr)
+                 : w_ctx->e->order_supply(w_ctx->m, b, pr);
+
+      if (o_id == NULL)
+        werr("%s: %s: %s: Failure creating %s order\n",
+             String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm), s->info,
+             p->type == POSITION_TYPE_LONG ? "buy" : "sell");
+
+      Numeric_char_free(b);
+      Numeric_char_free(pr);
+    }
+
+    Array_lock(trades);
+    found = trade_find(trades, t);
+
+    Array_lock(samples);
+    mutex_lock(&t->mtx);
+    p->pending = false;
+
+    if (found && o_id != NULL) {
+      p->id = o_id;
+      order_index_put(o_id, t);
+      Numeric_copy_to(s->price, p->price);
+      Numeric_copy_to(s->b_ordered, p->b_ordered);
+      position_create(w_ctx, t, p);
+
+      if (Array_size(samples) > 0)
+        position_timeout(w_ctx, t, p, samples, Array_tail(samples));
+
+      if (verbose) {
+        char *restrict const p_info = position_string(w_ctx, t, p);
+        wout("%s: %s: %s\n", String_chars(w_ctx->e->nm),
+             String_chars(w_ctx->m->nm), p_info);
+
+        heap_free(p_info);
+      }
+    }
+
+    // Removed trades still queued for pricing are deleted by that worker.
+    if (!found && !TRADE_IS_ENQUEUED(t) && !TRADE_IS_DELETED(t))
+      trade_release(t);
+    else
+      mutex_unlock(&t->mtx);
+
+    Array_unlock(samples);
+
+    struct Array *restrict const strays =
+        order_strays_take(found ? o_id : NULL);
+
+    if (strays != NULL) {
+      items = Array_items(strays);
+      for (size_t i = 0; i < Array_size(strays); i++)
+        if (String_equals(((struct Order *)items[i])->m_id, s->m_id) &&
+            order_apply(w_ctx, trades, samples, t, p, items[i]))
+          break;
+
+      Array_delete(strays, Order_delete);
+    }
+
+    Array_unlock(trades);
+
+    if (!found && o_id != NULL) {
+      werr("%s: %s: %s: Trade gone, cancelling order: %s\n",
+           String_chars(w_ctx->e->nm), String_chars(w_ctx->m->nm), s->info,
+           String_chars(o_id));
+
+      order_cancel_request(w_ctx, NULL, o_id, s->info);
+      String_delete(o_id);
+    }
+
+    Market_delete(w_ctx->m);
+    w_ctx->m = NULL;
+    w_ctx->m_cnf = NULL;
+    order_submission_delete(s);
+  }
+
+  heap_free(w_ctx);
+  thread_exit(EXIT_SUCCESS);
+}
+
+static void orders_cancel_each(const struct Exchange *restrict const e,
+                               struct Array *restrict const cancels) {
+  void *const *restrict const items = Array_items(cancels);
+
+  for (size_t i = 0; i < Array_size(cancels); i++) {
+    struct Order *restrict const o = items[i];
+    struct Market *restrict const m = e->market(o->m_id);
+
+    if (m == NULL) {
+      werr("%s: %s: Market: Not available\n", String_chars(e->nm),
+           String_chars(o->m_id));
+      continue;
+    }
+
+    struct Market *restrict const m_copy = Market_copy(m);
+    mutex_unlock(m->mtx);
+
+    if (e->order_cancel(m_copy, o->id))
+      o->status = ORDER_STATUS_CANCELLED;
+
+    Market_delete(m_copy);
+  }
+}
+
+/*
+ * Hands the orders requested so far to the exchange and reports the outcome
+ * per position.
+ */
+static void orders_cancel_flush(struct order_cancels *restrict const c) {
+  const struct Exchange *restrict const e = c->e;
+
+  mutex_lock(&c->mtx);
+  struct Array *restrict const requests = c->orders;
+  c->orders = Array_new(ORDERS_CANCEL_CAPACITY);
+  mutex_unlock(&c->mtx);
+
+  void *const *restrict const items = Array_items(requests);
+  struct Array *restrict const cancels = Array_new(Array_size(requests) + 1);
+
+  for (size_t i = 0; i < Array_size(requests); i++)
+    Array_add_tail(cancels, ((struct order_cancel *)items[i])->o);
+
+  if (Array_size(cancels) > 0) {
+    if (e->orders_cancel != NULL) {
+      if (!e->orders_cancel(cancels))
+        werr("%s: Failure cancelling %zu orders\n", String_chars(e->nm),
+             Array_size(cancels));
+    } else
+      orders_cancel_each(e, cancels);
+  }
+
+  for (size_t i = 0; i < Array_size(requests); i++) {
+    const struct order_cancel *restrict const r = items[i];
+
+    if (r->o->status != ORDER_STATUS_CANCELLED) {
+      if (r->t_id != NULL) {
+        werr("%s: %s: Position: Failure cancelling order: %s\n",
+             String_chars(e->nm), String_chars(r->m_nm),
+             String_chars(r->t_id));
+
+        werr("%s: %s: %s\n", String_chars(e->nm), String_chars(r->m_nm),
+             r->info);
+      } else
+        werr("%s: %s: %s: Failure cancelling order: %s\n",
+             String_chars(e->nm), String_chars(r->m_nm), r->info,
+             String_chars(r->o->id));
+    } else if (verbose)
+      wout("%s: %s: Order cancelled: %s\n", String_chars(e->nm),
+           String_chars(r->m_nm), String_chars(r->o->id));
+  }
+
+  Array_delete(cancels, NULL);
+  Array_delete(requests, order_cancel_delete);
+}
+
+/*
+ * Cancels the orders requested for an exchange. Requests arriving within
+ * ABAG_CANCEL_BATCH_MILLIS of the first one are handed to the exchange
+ * together. Positions learn about the outcome from the order events. Requests
+ * still pending on termination are cancelled before the thread exits.
+ */
+static int orders_cancel(void *restrict const arg) {
+  struct worker_ctx *restrict const w_ctx = arg;
+  struct order_cancels *restrict const c = w_ctx->cancels;
+  const struct timespec batch_rate = {
+      .tv_sec = (time_t)(cancel_batch_millis / 1000UL),
+      .tv_nsec = (long)(cancel_batch_millis % 1000UL) * 1000000L,
+  };
+  struct timespec to;
+
+  while (!terminated) {
+    mutex_lock(&c->mtx);
+
+    if (Array_size(c->orders) == 0) {
+      time_now(&to);
+      to.tv_sec += 1;
+      condition_timedwait(&c->cnd, &c->mtx, &to);
+    }
+
+    const bool requested = Array_size(c->orders) > 0;
+    mutex_unlock(&c->mtx);
+
+    if (!requested)
+      continue;
+
+    if (cancel_batch_millis > 0 && !terminated)
+      thread_sleep(&batch_rate);
+
+    orders_cancel_flush(c);
+  }
+
+  orders_cancel_flush(c);
+
   heap_free(w_ctx);
   thread_exit(EXIT_SUCCESS);
 }
@@ -3417,10 +5374,24 @@ static int samples_process(void *restrict const arg) {
 
     w_ctx->m_cnf = marketconfig(w_ctx->e->nm, w_ctx->m->nm);
 
-    if (ticker_exporter)
-      db_sample_create(w_ctx->db, String_chars(w_ctx->e->id),
+    Map_lock(market_last_prices);
+    struct Numeric *restrict pr = Map_get(market_last_prices, w_ctx->m->id);
+    if (pr == NULL)
+      Map_put(market_last_prices, w_ctx->m->id, Numeric_copy(sample->price));
+    else
+      Numeric_copy_to(sample->price, pr);
+    Map_unlock(market_last_prices);
+
+    if (ticker_exporter) {
+      void *restrict const db = db_pool_acquire(db_ingest);
+      db_sample_create(db, String_chars(w_ctx->e->id),
                        String_chars(w_ctx->m->id), sample->nanos,
                        sample->price);
+      db_pool_release(db_ingest, db);
+
+      if (*samples_archive)
+        samples_archive_append(w_ctx, sample);
+    }
 
     if (!w_ctx->m->is_tradeable) {
       Sample_delete(sample);
@@ -3508,7 +5479,7 @@ static int samples_process(void *restrict const arg) {
           const struct Sample *restrict const s = Array_tail(samples);
           mutex_lock(&t->mtx);
           trade_pricing(w_ctx, t, samples, s);
-          if (TRADE_IS_READY(t))
+          if (TRADE_IS_READY(t) && !TRADE_IS_PENDING(t))
             trade_maintain(w_ctx, t, samples, s);
           mutex_unlock(&t->mtx);
         }
@@ -3516,12 +5487,12 @@ static int samples_process(void *restrict const arg) {
 
         if (t->status == TRADE_STATUS_CANCELLED ||
             t->status == TRADE_STATUS_DONE) {
+          order_index_trade_remove(t);
           mutex_lock(&t->mtx);
 
-          if (!TRADE_IS_ENQUEUED(t) && !TRADE_IS_DELETED(t)) {
-            mutex_unlock(&t->mtx);
-            trade_delete(t);
-          } else {
+          if (!TRADE_IS_ENQUEUED(t) && !TRADE_IS_DELETED(t))
+            trade_release(t);
+          else {
             TRADE_SET_DELETED(t);
             mutex_unlock(&t->mtx);
           }
@@ -3538,6 +5509,7 @@ static int samples_process(void *restrict const arg) {
         wout("%s: %s: Position: Unconfigured: %s\n", String_chars(w_ctx->e->nm),
              String_chars(w_ctx->m->nm), String_chars(t->id));
 
+        order_index_trade_remove(t);
         Array_remove_idx(trades, i);
         goto again;
       }
@@ -3557,7 +5529,6 @@ static int samples_process(void *restrict const arg) {
     Market_delete(w_ctx->m);
   }
 
-  db_disconnect(w_ctx->db);
   heap_free(arg);
   thread_exit(EXIT_SUCCESS);
 }
@@ -3585,10 +5556,9 @@ static int trades_process(void *restrict const arg) {
            String_chars(t->m_id));
 
       mutex_lock(&t->mtx);
-      if (TRADE_IS_DELETED(t)) {
-        mutex_unlock(&t->mtx);
-        trade_delete(t);
-      } else {
+      if (TRADE_IS_DELETED(t))
+        trade_release(t);
+      else {
         TRADE_UNSET_ENQUEUED(t);
         mutex_unlock(&t->mtx);
       }
@@ -3602,10 +5572,9 @@ static int trades_process(void *restrict const arg) {
 
     if (w_ctx->m_cnf == NULL || w_ctx->m_cnf->v_pc != NULL) {
       mutex_lock(&t->mtx);
-      if (TRADE_IS_DELETED(t)) {
-        mutex_unlock(&t->mtx);
-        trade_delete(t);
-      } else {
+      if (TRADE_IS_DELETED(t))
+        trade_release(t);
+      else {
         TRADE_UNSET_ENQUEUED(t);
         mutex_unlock(&t->mtx);
       }
@@ -3613,7 +5582,9 @@ static int trades_process(void *restrict const arg) {
       continue;
     }
 
-    db_volatility_open(w_ctx->db, String_chars(w_ctx->e->id),
+    void *restrict const db = db_pool_acquire(db_analytic);
+
+    db_volatility_open(db, String_chars(w_ctx->e->id),
                        String_chars(w_ctx->m->id), w_ctx->m_cnf->wnanos);
 
     if (w_ctx->m_cnf->v_wnanos == NULL) {
@@ -3621,18 +5592,19 @@ static int trades_process(void *restrict const arg) {
 
       items = Array_items(volatility_windows);
       for (size_t i = Array_size(volatility_windows); !terminated && i-- > 0;) {
-        db_volatility(r0, w_ctx->db, items[i]);
+        db_volatility(r0, db, items[i]);
 
         if (Numeric_cmp(r0, tp_pc) > 0)
           Numeric_copy_to(r0, tp_pc);
       }
 
       if (terminated) {
+        db_volatility_close(db);
+        db_pool_release(db_analytic, db);
         mutex_lock(&t->mtx);
-        if (TRADE_IS_DELETED(t)) {
-          mutex_unlock(&t->mtx);
-          trade_delete(t);
-        } else {
+        if (TRADE_IS_DELETED(t))
+          trade_release(t);
+        else {
           TRADE_UNSET_ENQUEUED(t);
           mutex_unlock(&t->mtx);
         }
@@ -3640,9 +5612,10 @@ static int trades_process(void *restrict const arg) {
         continue;
       }
     } else
-      db_volatility(tp_pc, w_ctx->db, w_ctx->m_cnf->v_wnanos);
+      db_volatility(tp_pc, db, w_ctx->m_cnf->v_wnanos);
 
-    db_volatility_close(w_ctx->db);
+    db_volatility_close(db);
+    db_pool_release(db_analytic, db);
 
     if (Numeric_cmp(tp_pc, t->fee_pc) < 0) {
       char *restrict const stddev = Numeric_to_char(tp_pc, 4);
@@ -3679,20 +5652,18 @@ static int trades_process(void *restrict const arg) {
     }
 
     mutex_lock(&t->mtx);
-    if (TRADE_IS_DELETED(t)) {
-      mutex_unlock(&t->mtx);
-      trade_delete(t);
-    } else {
+    if (TRADE_IS_DELETED(t))
+      trade_release(t);
+    else {
       TRADE_SET_READY(t, tp_pc);
       Numeric_div_to(t->tp_pc, hundred, r0);
       Numeric_add_to(r0, one, t->tp_pf);
-      trade_state_save(w_ctx->db, t);
+      trade_state_save(t);
       mutex_unlock(&t->mtx);
     }
     Market_delete(w_ctx->m);
   }
 
-  db_disconnect(w_ctx->db);
   Numeric_delete(tp_pc);
   Numeric_delete(r0);
   heap_free(arg);
@@ -3711,10 +5682,107 @@ static int exchange_stop(void *restrict const arg) {
 
   e_ctx->e->stop();
   Queue_stop(e_ctx->trades_queue);
+  Queue_stop(e_ctx->submit_queue);
+
+  if (e_ctx->orders_queues != NULL) {
+    void *const *restrict const items = Array_items(e_ctx->orders_queues);
+    for (size_t i = Array_size(e_ctx->orders_queues); i-- > 0;)
+      Queue_stop(items[i]);
+  }
+
   heap_free(e_ctx);
   thread_exit(EXIT_SUCCESS);
 }
 
+static int stats_refresh(void *restrict const arg) {
+  void *restrict const db = arg;
+  struct db_stats_rec *restrict const rec = stats_new();
+  struct timespec sleep_rate = {
+      .tv_sec = 1,
+      .tv_nsec = 0L,
+  };
+  unsigned long secs = 0;
+
+  while (!terminated) {
+    thread_sleep(&sleep_rate);
+    stats_fetch_pending(db, rec);
+
+    if (stats_refresh_secs == 0 || ++secs < stats_refresh_secs)
+      continue;
+
+    secs = 0;
+    stats_load(db, rec);
+  }
+
+  stats_delete(rec);
+  db_disconnect(db);
+  thread_exit(EXIT_SUCCESS);
+}
+
+static int plots_export(void *restrict const arg) {
+  (void)arg;
+  struct timespec to;
+
+  while (!terminated) {
+    mutex_lock(&plot_mtx);
+    time_now(&to);
+    to.tv_sec += 1;
+    condition_timedwait(&plot_cnd, &plot_mtx, &to);
+    struct Map *restrict const jobs = plot_jobs;
+    plot_jobs = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+    mutex_unlock(&plot_mtx);
+
+    struct MapIterator *restrict const it = MapIterator_new(jobs);
+    while (!terminated && MapIterator_next(it)) {
+      const struct plot_job *restrict const job = MapIterator_value(it);
+      void *restrict const db = db_pool_acquire(db_ingest);
+
+      if (!job->a->market_plot(db, job->e, job->m, job->fn))
+        werr("%s: %s: %s: Plot: Not plotted\n", String_chars(job->e->nm),
+             String_chars(job->m->nm), String_chars(job->a->nm));
+
+      db_pool_release(db_ingest, db);
+    }
+    MapIterator_delete(it);
+    Map_delete(jobs, plot_job_delete);
+  }
+
+  thread_exit(EXIT_SUCCESS);
+}
+
+static int state_persist(void *restrict const arg) {
+  void *restrict const db = arg;
+  const unsigned long step = state_wals[0] != NULL && state_wal_sync_millis > 0
+                                 ? state_wal_sync_millis
+                                 : state_flush_millis;
+  struct timespec sleep_rate = {
+      .tv_sec = (time_t)(step / 1000UL),
+      .tv_nsec = (long)(step % 1000UL) * 1000000L,
+  };
+  unsigned long millis = 0;
+
+  while (!terminated) {
+    thread_sleep(&sleep_rate);
+
+    // Group commit of everything logged since the last sync.
+    if (state_wals[0] != NULL) {
+      Wal_sync(state_wals[0]);
+      Wal_sync(state_wals[1]);
+    }
+
+    millis += step;
+
+    if (state_flush_millis == 0 || millis < state_flush_millis)
+      continue;
+
+    millis = 0;
+    state_flush(db);
+  }
+
+  db_disconnect(db);
+  thread_exit(EXIT_SUCCESS);
+}
+
 static inline void sample_array_delete(void *restrict const entry) {
   Array_delete(entry, Sample_delete);
 }
@@ -3733,6 +5801,26 @@ static inline void trade_queue_delete(void *restrict const entry) {
   Queue_delete(entry, trade_delete);
 }
 
+static inline void order_queue_delete(void *restrict const entry) {
+  Queue_delete(entry, Order_delete);
+}
+
+static inline void order_queues_delete(void *restrict const entry) {
+  Array_delete(entry, order_queue_delete);
+}
+
+static inline void submit_queue_delete(void *restrict const entry) {
+  Queue_delete(entry, order_submission_delete);
+}
+
+static inline void order_cancels_delete(void *restrict const entry) {
+  struct order_cancels *restrict const c = entry;
+  Array_delete(c->orders, order_cancel_delete);
+  mutex_destroy(&c->mtx);
+  condition_destroy(&c->cnd);
+  heap_free(c);
+}
+
 static inline void thrd_delete(void *restrict const entry) { heap_free(entry); }
 
 int abagnale(int argc, char *argv[]) {
@@ -3740,16 +5828,76 @@ int abagnale(int argc, char *argv[]) {
   const unsigned long order_workers =
       envul("ABAG_ORDER_WORKERS", DEFAULT_ABAG_ORDER_WORKERS);
 
+  const unsigned long submit_workers =
+      envul("ABAG_SUBMIT_WORKERS", DEFAULT_ABAG_SUBMIT_WORKERS);
+
+  cancel_batch_millis =
+      envul("ABAG_CANCEL_BATCH_MILLIS", DEFAULT_ABAG_CANCEL_BATCH_MILLIS);
+
   const unsigned long ticker_workers =
       envul("ABAG_TICKER_WORKERS", DEFAULT_ABAG_TICKER_WORKERS);
 
   const unsigned long trade_workers =
       envul("ABAG_TRADE_WORKERS", DEFAULT_ABAG_TRADE_WORKERS);
 
+  stats_refresh_secs = envul("ABAG_STATISTICS_REFRESH_SECONDS",
+                             DEFAULT_ABAG_STATISTICS_REFRESH_SECONDS);
+
+  state_flush_millis =
+      envul("ABAG_STATE_FLUSH_MILLIS", DEFAULT_ABAG_STATE_FLUSH_MILLIS);
+
+  const char *restrict const state_wal_path =
+      envs("ABAG_STATE_WAL", DEFAULT_ABAG_STATE_WAL);
+
+  const unsigned long state_wal_size =
+      envul("ABAG_STATE_WAL_SIZE", DEFAULT_ABAG_STATE_WAL_SIZE);
+
+  state_wal_sync_millis =
+      envul("ABAG_STATE_WAL_SYNC_MILLIS", DEFAULT_ABAG_STATE_WAL_SYNC_MILLIS);
+
+  const unsigned long db_trading_cnt = envul(
+      "ABAG_DB_TRADING_CONNECTIONS", DEFAULT_ABAG_DB_TRADING_CONNECTIONS);
+
+  const unsigned long db_ingest_cnt =
+      envul("ABAG_DB_INGEST_CONNECTIONS", DEFAULT_ABAG_DB_INGEST_CONNECTIONS);
+
+  const unsigned long db_analytic_cnt = envul(
+      "ABAG_DB_ANALYTIC_CONNECTIONS", DEFAULT_ABAG_DB_ANALYTIC_CONNECTIONS);
+
+  const unsigned long warmup_workers = envul(
+      "ABAG_SAMPLES_WARMUP_WORKERS", DEFAULT_ABAG_SAMPLES_WARMUP_WORKERS);
+
+  samples_archive = envs("ABAG_SAMPLES_ARCHIVE", DEFAULT_ABAG_SAMPLES_ARCHIVE);
+
+  const unsigned long archive_gap_millis =
+      envul("ABAG_SAMPLES_ARCHIVE_GAP_MILLIS",
+            DEFAULT_ABAG_SAMPLES_ARCHIVE_GAP_MILLIS);
+
+  const unsigned long reconcile_workers = envul(
+      "ABAG_ORDERS_RECONCILE_WORKERS", DEFAULT_ABAG_ORDERS_RECONCILE_WORKERS);
+
+  ledger_refresh_millis =
+      envul("ABAG_LEDGER_REFRESH_MILLIS", DEFAULT_ABAG_LEDGER_REFRESH_MILLIS);
+
   if (verbose) {
     wout("\tABAG_ORDER_WORKERS=%lu\n", order_workers);
+    wout("\tABAG_SUBMIT_WORKERS=%lu\n", submit_workers);
+    wout("\tABAG_CANCEL_BATCH_MILLIS=%lu\n", cancel_batch_millis);
     wout("\tABAG_TICKER_WORKERS=%lu\n", ticker_workers);
     wout("\tABAG_TRADE_WORKERS=%lu\n", trade_workers);
+    wout("\tABAG_STATISTICS_REFRESH_SECONDS=%lu\n", stats_refresh_secs);
+    wout("\tABAG_STATE_FLUSH_MILLIS=%lu\n", state_flush_millis);
+    wout("\tABAG_STATE_WAL=%s\n", state_wal_path);
+    wout("\tABAG_STATE_WAL_SIZE=%lu\n", state_wal_size);
+    wout("\tABAG_STATE_WAL_SYNC_MILLIS=%lu\n", state_wal_sync_millis);
+    wout("\tABAG_DB_TRADING_CONNECTIONS=%lu\n", db_trading_cnt);
+    wout("\tABAG_DB_INGEST_CONNECTIONS=%lu\n", db_ingest_cnt);
+    wout("\tABAG_DB_ANALYTIC_CONNECTIONS=%lu\n", db_analytic_cnt);
+    wout("\tABAG_SAMPLES_WARMUP_WORKERS=%lu\n", warmup_workers);
+    wout("\tABAG_SAMPLES_ARCHIVE=%s\n", samples_archive);
+    wout("\tABAG_SAMPLES_ARCHIVE_GAP_MILLIS=%lu\n", archive_gap_millis);
+    wout("\tABAG_ORDERS_RECONCILE_WORKERS=%lu\n", reconcile_workers);
+    wout("\tABAG_LEDGER_REFRESH_MILLIS=%lu\n", ledger_refresh_millis);
   }
 
   if (Array_size(exchanges) == 0) {
@@ -3757,6 +5905,9 @@ int abagnale(int argc, char *argv[]) {
     return (EXIT_FAILURE);
   }
 
+  if (submit_workers == 0)
+    fatal("%s == 0", "ABAG_SUBMIT_WORKERS");
+
   // order_workers + trade_workers + ticker_workers + 1 <= ULONG_MAX
   // => trade_workers <= ULONG_MAX - ticker_workers - order_workers - 1
   // => ticker_workers <= ULONG_MAX - trade_workers - order_workers - 1
@@ -3781,12 +5932,101 @@ int abagnale(int argc, char *argv[]) {
   market_samples = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
   market_prices = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
   market_trades = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  market_stats = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  market_stats_missing = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  market_stats_pending = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  market_graphs = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  market_last_prices = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  order_trades = Map_new(StringMapOps, ORDERS_MAP_CAPACITY);
+  order_strays = Map_new(StringMapOps, ORDERS_MAP_CAPACITY);
+  order_preloads = Map_new(StringMapOps, ORDERS_MAP_CAPACITY);
+  market_ledgers = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  market_archives = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  samples_archive_gap = Numeric_new();
+  Numeric_from_int64_to((int64_t)archive_gap_millis * INT64_C(1000000),
+                        samples_archive_gap);
+  plot_jobs = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  mutex_init(&plot_mtx);
+  condition_init(&plot_cnd);
+  state_trades = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  state_positions = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  state_entries = Array_new(PRODUCTS_MAP_CAPACITY);
+  state_flushing_trades = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  state_flushing_positions = Map_new(StringMapOps, PRODUCTS_MAP_CAPACITY);
+  mutex_init(&state_mtx);
+  mutex_init(&state_flush_mtx);
+  condition_init(&state_flush_cnd);
+  db_trading = db_pool_new("trading", db_trading_cnt);
+  db_ingest = db_pool_new("ingest", db_ingest_cnt);
+  db_analytic = db_pool_new("analytic", db_analytic_cnt);
 
   tls_create(&abag_tls_key, abag_tls_dtor);
 
   struct Array *restrict const trade_queues = Array_new(128);
+  struct Array *restrict const order_queues = Array_new(128);
+  struct Array *restrict const submit_queues = Array_new(128);
+  struct Array *restrict const order_cancels = Array_new(128);
   struct Array *restrict const workers =
-      Array_new(w_cnt * Array_size(exchanges));
+      Array_new(w_cnt * Array_size(exchanges) + 2);
+
+  // Workers read statistics from memory; keep them current in the background.
+  void *restrict const stats_db = db_connect("statistics");
+  struct db_stats_rec *restrict const stats = stats_new();
+  stats_load(stats_db, stats);
+  stats_delete(stats);
+
+  thrd_t *restrict const stats_thrd = heap_calloc(1, sizeof(thrd_t));
+  thread_create(stats_thrd, stats_refresh, stats_db);
+  Array_add_tail(workers, stats_thrd);
+
+  // State changes are journaled in memory and written in batches.
+  void *restrict const state_persist_db = db_connect("state");
+
+  if (state_wal_path[0] != '\0') {
+    struct Wal *restrict wals[2];
+    const size_t len = strlen(state_wal_path) + 3;
+    char *restrict const path = heap_malloc(len);
+
+    for (size_t i = 0; i < nitems(wals); i++) {
+      const int r = snprintf(path, len, "%s.%zu", state_wal_path, i);
+
+      if (r < 0 || (size_t)r >= len)
+        panic();
+
+      wals[i] = Wal_new(path, state_wal_size);
+    }
+
+    heap_free(path);
+
+    // Whatever is logged did not reach the database before the last exit.
+    const size_t first = Wal_seq(wals[0]) <= Wal_seq(wals[1]) ? 0 : 1;
+    Wal_replay(wals[first], state_wal_apply, NULL);
+    Wal_replay(wals[first ^ 1], state_wal_apply, NULL);
+    state_flush(state_persist_db);
+    Wal_reset(wals[0], 0);
+    Wal_reset(wals[1], 0);
+
+    state_wals[0] = wals[0];
+    state_wals[1] = wals[1];
+    state_wal = 0;
+  }
+
+  if (state_flush_millis > 0 ||
+      (state_wals[0] != NULL && state_wal_sync_millis > 0)) {
+    thrd_t *restrict const thrd = heap_calloc(1, sizeof(thrd_t));
+    thread_create(thrd, state_persist, state_persist_db);
+    Array_add_tail(workers, thrd);
+  } else
+    db_disconnect(state_persist_db);
+
+  if (cnf->plts_dir != NULL) {
+    thrd_t *restrict const thrd = heap_calloc(1, sizeof(thrd_t));
+    thread_create(thrd, plots_export, NULL);
+    Array_add_tail(workers, thrd);
+  }
+
+  samples_warmup(warmup_workers);
+  orders_reconcile(reconcile_workers);
 
   items = Array_items(exchanges);
   for (size_t i = Array_size(exchanges); i-- > 0 && !terminated;) {
@@ -3799,37 +6039,100 @@ int abagnale(int argc, char *argv[]) {
     e_ctx->e->start();
     Queue_start(e_ctx->trades_queue);
     Array_add_tail(trade_queues, e_ctx->trades_queue);
+    e_ctx->submit_queue = Queue_new(PRODUCTS_QUEUE_CAPACITY, (time_t)0);
+    Queue_start(e_ctx->submit_queue);
+    Array_add_tail(submit_queues, e_ctx->submit_queue);
+
+    struct order_cancels *restrict const e_cancels =
+        heap_calloc(1, sizeof(struct order_cancels));
+
+    e_cancels->e = e;
+    e_cancels->orders = Array_new(ORDERS_CANCEL_CAPACITY);
+    mutex_init(&e_cancels->mtx);
+    condition_init(&e_cancels->cnd);
+    Array_add_tail(order_cancels, e_cancels);
+
+    /*
+     * Multiple order workers each get a queue of their own fed by a
+     * dispatcher, so that the orders of a market stay in sequence.
+     */
+    if (order_workers > 1) {
+      e_ctx->orders_queues = Array_new(order_workers);
+      Array_add_tail(order_queues, e_ctx->orders_queues);
+
+      for (size_t j = order_workers; j-- > 0;) {
+        struct Queue *restrict const q =
+            Queue_new(PRODUCTS_QUEUE_CAPACITY, (time_t)0);
+
+        Queue_start(q);
+        Array_add_tail(e_ctx->orders_queues, q);
+      }
+    }
 
+    struct Array *restrict const e_orders_queues = e_ctx->orders_queues;
+    struct Queue *restrict const e_submit_queue = e_ctx->submit_queue;
     thrd_t *restrict thrd = heap_calloc(1, sizeof(thrd_t));
     thread_create(thrd, exchange_stop, e_ctx);
     Array_add_tail(workers, thrd);
 
+    if (e_orders_queues != NULL) {
+      struct worker_ctx *restrict const d_ctx =
+          heap_calloc(1, sizeof(struct worker_ctx));
+
+      d_ctx->e = e;
+      d_ctx->orders_queues = e_orders_queues;
+
+      thrd = heap_calloc(1, sizeof(thrd_t));
+      thread_create(thrd, orders_dispatch, d_ctx);
+      Array_add_tail(workers, thrd);
+    }
+
+    struct worker_ctx *restrict const c_ctx =
+        heap_calloc(1, sizeof(struct worker_ctx));
+
+    c_ctx->e = e;
+    c_ctx->cancels = e_cancels;
+
+    thrd = heap_calloc(1, sizeof(thrd_t));
+    thread_create(thrd, orders_cancel, c_ctx);
+    Array_add_tail(workers, thrd);
+
+    for (size_t j = submit_workers; j-- > 0 && !terminated;) {
+      struct worker_ctx *restrict const s_ctx =
+          heap_calloc(1, sizeof(struct worker_ctx));
+
+      s_ctx->e = e;
+      s_ctx->submit_queue = e_submit_queue;
+      s_ctx->cancels = e_cancels;
+
+      thrd = heap_calloc(1, sizeof(thrd_t));
+      thread_create(thrd, orders_submit, s_ctx);
+      Array_add_tail(workers, thrd);
+    }
+
     size_t e_order_workers = order_workers;
     size_t e_trade_workers = trade_workers;
     size_t e_ticker_workers = ticker_workers;
 
     for (size_t j = 1; j < w_cnt && !terminated; j++) {
-      char cname[DATABASE_CONNECTION_NAME_MAX_LENGTH + 1] = {0};
       struct worker_ctx *restrict const w_ctx =
           heap_calloc(1, sizeof(struct worker_ctx));
 
       w_ctx->e = e;
       w_ctx->trades_queue = e_ctx->trades_queue;
-
-      const int r = snprintf(cname, sizeof(cname), "%s-worker-%.3zu",
-                             String_chars(e->nm), j);
-
-      if (r < 0 || (size_t)r >= sizeof(cname))
-        panic();
-
-      w_ctx->db = db_connect(cname);
+      w_ctx->submit_queue = e_submit_queue;
+      w_ctx->cancels = e_cancels;
 
       thrd = heap_calloc(1, sizeof(thrd_t));
       Array_add_tail(workers, thrd);
 
       if (e_order_workers > 0) {
-        thread_create(thrd, orders_process, w_ctx);
         e_order_workers--;
+
+        if (e_orders_queues != NULL)
+          w_ctx->orders_queue = Array_items(e_orders_queues)[e_order_workers];
+
+        thread_create(thrd, orders_process, w_ctx);
       } else if (e_trade_workers > 0) {
         thread_create(thrd, trades_process, w_ctx);
         e_trade_workers--;
@@ -3850,23 +6153,59 @@ int abagnale(int argc, char *argv[]) {
       thread_join(*((thrd_t *)items[i]), NULL);
   }
 
-  void *restrict const state_db = db_connect(String_chars(progname));
+  // Workers may have requested cancels after the cancel threads exited.
+  items = Array_items(order_cancels);
+  for (size_t i = Array_size(order_cancels); i-- > 0;)
+    orders_cancel_flush(items[i]);
+
+  void *restrict const state_db = db_pool_acquire(db_trading);
   struct MapIterator *restrict const it = MapIterator_new(market_trades);
   while (MapIterator_next(it)) {
     const struct Array *restrict const trades = MapIterator_value(it);
     items = Array_items(trades);
     for (size_t i = Array_size(trades); i-- > 0;)
-      trade_state_save(state_db, items[i]);
+      trade_state_save(items[i]);
   }
   MapIterator_delete(it);
-  db_disconnect(state_db);
+  state_flush(state_db);
+  db_pool_release(db_trading, state_db);
+  db_pool_delete(db_trading);
+  db_pool_delete(db_ingest);
+  db_pool_delete(db_analytic);
 
   Numeric_delete(ninety_percent_factor);
 
   Map_delete(market_samples, sample_array_delete);
   Map_delete(market_prices, Numeric_delete);
   Map_delete(market_trades, trade_array_delete);
+  Map_delete(market_stats, stats_delete);
+  Map_delete(market_stats_missing, String_delete);
+  Map_delete(market_stats_pending, String_delete);
+  Map_delete(market_graphs, market_graph_delete);
+  Map_delete(market_last_prices, Numeric_delete);
+  Map_delete(order_trades, NULL);
+  Map_delete(order_strays, order_strays_delete);
+  Map_delete(order_preloads, Order_delete);
+  Map_delete(market_ledgers, ledger_delete);
+  Map_delete(market_archives, Archive_delete);
+  Numeric_delete(samples_archive_gap);
+  Map_delete(plot_jobs, plot_job_delete);
+  mutex_destroy(&plot_mtx);
+  condition_destroy(&plot_cnd);
+  Map_delete(state_trades, NULL);
+  Map_delete(state_positions, NULL);
+  Array_delete(state_entries, state_entry_delete);
+  Map_delete(state_flushing_trades, NULL);
+  Map_delete(state_flushing_positions, NULL);
+  Wal_delete(state_wals[0]);
+  Wal_delete(state_wals[1]);
+  mutex_destroy(&state_mtx);
+  mutex_destroy(&state_flush_mtx);
+  condition_destroy(&state_flush_cnd);
   Array_delete(trade_queues, trade_queue_delete);
+  Array_delete(order_queues, order_queues_delete);
+  Array_delete(submit_queues, submit_queue_delete);
+  Array_delete(order_cancels, order_cancels_delete);
   Array_delete(workers, thrd_delete);
   tls_delete(abag_tls_key);
 
@@ -86,6 +86,7 @@ struct Position {
   enum position_type type;
   bool done;
   bool filled;
+  bool pending;
 };
 
 enum trade_status {
@@ -137,6 +138,8 @@ struct Algorithm {
                       const struct Exchange *restrict const,
                       const struct Market *restrict const,
                       const char *restrict const);
+  void (*market_purge)(const struct Exchange *restrict const,
+                       const struct Market *restrict const);
 };
 
 void abagnale_init(void);
@@ -148,6 +151,10 @@ void Candle_copy_to(const struct Candle *restrict const,
                     struct Candle *restrict const);
 void Candle_reset(struct Candle *restrict const);
 
+struct Trade *Trade_new(struct String *restrict const,
+                        struct String *restrict const);
+void Trade_delete(void *restrict const);
+
 const struct Algorithm *algorithm(const struct String *restrict const);
 const struct Exchange *exchange(const struct String *restrict const);
 const struct MarketConfig *marketconfig(struct String *restrict const,
@@ -43,9 +43,14 @@
 #define nitems(_a) (sizeof((_a)) / sizeof((_a)[0]))
 #endif
 
+extern _Atomic bool terminated;
+
 extern const struct String *restrict const progname;
 
 extern const struct Numeric *restrict const zero;
+extern const struct Numeric *restrict const one;
+extern const struct Numeric *restrict const hundred;
+extern const struct Numeric *restrict const second_nanos;
 
 extern const struct Algorithm *restrict const all_algorithms[];
 extern const size_t all_algorithms_nitems;
@@ -112,6 +117,7 @@ static int cmd_account(int, char *[]);
 static int cmd_order(int, char *[]);
 static int cmd_plot(int, char *[]);
 static int cmd_volatility(int, char *[]);
+static int cmd_backtest(int, char *[]);
 
 static const struct {
   const char *restrict name;
@@ -130,6 +136,9 @@ static const struct {
     {"account", "-e exchange [-h] -i id", cmd_account},
     {"accounts", "-e exchange [-h] [-t UNKNOWN|CRYPTO|FIAT|PERP_FUTURES|VAULT]",
      cmd_accounts},
+    {"backtest", "-e exchange [-h] -m market [-m market ...] -a algorithm [-f "
+     "fee-percent]",
+     cmd_backtest},
     {"algorithms", "", cmd_algorithms},
     {"exchanges", "", cmd_exchanges},
 };
@@ -897,6 +906,482 @@ ret:
   return r;
 }
 
+struct backtest_ctx {
+  const struct Exchange *restrict e;
+  const struct Algorithm *restrict a;
+  const struct MarketConfig *restrict m_cnf;
+  struct Market *restrict m;
+  struct Numeric *restrict fee_pc;
+  struct Numeric *restrict q_return;
+  struct Numeric *restrict nanos;
+  uintmax_t ticks;
+  uintmax_t trades;
+  uintmax_t wins;
+  uintmax_t losses;
+  uintmax_t cancels;
+  thrd_t thread;
+};
+
+static void backtest_volatility(struct Numeric *restrict const tp_pc,
+                                const void *restrict const db,
+                                const struct backtest_ctx *restrict const ctx) {
+  struct Numeric *restrict const v = Numeric_new();
+  void *const *restrict items;
+
+  if (ctx->m_cnf->v_pc != NULL) {
+    Numeric_copy_to(ctx->m_cnf->v_pc, tp_pc);
+    goto ret;
+  }
+
+  db_volatility_open(db, String_chars(ctx->e->id), String_chars(ctx->m->id),
+                     NULL);
+
+  if (ctx->m_cnf->v_wnanos == NULL) {
+    Numeric_copy_to(zero, tp_pc);
+
+    items = Array_items(volatility_windows);
+    for (size_t i = Array_size(volatility_windows); i-- > 0;) {
+      db_volatility(v, db, items[i]);
+
+      if (Numeric_cmp(v, tp_pc) > 0)
+        Numeric_copy_to(v, tp_pc);
+    }
+  } else
+    db_volatility(tp_pc, db, ctx->m_cnf->v_wnanos);
+
+  db_volatility_close(db);
+ret:
+  if (Numeric_cmp(tp_pc, ctx->fee_pc) < 0)
+    Numeric_copy_to(ctx->fee_pc, tp_pc);
+
+  Numeric_delete(v);
+}
+
+static void backtest_settle(struct backtest_ctx *restrict const ctx,
+                            const struct Trade *restrict const t,
+                            const struct Position *restrict const p,
+                            const struct Numeric *restrict const entry,
+                            const struct Numeric *restrict const exit) {
+  struct Numeric *restrict const rt_pf = Numeric_mul(t->fee_pf, t->fee_pf);
+  struct Numeric *restrict const r0 = Numeric_new();
+  struct Numeric *restrict const r1 = Numeric_new();
+
+  // long: exit / (entry * fee²), short: entry / (exit * fee²)
+  switch (p->type) {
+  case POSITION_TYPE_LONG:
+    Numeric_mul_to(entry, rt_pf, r0);
+    Numeric_div_to(exit, r0, r1);
+    break;
+  case POSITION_TYPE_SHORT:
+    Numeric_mul_to(exit, rt_pf, r0);
+    Numeric_div_to(entry, r0, r1);
+    break;
+  default:
+    panic();
+  }
+
+  Numeric_mul_to(ctx->q_return, r1, r0);
+  Numeric_copy_to(r0, ctx->q_return);
+
+  ctx->trades++;
+  if (Numeric_cmp(r1, one) > 0)
+    ctx->wins++;
+  else
+    ctx->losses++;
+
+  Numeric_delete(rt_pf);
+  Numeric_delete(r0);
+  Numeric_delete(r1);
+}
+
+static int backtest_run(void *arg) {
+  struct backtest_ctx *restrict const ctx = arg;
+  const struct MarketConfig *restrict const m_cnf = ctx->m_cnf;
+  char db_nm[BUFSIZ] = {0};
+  char s_db_nm[BUFSIZ] = {0};
+  struct db_sample_rec rec = {0};
+  struct Position *restrict p = NULL;
+  bool filled = false;
+  void *const *restrict items;
+
+  int r = snprintf(db_nm, sizeof(db_nm), "%s-%s", String_chars(progname),
+                   String_chars(ctx->m->nm));
+
+  if (r < 0 || (size_t)r >= sizeof(db_nm))
+    panic();
+
+  r = snprintf(s_db_nm, sizeof(s_db_nm), "%s-%s-samples",
+               String_chars(progname), String_chars(ctx->m->nm));
+
+  if (r < 0 || (size_t)r >= sizeof(s_db_nm))
+    panic();
+
+  // The samples are read on a connection of their own. The algorithm gets no
+  // connection at all, so that it keeps its state in memory and neither
+  // writes to the database nor plots.
+  void *restrict const db = db_connect(db_nm);
+  void *restrict const s_db = db_connect(s_db_nm);
+  struct Array *restrict const samples = Array_new(524288);
+  struct Trade *restrict const sig = Trade_new(ctx->e->id, ctx->m->id);
+  struct Trade *restrict const t = Trade_new(ctx->e->id, ctx->m->id);
+  struct Numeric *restrict const pr_last = Numeric_copy(zero);
+  struct Numeric *restrict const o_nanos = Numeric_new();
+  struct Numeric *restrict const o_price = Numeric_new();
+  struct Numeric *restrict const tp_price = Numeric_new();
+  struct Numeric *restrict const tp_f = Numeric_new();
+  struct Numeric *restrict const start = Numeric_new();
+  struct Numeric *restrict const r0 = Numeric_new();
+  struct Numeric *restrict const r1 = Numeric_new();
+
+  rec.nanos = Numeric_new();
+  rec.price = Numeric_new();
+
+  // Trades of a backtest are never stored, but messages name them.
+  sig->id = String_cnew("backtest");
+  t->id = String_cnew("backtest");
+  sig->a = t->a = ctx->a;
+  Numeric_copy_to(ctx->fee_pc, t->fee_pc);
+  Numeric_div_to(t->fee_pc, hundred, r0);
+  Numeric_add_to(r0, one, t->fee_pf);
+
+  backtest_volatility(t->tp_pc, db, ctx);
+  Numeric_div_to(t->tp_pc, hundred, r0);
+  Numeric_add_to(r0, one, t->tp_pf);
+
+  Numeric_copy_to(t->fee_pc, sig->fee_pc);
+  Numeric_copy_to(t->fee_pf, sig->fee_pf);
+  Numeric_copy_to(t->tp_pc, sig->tp_pc);
+  Numeric_copy_to(t->tp_pf, sig->tp_pf);
+
+  // Take profit factor covering the fees of both legs.
+  Numeric_mul_to(t->fee_pf, t->fee_pf, r0);
+  Numeric_mul_to(r0, t->tp_pf, tp_f);
+
+  nanos_now(start);
+
+  db_samples_open(s_db, String_chars(ctx->e->id), String_chars(ctx->m->id),
+                  zero);
+
+  while (!terminated && db_samples_next(&rec, s_db)) {
+    struct Sample *restrict const s = Sample_new();
+    s->m_id = String_copy(ctx->m->id);
+    s->nanos = Numeric_copy(rec.nanos);
+    s->price = Numeric_copy(rec.price);
+    Array_add_tail(samples, s);
+    ctx->ticks++;
+
+    if (Array_size(samples) < 2)
+      continue;
+
+    Numeric_sub_to(s->nanos, ((struct Sample *)Array_head(samples))->nanos,
+                   r0);
+    const bool ready = Numeric_cmp(r0, m_cnf->wnanos) >= 0;
+
+    Numeric_sub_to(s->nanos, m_cnf->wnanos, r0);
+
+    items = Array_items(samples);
+    const size_t s_items = Array_size(samples);
+    for (size_t i = 0; i < s_items; i++)
+      if (Numeric_cmp(((struct Sample *)items[i])->nanos, r0) > 0) {
+        Array_cut(samples, i, Array_size(samples) - i, Sample_delete);
+        break;
+      }
+
+    if (!ready || Array_size(samples) < 2)
+      continue;
+
+    // The algorithm needs to see every price change to keep its state.
+    struct Position *restrict sig_p = NULL;
+    if (Numeric_cmp(pr_last, s->price)) {
+      Numeric_copy_to(s->price, pr_last);
+      sig_p = ctx->a->position_open(NULL, ctx->e, ctx->m, sig, samples, s);
+    }
+
+    if (p == NULL) {
+      if (sig_p == NULL)
+        continue;
+
+      p = sig_p->type == POSITION_TYPE_LONG ? &t->p_long : &t->p_short;
+      Numeric_copy_to(sig_p->price, o_price);
+      Numeric_copy_to(s->nanos, o_nanos);
+      filled = false;
+      continue;
+    }
+
+    if (!filled) {
+      const int c = Numeric_cmp(s->price, o_price);
+
+      if ((p->type == POSITION_TYPE_LONG && c <= 0) ||
+          (p->type == POSITION_TYPE_SHORT && c >= 0)) {
+        filled = true;
+        p->tl_trg.set = false;
+
+        if (p->type == POSITION_TYPE_LONG)
+          Numeric_mul_to(o_price, tp_f, tp_price);
+        else
+          Numeric_div_to(o_price, tp_f, tp_price);
+
+        Numeric_scale(tp_price, ctx->m->p_sc);
+        continue;
+      }
+
+      if (m_cnf->bo_maxnanos != NULL) {
+        Numeric_sub_to(s->nanos, o_nanos, r1);
+
+        if (Numeric_cmp(r1, m_cnf->bo_maxnanos) > 0) {
+          ctx->cancels++;
+          p = NULL;
+        }
+      }
+      continue;
+    }
+
+    const int c = Numeric_cmp(s->price, tp_price);
+
+    if ((p->type == POSITION_TYPE_LONG && c >= 0) ||
+        (p->type == POSITION_TYPE_SHORT && c <= 0)) {
+      backtest_settle(ctx, t, p, o_price, tp_price);
+      p = NULL;
+      continue;
+    }
+
+    if (!ctx->a->position_close(NULL, ctx->e, ctx->m, t, p)) {
+      p->tl_trg.set = false;
+      continue;
+    }
+
+    if (m_cnf->tl_dlnanos != NULL) {
+      if (!p->tl_trg.set) {
+        p->tl_trg.set = true;
+        Numeric_copy_to(s->nanos, p->tl_trg.nanos);
+        continue;
+      }
+
+      Numeric_sub_to(s->nanos, p->tl_trg.nanos, r1);
+
+      if (Numeric_cmp(r1, m_cnf->tl_dlnanos) < 0)
+        continue;
+    }
+
+    backtest_settle(ctx, t, p, o_price, s->price);
+    p = NULL;
+  }
+
+  db_samples_close(s_db);
+
+  // Mark a position still open at the end of the data to the last price.
+  if (p != NULL && filled && Array_size(samples) > 0)
+    backtest_settle(ctx, t, p, o_price,
+                    ((struct Sample *)Array_tail(samples))->price);
+
+  nanos_now(r0);
+  Numeric_sub_to(r0, start, ctx->nanos);
+
+  if (ctx->a->market_purge != NULL)
+    ctx->a->market_purge(ctx->e, ctx->m);
+
+  db_disconnect(s_db);
+  db_disconnect(db);
+
+  Array_delete(samples, Sample_delete);
+  Trade_delete(sig);
+  Trade_delete(t);
+  Numeric_delete(rec.nanos);
+  Numeric_delete(rec.price);
+  Numeric_delete(pr_last);
+  Numeric_delete(o_nanos);
+  Numeric_delete(o_price);
+  Numeric_delete(tp_price);
+  Numeric_delete(tp_f);
+  Numeric_delete(start);
+  Numeric_delete(r0);
+  Numeric_delete(r1);
+  return EXIT_SUCCESS;
+}
+
+static void backtest_report(const struct backtest_ctx *restrict const ctx) {
+  struct Numeric *restrict const r0 = Numeric_sub(ctx->q_return, one);
+  struct Numeric *restrict const ret = Numeric_mul(r0, hundred);
+  struct Numeric *restrict const ticks = Numeric_from_long(ctx->ticks);
+  struct Numeric *restrict const rate = Numeric_new();
+
+  Numeric_copy_to(zero, rate);
+  if (Numeric_cmp(ctx->nanos, zero) > 0) {
+    Numeric_mul_to(ticks, second_nanos, r0);
+    Numeric_div_to(r0, ctx->nanos, rate);
+  }
+
+  char *restrict const ret_info = Numeric_to_char(ret, 4);
+  char *restrict const rate_info = Numeric_to_char(rate, 0);
+  char *restrict const d_info = nanos_string(ctx->nanos);
+
+  printf("%s\t%" PRIuMAX "\t%" PRIuMAX "\t%" PRIuMAX "\t%" PRIuMAX
+         "\t%" PRIuMAX "\t%s\t%s\t%s\n",
+         String_chars(ctx->m->nm), ctx->ticks, ctx->trades, ctx->wins,
+         ctx->losses, ctx->cancels, ret_info, d_info, rate_info);
+
+  Numeric_char_free(ret_info);
+  Numeric_char_free(rate_info);
+  heap_free(d_info);
+  Numeric_delete(r0);
+  Numeric_delete(ret);
+  Numeric_delete(ticks);
+  Numeric_delete(rate);
+}
+
+static int cmd_backtest(int argc, char *argv[]) {
+  int ch, r = EXIT_FAILURE;
+  struct String *restrict e_nm = NULL;
+  struct String *restrict a_nm = NULL;
+  struct Numeric *restrict fee_pc = NULL;
+  struct Array *restrict const m_nms = Array_new(16);
+  struct Array *restrict const ctxs = Array_new(16);
+  bool header = false;
+  struct optparse options = {0};
+  void *const *restrict items;
+
+  optparse_init(&options, argv);
+
+  while ((ch = optparse(&options, "e:hm:a:f:")) != -1) {
+    switch (ch) {
+    case 'e':
+      e_nm = String_cnew(options.optarg);
+      break;
+    case 'h':
+      header = true;
+      break;
+    case 'm':
+      Array_add_tail(m_nms, String_cnew(options.optarg));
+      break;
+    case 'a':
+      a_nm = String_cnew(options.optarg);
+      break;
+    case 'f':
+      fee_pc = Numeric_from_char(options.optarg);
+      if (fee_pc == NULL)
+        usage();
+      break;
+    default:
+      usage();
+    }
+  }
+  argc -= options.optind;
+
+  if (argc > 0 || e_nm == NULL || Array_size(m_nms) == 0 || a_nm == NULL)
+    usage();
+
+  const struct Exchange *restrict const e = exchange(e_nm);
+
+  if (e == NULL) {
+    werr("%s: Exchange: Not found: %s\n", String_chars(progname),
+         String_chars(e_nm));
+    goto ret;
+  }
+
+  const struct Algorithm *restrict const a = algorithm(a_nm);
+
+  if (a == NULL) {
+    werr("%s: Algorithm: Not found: %s\n", String_chars(progname),
+         String_chars(a_nm));
+    goto ret;
+  }
+
+  struct Array *restrict const markets = e->markets();
+
+  items = Array_items(m_nms);
+  for (size_t i = 0; i < Array_size(m_nms); i++) {
+    void *const *restrict const m_items = Array_items(markets);
+    struct Market *restrict m = NULL;
+
+    for (size_t j = Array_size(markets); j-- > 0;) {
+      struct Market *restrict const needle = m_items[j];
+      if (String_equals(needle->nm, items[i])) {
+        m = needle;
+        break;
+      }
+    }
+
+    if (m == NULL) {
+      werr("%s: %s: Market: Not found: %s\n", String_chars(progname),
+           String_chars(e_nm), String_chars(items[i]));
+      Array_unlock(markets);
+      goto cleanup;
+    }
+
+    const struct MarketConfig *restrict const m_cnf =
+        marketconfig(e->nm, m->nm);
+
+    if (m_cnf == NULL || m_cnf->wnanos == NULL) {
+      werr("%s: %s: %s: Market: Not configured\n", String_chars(progname),
+           String_chars(e_nm), String_chars(m->nm));
+      Array_unlock(markets);
+      goto cleanup;
+    }
+
+    struct backtest_ctx *restrict const ctx =
+        heap_calloc(1, sizeof(struct backtest_ctx));
+
+    ctx->e = e;
+    ctx->a = a;
+    ctx->m_cnf = m_cnf;
+    ctx->m = Market_copy(m);
+    ctx->q_return = Numeric_copy(one);
+    ctx->nanos = Numeric_copy(zero);
+    Array_add_tail(ctxs, ctx);
+  }
+
+  Array_unlock(markets);
+
+  items = Array_items(ctxs);
+  for (size_t i = 0; i < Array_size(ctxs); i++) {
+    struct backtest_ctx *restrict const ctx = items[i];
+
+    if (fee_pc != NULL)
+      ctx->fee_pc = Numeric_copy(fee_pc);
+    else {
+      const struct Pricing *restrict const pricing = e->pricing(ctx->m);
+      ctx->fee_pc = Numeric_copy(pricing->ef_pc);
+      mutex_unlock(pricing->mtx);
+    }
+  }
+
+  for (size_t i = 0; i < Array_size(ctxs); i++) {
+    struct backtest_ctx *restrict const ctx = items[i];
+    thread_create(&ctx->thread, backtest_run, ctx);
+  }
+
+  for (size_t i = 0; i < Array_size(ctxs); i++) {
+    struct backtest_ctx *restrict const ctx = items[i];
+    thread_join(ctx->thread, NULL);
+  }
+
+  if (header)
+    printf("MARKET\tTICKS\tTRADES\tWINS\tLOSSES\tCANCELS\tRETURN\tDURATION\t"
+           "TICKS_PER_SECOND\n");
+
+  for (size_t i = 0; i < Array_size(ctxs); i++)
+    backtest_report(items[i]);
+
+  r = terminated ? EXIT_FAILURE : EXIT_SUCCESS;
+cleanup:
+  items = Array_items(ctxs);
+  for (size_t i = Array_size(ctxs); i-- > 0;) {
+    struct backtest_ctx *restrict const ctx = items[i];
+    Market_delete(ctx->m);
+    Numeric_delete(ctx->fee_pc);
+    Numeric_delete(ctx->q_return);
+    Numeric_delete(ctx->nanos);
+    heap_free(ctx);
+  }
+ret:
+  Array_delete(ctxs, NULL);
+  Array_delete(m_nms, String_delete);
+  String_delete(e_nm);
+  String_delete(a_nm);
+  Numeric_delete(fee_pc);
+  return r;
+}
+
 int abagnalectl(int argc, char *argv[]) {
   int (*cmd)(int, char *[]) = NULL;
 
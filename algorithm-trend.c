@@ -30,14 +30,22 @@
 #include "time.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifndef DEFAULT_ABAG_PLOT_BINARY_SAMPLES
+#define DEFAULT_ABAG_PLOT_BINARY_SAMPLES 0
+#endif
+
 #ifndef nitems
 #define nitems(a) (sizeof((a)) / sizeof((a)[0]))
 #endif
 
 #define TREND_UUID "bfd87009-ea0f-4664-a03a-f9b6e91274dd"
+#define TREND_PLOT_BUFFER_SIZE (size_t)1048576
+#define TREND_PLOT_NUMBER_MAX_LENGTH (size_t)128
 
 struct trend_state {
   mtx_t mtx;
@@ -209,6 +217,8 @@ static bool trend_market_plot(const void *restrict const,
                               const struct Exchange *restrict const,
                               const struct Market *restrict const,
                               const char *restrict const);
+static void trend_market_purge(const struct Exchange *restrict const,
+                               const struct Market *restrict const);
 
 struct Algorithm algorithm_trend = {
     .nm = NULL,
@@ -217,6 +227,7 @@ struct Algorithm algorithm_trend = {
     .position_open = trend_position_open,
     .position_close = trend_position_close,
     .market_plot = trend_market_plot,
+    .market_purge = trend_market_purge,
 };
 
 static enum candle_trend candle_trend_db(const char *const db) {
@@ -237,7 +248,12 @@ static void db_candle_trend(char *restrict const db_trend,
   panic();
 }
 
+static bool plot_binary_samples;
+
 static void trend_init(void) {
+  plot_binary_samples =
+      envul("ABAG_PLOT_BINARY_SAMPLES", DEFAULT_ABAG_PLOT_BINARY_SAMPLES) != 0;
+
   algorithm_trend.id = String_cnew(TREND_UUID);
   algorithm_trend.nm = String_cnew("trend");
   tls_create(&trend_tls_key, trend_tls_dtor);
@@ -251,6 +267,10 @@ static void trend_destroy(void) {
   Map_delete(states, trend_state_delete);
 }
 
+/*
+ * Without a database connection, as when backtesting, the state is kept in
+ * memory only and nothing is plotted.
+ */
 static struct trend_state *trend_state(const void *restrict const db,
                                        struct String *restrict const e_id,
                                        struct String *restrict const m_id) {
@@ -263,12 +283,19 @@ static struct trend_state *trend_state(const void *restrict const db,
   st = Map_get(states, m_id);
 
   if (st == NULL) {
-    db_trend_state(db_st, db, String_chars(e_id), String_chars(m_id));
-
     st = heap_malloc(sizeof(struct trend_state));
-    st->cd_lnanos = Numeric_copy(db_st->cd_lnanos);
-    st->cd_langle = Numeric_copy(db_st->cd_langle);
-    st->cd_ltrend = candle_trend_db(db_st->cd_ltrend);
+
+    if (db != NULL) {
+      db_trend_state(db_st, db, String_chars(e_id), String_chars(m_id));
+      st->cd_lnanos = Numeric_copy(db_st->cd_lnanos);
+      st->cd_langle = Numeric_copy(db_st->cd_langle);
+      st->cd_ltrend = candle_trend_db(db_st->cd_ltrend);
+    } else {
+      st->cd_lnanos = Numeric_copy(zero);
+      st->cd_langle = Numeric_copy(zero);
+      st->cd_ltrend = CANDLE_NONE;
+    }
+
     mutex_init(&st->mtx);
     Map_put(states, m_id, st);
   }
@@ -436,7 +463,7 @@ static struct Position *trend_position_open(
   Numeric_copy_to(r1, st->cd_langle);
   Numeric_copy_to(st->cd_langle, cd_first->a);
 
-  if (cnf->plts_dir) {
+  if (db != NULL && cnf->plts_dir) {
     Numeric_copy_to(((struct Sample *)Array_head(samples))->nanos,
                     db_plot->snanos);
     Numeric_copy_to(cd_first->cnanos, db_plot->enanos);
@@ -504,10 +531,13 @@ static struct Position *trend_position_open(
   st->cd_ltrend = t->open_cd.t;
   Numeric_copy_to(sample->nanos, st->cd_lnanos);
 
-  Numeric_copy_to(st->cd_lnanos, db_st->cd_lnanos);
-  Numeric_copy_to(st->cd_langle, db_st->cd_langle);
-  db_candle_trend(db_st->cd_ltrend, st->cd_ltrend);
-  db_trend_state_update(db, String_chars(e->id), String_chars(m->id), db_st);
+  if (db != NULL) {
+    Numeric_copy_to(st->cd_lnanos, db_st->cd_lnanos);
+    Numeric_copy_to(st->cd_langle, db_st->cd_langle);
+    db_candle_trend(db_st->cd_ltrend, st->cd_ltrend);
+    db_trend_state_update(db, String_chars(e->id), String_chars(m->id),
+                          db_st);
+  }
 
   mutex_unlock(&st->mtx);
   return p;
@@ -541,6 +571,110 @@ static bool trend_position_close(const void *restrict const db,
   return close;
 }
 
+static void trend_market_purge(const struct Exchange *restrict const e,
+                               const struct Market *restrict const m) {
+  (void)e;
+  Map_lock(states);
+  trend_state_delete(Map_remove(states, m->id));
+  Map_unlock(states);
+}
+
+static void trend_plot_number(char *restrict const buf,
+                              const struct Numeric *restrict const n,
+                              const int sc) {
+  if (Numeric_to_buf(n, sc, buf, TREND_PLOT_NUMBER_MAX_LENGTH) == 0)
+    memcpy(buf, "NaN", sizeof("NaN"));
+}
+
+static FILE *trend_plot_open(const struct Exchange *restrict const e,
+                             const struct Market *restrict const m,
+                             const char *restrict const fn) {
+  FILE *restrict const f = fopen(fn, "w");
+
+  if (f == NULL) {
+    werr("%s: %s: %s: %s\n", String_chars(e->nm), String_chars(m->nm), fn,
+         strerror(errno));
+    return NULL;
+  }
+
+  if (setvbuf(f, NULL, _IOFBF, TREND_PLOT_BUFFER_SIZE) != 0)
+    werr("%s: %s: %s: Unbuffered\n", String_chars(e->nm), String_chars(m->nm),
+         fn);
+
+  return f;
+}
+
+static bool trend_plot_close(FILE *restrict const f,
+                             const struct Exchange *restrict const e,
+                             const struct Market *restrict const m,
+                             const char *restrict const fn) {
+  if (fclose(f) == EOF) {
+    werr("%s: %s: %s: %s\n", String_chars(e->nm), String_chars(m->nm), fn,
+         strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Writes the samples as records of the nanos as int64 followed by the price as
+ * double in host byte order to a file next to the script, which reads them
+ * back with fread.
+ */
+static bool trend_plot_samples_binary(FILE *restrict const f,
+                                      const void *restrict const db,
+                                      const struct Exchange *restrict const e,
+                                      const struct Market *restrict const m,
+                                      const char *restrict const fn) {
+  const struct trend_tls *restrict const tls = trend_tls();
+  struct db_datapoint_rec *restrict const db_pt = tls->trend_market_plot.db_pt;
+  char bin_fn[BUFSIZ] = {0};
+  bool written = true;
+  size_t len = strlen(fn);
+
+  if (len > 2 && !strcmp(fn + len - 2, ".m"))
+    len -= 2;
+
+  const int r = snprintf(bin_fn, sizeof(bin_fn), "%.*s.samples", (int)len, fn);
+
+  if (r < 0 || (size_t)r >= sizeof(bin_fn))
+    panic();
+
+  FILE *restrict const bin = trend_plot_open(e, m, bin_fn);
+
+  if (bin == NULL)
+    return false;
+
+  db_tx_trend_plot_samples_open(db, String_chars(e->id), String_chars(m->id));
+  while (written && !terminated &&
+         db_tx_trend_plot_samples_next(db_pt, db)) {
+    const int64_t x = Numeric_to_int64(db_pt->x);
+    const double y = Numeric_to_double_approx(db_pt->y);
+
+    written = fwrite(&x, sizeof(x), 1, bin) == 1 &&
+              fwrite(&y, sizeof(y), 1, bin) == 1;
+  }
+  db_tx_trend_plot_samples_close(db);
+
+  // The script must not read back a truncated file.
+  if (!written || fflush(bin) == EOF || ferror(bin)) {
+    werr("%s: %s: %s: %s\n", String_chars(e->nm), String_chars(m->nm), bin_fn,
+         strerror(errno));
+    fclose(bin);
+    return false;
+  }
+
+  fprintf(f, "fid = fopen([mfilename(\"fullpath\") \".samples\"], \"r\");\n"
+             "x = fread(fid, Inf, \"int64\", 8);\n"
+             "fseek(fid, 8, SEEK_SET);\n"
+             "y = fread(fid, Inf, \"double\", 8);\n"
+             "fclose(fid);\n"
+             "samples = [x, y];\n");
+
+  return trend_plot_close(bin, e, m, bin_fn);
+}
+
 static bool trend_market_plot(const void *restrict const db,
                               const struct Exchange *restrict const e,
                               const struct Market *restrict const m,
@@ -549,63 +683,54 @@ static bool trend_market_plot(const void *restrict const db,
   struct db_datapoint_rec *restrict const db_pt = tls->trend_market_plot.db_pt;
   struct db_marker_rec *restrict const db_mk = tls->trend_market_plot.db_mk;
   struct db_candle_rec *restrict const db_cd = tls->trend_market_plot.db_cd;
+  char x[TREND_PLOT_NUMBER_MAX_LENGTH], y[TREND_PLOT_NUMBER_MAX_LENGTH];
+  char x1[TREND_PLOT_NUMBER_MAX_LENGTH], y1[TREND_PLOT_NUMBER_MAX_LENGTH];
   size_t cd_red_cnt = 0, cd_green_cnt = 0, up_cnt = 0, down_cnt = 0,
          left_cnt = 0, right_cnt = 0;
+  bool ret = true;
 
-  FILE *restrict const f = fopen(fn, "w");
+  FILE *restrict const f = trend_plot_open(e, m, fn);
 
-  if (f == NULL) {
-    werr("%s: %s: %s: %s\n", String_chars(e->nm), String_chars(m->nm), fn,
-         strerror(errno));
+  if (f == NULL)
     return false;
-  }
 
   db_tx_begin(db);
 
-  fprintf(f, "samples = [\n");
-  db_tx_trend_plot_samples_open(db, String_chars(e->id), String_chars(m->id));
-  while (!terminated && db_tx_trend_plot_samples_next(db_pt, db)) {
-    char *restrict const x = Numeric_to_char(db_pt->x, 0);
-    char *restrict const y = Numeric_to_char(db_pt->y, m->p_sc);
-    fprintf(f, "\t%s, %s;\n", x, y);
-    Numeric_char_free(x);
-    Numeric_char_free(y);
+  if (plot_binary_samples)
+    ret = trend_plot_samples_binary(f, db, e, m, fn);
+  else {
+    fprintf(f, "samples = [\n");
+    db_tx_trend_plot_samples_open(db, String_chars(e->id),
+                                  String_chars(m->id));
+    while (!terminated && db_tx_trend_plot_samples_next(db_pt, db)) {
+      trend_plot_number(x, db_pt->x, 0);
+      trend_plot_number(y, db_pt->y, m->p_sc);
+      fprintf(f, "\t%s, %s;\n", x, y);
+    }
+    db_tx_trend_plot_samples_close(db);
+    fprintf(f, "];\n");
   }
-  db_tx_trend_plot_samples_close(db);
-  fprintf(f, "];\n");
 
   db_tx_trend_plot_candles_open(db, String_chars(e->id), String_chars(m->id));
   while (!terminated && db_tx_trend_plot_candles_next(db_cd, db)) {
-    char *restrict const onanos = Numeric_to_char(db_cd->onanos, 0);
-    char *restrict const o = Numeric_to_char(db_cd->o, m->p_sc);
-    char *restrict const hnanos = Numeric_to_char(db_cd->hnanos, 0);
-    char *restrict const h = Numeric_to_char(db_cd->h, m->p_sc);
-    char *restrict const lnanos = Numeric_to_char(db_cd->lnanos, 0);
-    char *restrict const l = Numeric_to_char(db_cd->l, m->p_sc);
-    char *restrict const cnanos = Numeric_to_char(db_cd->cnanos, 0);
-    char *restrict const c = Numeric_to_char(db_cd->c, m->p_sc);
     const bool red = Numeric_cmp(db_cd->o, db_cd->c) > 0;
 
+    trend_plot_number(x, db_cd->onanos, 0);
+    trend_plot_number(y, db_cd->o, m->p_sc);
+    trend_plot_number(x1, db_cd->cnanos, 0);
+    trend_plot_number(y1, db_cd->c, m->p_sc);
+
     fprintf(f, "%scandle%zu = [\n", red ? "red_" : "green_",
             red ? cd_red_cnt++ : cd_green_cnt++);
 
-    fprintf(f, "\t%s, %s;\n\t%s, %s;\n];\n", onanos, o, cnanos, c);
-
-    Numeric_char_free(o);
-    Numeric_char_free(h);
-    Numeric_char_free(l);
-    Numeric_char_free(c);
-    Numeric_char_free(onanos);
-    Numeric_char_free(hnanos);
-    Numeric_char_free(lnanos);
-    Numeric_char_free(cnanos);
+    fprintf(f, "\t%s, %s;\n\t%s, %s;\n];\n", x, y, x1, y1);
   }
   db_tx_trend_plot_candles_close(db);
 
   db_tx_trend_plot_markers_open(db, String_chars(e->id), String_chars(m->id));
   while (!terminated && db_tx_trend_plot_markers_next(db_mk, db)) {
-    char *restrict const x = Numeric_to_char(db_mk->dp.x, 0);
-    char *restrict const y = Numeric_to_char(db_mk->dp.y, m->p_sc);
+    trend_plot_number(x, db_mk->dp.x, 0);
+    trend_plot_number(y, db_mk->dp.y, m->p_sc);
 
     if (!strcmp("UP", db_mk->type))
       fprintf(f, "candle%zu_high = [\t%s, %s;\t];\n", up_cnt++, x, y);
@@ -617,9 +742,6 @@ static bool trend_market_plot(const void *restrict const db,
       fprintf(f, "window%zu_open = [\t%s, %s;\t];\n", right_cnt++, x, y);
     else
       panic();
-
-    Numeric_char_free(x);
-    Numeric_char_free(y);
   }
   db_tx_trend_plot_markers_close(db);
 
@@ -653,11 +775,5 @@ static bool trend_market_plot(const void *restrict const db,
           "\"none\")\nylabel(\"Price (%s)\", \"interpreter\", \"none\")\n",
           String_chars(m->nm), String_chars(m->q_id));
 
-  if (fclose(f) == EOF) {
-    werr("%s: %s: %s: %s\n", String_chars(e->nm), String_chars(m->nm), fn,
-         strerror(errno));
-    return false;
-  }
-
-  return true;
+  return trend_plot_close(f, e, m, fn) && ret;
 }
@@ -0,0 +1,520 @@
+/* $JDTAUS$ */
+
+/*
+ * Copyright (c) 2026 Christian Schulte <cs@schulte.it>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Append-only sample archive of a single market. The file is a sequence of
+ * blocks of up to ARCHIVE_BLOCK_SAMPLES samples. A block header holds the
+ * first sample, the time range covered, the decimal scale of the prices and a
+ * checksum of the payload. The payload holds the remaining samples as zigzag
+ * varint deltas of the nanos and of the prices scaled to integers, all in
+ * host byte order. Readers map the file and skip blocks by their headers
+ * without decoding them. A block torn by a crash fails its checksum and ends
+ * the archive.
+ */
+
+#if !defined(_MSC_VER)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifdef HAVE_HOST_H
+#include "host.h"
+#endif
+
+#include "archive.h"
+#include "heap.h"
+#include "proc.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(_MSC_VER)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define ARCHIVE_MAGIC UINT64_C(0x31304b4c42474241)
+#define ARCHIVE_BLOCK_SAMPLES (uint32_t)1024
+#define ARCHIVE_VARINT_MAX_LENGTH (size_t)10
+#define ARCHIVE_SCALE_MAX 18
+
+struct archive_blk {
+  uint64_t magic;
+  uint64_t sum;
+  int64_t f_nanos;
+  int64_t l_nanos;
+  int64_t f_price;
+  uint32_t cnt;
+  uint32_t len;
+  int32_t scale;
+  uint32_t reserved;
+};
+
+struct Archive {
+  char *restrict path;
+  unsigned char *restrict buf;
+  int64_t l_nanos;
+  int64_t l_price;
+  int32_t scale;
+  int fd;
+  mtx_t mtx;
+};
+
+#define ARCHIVE_PAYLOAD_MAX_LENGTH                                             \
+  ((size_t)(ARCHIVE_BLOCK_SAMPLES - 1) * 2 * ARCHIVE_VARINT_MAX_LENGTH)
+
+static inline size_t archive_padded(const size_t len) {
+  return (len + 7) & ~(size_t)7;
+}
+
+static uint64_t archive_sum(const unsigned char *restrict const data,
+                            const size_t len) {
+  uint64_t h = UINT64_C(14695981039346656037);
+
+  for (size_t i = 0; i < len; i++) {
+    h ^= data[i];
+    h *= UINT64_C(1099511628211);
+  }
+
+  return h ^ (uint64_t)len;
+}
+
+static inline int64_t archive_delta(const int64_t a, const int64_t b) {
+  return (int64_t)((uint64_t)a - (uint64_t)b);
+}
+
+static inline int64_t archive_undelta(const int64_t a, const int64_t d) {
+  return (int64_t)((uint64_t)a + (uint64_t)d);
+}
+
+static size_t archive_varint_put(unsigned char *restrict const p,
+                                 const int64_t v) {
+  uint64_t z = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+  size_t n = 0;
+
+  while (z >= 0x80) {
+    p[n++] = (unsigned char)(z | 0x80);
+    z >>= 7;
+  }
+
+  p[n++] = (unsigned char)z;
+  return n;
+}
+
+static bool archive_varint_get(int64_t *restrict const v,
+                               const unsigned char *restrict const p,
+                               const size_t len, size_t *restrict const off) {
+  uint64_t z = 0;
+
+  for (unsigned s = 0; *off < len && s < 64; s += 7) {
+    const unsigned char b = p[(*off)++];
+    z |= (uint64_t)(b & 0x7f) << s;
+
+    if ((b & 0x80) == 0) {
+      *v = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*
+ * Splits the decimal representation of a price into an integer and the
+ * number of digits after the decimal point, dropping trailing zeros.
+ */
+static bool archive_price_split(int64_t *restrict const m,
+                                int32_t *restrict const scale,
+                                const struct Numeric *restrict const price) {
+  char *restrict const s = Numeric_to_char(price, -1);
+  const char *restrict p = s;
+  bool neg = false, frac = false, ret = false;
+  int32_t sc = 0;
+  int64_t v = 0;
+
+  if (*p == '-') {
+    neg = true;
+    p++;
+  }
+
+  for (; *p != '\0'; p++) {
+    if (*p == '.' && !frac) {
+      frac = true;
+      continue;
+    }
+
+    if (*p < '0' || *p > '9' || v > (INT64_MAX - (*p - '0')) / 10)
+      goto ret;
+
+    v = v * 10 + (*p - '0');
+
+    if (frac)
+      sc++;
+  }
+
+  for (; sc > 0 && v % 10 == 0; sc--)
+    v /= 10;
+
+  if (sc > ARCHIVE_SCALE_MAX)
+    goto ret;
+
+  *m = neg ? -v : v;
+  *scale = sc;
+  ret = true;
+ret:
+  Numeric_char_free(s);
+  return ret;
+}
+
+static bool archive_price_rescale(int64_t *restrict const m, int32_t from,
+                                  const int32_t to) {
+  for (; from < to; from++) {
+    if (*m > INT64_MAX / 10 || *m < INT64_MIN / 10)
+      return false;
+
+    *m *= 10;
+  }
+
+  return true;
+}
+
+static struct Numeric *archive_price(const int64_t m, const int32_t scale) {
+  char d[32] = {0};
+  char s[ARCHIVE_SCALE_MAX + 40] = {0};
+  const bool neg = m < 0;
+  const uint64_t u = neg ? -(uint64_t)m : (uint64_t)m;
+  const int r = snprintf(d, sizeof(d), "%" PRIu64, u);
+
+  if (r < 0 || (size_t)r >= sizeof(d))
+    panic();
+
+  const size_t len = (size_t)r;
+  const size_t sc = (size_t)scale;
+  size_t n = 0;
+
+  if (neg)
+    s[n++] = '-';
+
+  if (len <= sc) {
+    s[n++] = '0';
+    s[n++] = '.';
+    for (size_t i = len; i < sc; i++)
+      s[n++] = '0';
+    memcpy(s + n, d, len);
+  } else {
+    memcpy(s + n, d, len - sc);
+    n += len - sc;
+    if (sc > 0) {
+      s[n++] = '.';
+      memcpy(s + n, d + len - sc, sc);
+    }
+  }
+
+  struct Numeric *restrict const price = Numeric_from_char(s);
+
+  if (price == NULL)
+    panic();
+
+  return price;
+}
+
+#if defined(_MSC_VER)
+struct Archive *Archive_new(const char *restrict const path) {
+  fatal("%s: Sample archives not supported", path);
+}
+#else
+struct Archive *Archive_new(const char *restrict const path) {
+  struct Archive *restrict const a = heap_calloc(1, sizeof(struct Archive));
+  const size_t len = strlen(path);
+
+  a->path = heap_malloc(len + 1);
+  memcpy(a->path, path, len + 1);
+  a->buf = heap_calloc(1, sizeof(struct archive_blk) +
+                              archive_padded(ARCHIVE_PAYLOAD_MAX_LENGTH));
+  a->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+
+  if (a->fd == -1)
+    fatal("%s: %s", path, strerror(errno));
+
+  mutex_init(&a->mtx);
+  return a;
+}
+#endif
+
+void Archive_delete(void *restrict const arg) {
+  struct Archive *restrict const a = arg;
+
+  if (a == NULL)
+    return;
+
+  Archive_flush(a);
+
+#if !defined(_MSC_VER)
+  if (close(a->fd) == -1)
+    werr("%s: %s\n", a->path, strerror(errno));
+#endif
+
+  mutex_destroy(&a->mtx);
+  heap_free(a->buf);
+  heap_free(a->path);
+  heap_free(a);
+}
+
+static void archive_flush(struct Archive *restrict const a) {
+  struct archive_blk *restrict const blk = (struct archive_blk *)a->buf;
+
+  if (blk->cnt == 0)
+    return;
+
+#if !defined(_MSC_VER)
+  const int saved_errno = errno;
+  unsigned char *restrict const data = a->buf + sizeof(struct archive_blk);
+  const size_t len = sizeof(struct archive_blk) + archive_padded(blk->len);
+
+  memset(data + blk->len, 0, archive_padded(blk->len) - blk->len);
+  blk->magic = ARCHIVE_MAGIC;
+  blk->l_nanos = a->l_nanos;
+  blk->sum = archive_sum(data, blk->len);
+
+  const ssize_t w = write(a->fd, a->buf, len);
+
+  if (w == -1)
+    werr("%s: %s\n", a->path, strerror(errno));
+  else if ((size_t)w != len)
+    werr("%s: Short write: %zd/%zu\n", a->path, w, len);
+
+  errno = saved_errno;
+#endif
+
+  memset(blk, 0, sizeof(struct archive_blk));
+}
+
+void Archive_flush(struct Archive *restrict const a) {
+  mutex_lock(&a->mtx);
+  archive_flush(a);
+  mutex_unlock(&a->mtx);
+}
+
+bool Archive_append(struct Archive *restrict const a,
+                    const struct Numeric *restrict const nanos,
+                    const struct Numeric *restrict const price) {
+  struct archive_blk *restrict const blk = (struct archive_blk *)a->buf;
+  const int64_t n = Numeric_to_int64(nanos);
+  int32_t scale = 0;
+  int64_t m = 0;
+  bool ret = false;
+
+  if (!archive_price_split(&m, &scale, price))
+    return false;
+
+  mutex_lock(&a->mtx);
+
+  // The scale only grows, so that blocks are not cut short by every price
+  // with fewer decimals than its predecessor.
+  if (scale > a->scale) {
+    archive_flush(a);
+    a->scale = scale;
+  }
+
+  if (!archive_price_rescale(&m, scale, a->scale))
+    goto ret;
+
+  if (blk->cnt == 0) {
+    blk->f_nanos = n;
+    blk->f_price = m;
+    blk->scale = a->scale;
+  } else {
+    unsigned char *restrict const data = a->buf + sizeof(struct archive_blk);
+    blk->len += archive_varint_put(data + blk->len,
+                                   archive_delta(n, a->l_nanos));
+    blk->len += archive_varint_put(data + blk->len,
+                                   archive_delta(m, a->l_price));
+  }
+
+  blk->cnt++;
+  a->l_nanos = n;
+  a->l_price = m;
+
+  if (blk->cnt == ARCHIVE_BLOCK_SAMPLES)
+    archive_flush(a);
+
+  ret = true;
+ret:
+  mutex_unlock(&a->mtx);
+  return ret;
+}
+
+#if defined(_MSC_VER)
+long Archive_load(const char *restrict const path,
+                  const struct Numeric *restrict const since,
+                  const struct Numeric *restrict const until,
+                  const struct Numeric *restrict const gap,
+                  void (*handler)(struct Numeric *restrict const,
+                                  struct Numeric *restrict const,
+                                  void *restrict const),
+                  void *restrict const arg) {
+  (void)path;
+  (void)since;
+  (void)until;
+  (void)gap;
+  (void)handler;
+  (void)arg;
+  return -1;
+}
+#else
+/*
+ * Hands all samples not older than since to the handler, which takes
+ * ownership of the numbers. Returns -1 without calling the handler if the
+ * archive does not cover since to until without a gap wider than gap. A
+ * corrupt sample also returns -1, after the samples before it have been
+ * handed out.
+ */
+long Archive_load(const char *restrict const path,
+                  const struct Numeric *restrict const since,
+                  const struct Numeric *restrict const until,
+                  const struct Numeric *restrict const gap,
+                  void (*handler)(struct Numeric *restrict const,
+                                  struct Numeric *restrict const,
+                                  void *restrict const),
+                  void *restrict const arg) {
+  const int64_t s_nanos = Numeric_to_int64(since);
+  const int64_t u_nanos = Numeric_to_int64(until);
+  const int64_t g_nanos = Numeric_to_int64(gap);
+  const int fd = open(path, O_RDONLY);
+  struct archive_blk blk;
+  struct stat st;
+  int64_t l_nanos;
+  size_t end = 0;
+  long ret = -1;
+
+  if (fd == -1) {
+    if (errno != ENOENT)
+      werr("%s: %s\n", path, strerror(errno));
+
+    return -1;
+  }
+
+  if (fstat(fd, &st) == -1) {
+    werr("%s: %s\n", path, strerror(errno));
+    goto ret_close;
+  }
+
+  const size_t size = (size_t)st.st_size;
+
+  if (size < sizeof(blk))
+    goto ret_close;
+
+  const unsigned char *restrict const map =
+      mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (map == MAP_FAILED) {
+    werr("%s: %s\n", path, strerror(errno));
+    goto ret_close;
+  }
+
+  memcpy(&blk, map, sizeof(blk));
+
+  if (blk.magic != ARCHIVE_MAGIC || blk.f_nanos > s_nanos)
+    goto ret_unmap;
+
+  l_nanos = blk.f_nanos;
+
+  // The headers are checked first, so that an archive with holes, e.g. from
+  // downtime, or with a stale tail is rejected before decoding any sample.
+  while (end + sizeof(blk) <= size) {
+    memcpy(&blk, map + end, sizeof(blk));
+
+    const unsigned char *restrict const data = map + end + sizeof(blk);
+
+    if (blk.magic != ARCHIVE_MAGIC || blk.cnt == 0 ||
+        blk.scale > ARCHIVE_SCALE_MAX || blk.scale < 0 ||
+        blk.l_nanos < blk.f_nanos ||
+        archive_padded(blk.len) > size - end - sizeof(blk) ||
+        archive_sum(data, blk.len) != blk.sum) {
+      werr("%s: Corrupt block at offset %zu\n", path, end);
+      break;
+    }
+
+    if (blk.f_nanos < l_nanos || blk.f_nanos - l_nanos > g_nanos)
+      goto ret_unmap;
+
+    l_nanos = blk.l_nanos;
+    end += sizeof(blk) + archive_padded(blk.len);
+  }
+
+  if (l_nanos < u_nanos && u_nanos - l_nanos > g_nanos)
+    goto ret_unmap;
+
+  ret = 0;
+
+  for (size_t off = 0; off < end;) {
+    memcpy(&blk, map + off, sizeof(blk));
+
+    const unsigned char *restrict const data = map + off + sizeof(blk);
+
+    off += sizeof(blk) + archive_padded(blk.len);
+
+    // The block headers are the time index; blocks ending before since are
+    // never decoded.
+    if (blk.l_nanos < s_nanos)
+      continue;
+
+    int64_t n = blk.f_nanos;
+    int64_t m = blk.f_price;
+    size_t d_off = 0;
+
+    for (uint32_t i = 0; i < blk.cnt; i++) {
+      if (i > 0) {
+        int64_t dn = 0, dm = 0;
+
+        if (!archive_varint_get(&dn, data, blk.len, &d_off) ||
+            !archive_varint_get(&dm, data, blk.len, &d_off)) {
+          werr("%s: Corrupt sample at offset %zu\n", path, off);
+          ret = -1;
+          goto ret_unmap;
+        }
+
+        n = archive_undelta(n, dn);
+        m = archive_undelta(m, dm);
+      }
+
+      if (n < s_nanos)
+        continue;
+
+      struct Numeric *restrict const nanos = Numeric_new();
+      Numeric_from_int64_to(n, nanos);
+      handler(nanos, archive_price(m, blk.scale), arg);
+      ret++;
+    }
+  }
+
+ret_unmap:
+  if (munmap((void *)map, size) == -1)
+    werr("%s: %s\n", path, strerror(errno));
+ret_close:
+  if (close(fd) == -1)
+    werr("%s: %s\n", path, strerror(errno));
+
+  return ret;
+}
+#endif
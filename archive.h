@@ -0,0 +1,49 @@
+/* $JDTAUS$ */
+
+/*
+ * Copyright (c) 2026 Christian Schulte <cs@schulte.it>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#ifdef HAVE_HOST_H
+#include "host.h"
+#endif
+
+#include "math.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct Archive;
+
+struct Archive *Archive_new(const char *restrict const);
+void Archive_delete(void *restrict const);
+
+bool Archive_append(struct Archive *restrict const,
+                    const struct Numeric *restrict const,
+                    const struct Numeric *restrict const);
+void Archive_flush(struct Archive *restrict const);
+
+long Archive_load(const char *restrict const,
+                  const struct Numeric *restrict const,
+                  const struct Numeric *restrict const,
+                  const struct Numeric *restrict const,
+                  void (*)(struct Numeric *restrict const,
+                           struct Numeric *restrict const,
+                           void *restrict const),
+                  void *restrict const);
+#endif
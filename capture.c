@@ -0,0 +1,188 @@
+/* $JDTAUS$ */
+
+/*
+ * Copyright (c) 2026 Christian Schulte <cs@schulte.it>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Append-only capture of raw websocket frames. Every record consists of the
+ * receive time in nanoseconds since the epoch, the length of the frame and
+ * the frame itself, all in host byte order. Captures are meant to be
+ * replayed on the host they have been recorded on.
+ */
+
+#ifdef HAVE_HOST_H
+#include "host.h"
+#endif
+
+#include "capture.h"
+#include "heap.h"
+#include "proc.h"
+#include "thread.h"
+#include "time.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CAPTURE_BUFFER_SIZE (size_t)1048576
+
+struct capture_rec {
+  uint64_t nanos;
+  uint64_t len;
+};
+
+struct Capture {
+  FILE *restrict f;
+  char *restrict path;
+  char *restrict buf;
+  size_t buf_len;
+  mtx_t mtx;
+};
+
+struct Capture *Capture_new(const char *restrict const path,
+                            const bool writable) {
+  struct Capture *restrict const c = heap_calloc(1, sizeof(struct Capture));
+  const size_t len = strlen(path);
+
+  c->path = heap_malloc(len + 1);
+  memcpy(c->path, path, len + 1);
+  c->f = fopen(path, writable ? "ab" : "rb");
+
+  if (c->f == NULL)
+    fatal("%s: %s", path, strerror(errno));
+
+  if (writable && setvbuf(c->f, NULL, _IOFBF, CAPTURE_BUFFER_SIZE) != 0)
+    fatal("%s: %s", path, strerror(errno));
+
+  mutex_init(&c->mtx);
+  return c;
+}
+
+void Capture_delete(struct Capture *restrict const c) {
+  if (c == NULL)
+    return;
+
+  if (fclose(c->f) == EOF)
+    werr("%s: %s\n", c->path, strerror(errno));
+
+  mutex_destroy(&c->mtx);
+  heap_free(c->buf);
+  heap_free(c->path);
+  heap_free(c);
+}
+
+void Capture_write(struct Capture *restrict const c, const uint64_t nanos,
+                   const void *restrict const data, const size_t len) {
+  const int saved_errno = errno;
+  const struct capture_rec rec = {
+      .nanos = nanos,
+      .len = len,
+  };
+
+  mutex_lock(&c->mtx);
+
+  errno = 0;
+
+  if (fwrite(&rec, sizeof(rec), 1, c->f) != 1 ||
+      (len > 0 && fwrite(data, len, 1, c->f) != 1))
+    werr("%s: %s\n", c->path, strerror(errno));
+
+  mutex_unlock(&c->mtx);
+
+  errno = saved_errno;
+}
+
+bool Capture_read(struct Capture *restrict const c,
+                  uint64_t *restrict const nanos,
+                  const char **restrict const data,
+                  size_t *restrict const len) {
+  const int saved_errno = errno;
+  struct capture_rec rec = {0};
+  bool ret = false;
+
+  mutex_lock(&c->mtx);
+
+  errno = 0;
+
+  if (fread(&rec, sizeof(rec), 1, c->f) != 1)
+    goto ret;
+
+  if (rec.len > c->buf_len) {
+    c->buf = heap_realloc(c->buf, rec.len);
+    c->buf_len = rec.len;
+  }
+
+  if (rec.len > 0 && fread(c->buf, rec.len, 1, c->f) != 1) {
+    if (!ferror(c->f))
+      werr("%s: Truncated record\n", c->path);
+
+    goto ret;
+  }
+
+  *nanos = rec.nanos;
+  *data = c->buf;
+  *len = rec.len;
+  ret = true;
+ret:
+  if (!ret && ferror(c->f))
+    werr("%s: %s\n", c->path, strerror(errno));
+
+  mutex_unlock(&c->mtx);
+
+  errno = saved_errno;
+  return ret;
+}
+
+/*
+ * Feeds all records of a capture to a handler. A speed of zero replays as
+ * fast as possible, any other value divides the recorded time between two
+ * records.
+ */
+void Capture_replay(struct Capture *restrict const c, const unsigned long speed,
+                    const _Atomic bool *restrict const running,
+                    void (*handler)(const char *restrict const, const size_t,
+                                    void *restrict const),
+                    void *restrict const arg) {
+  const long max_sleep_ns = 100000000L;
+  uint64_t prev_ns = 0;
+  uint64_t nanos;
+  const char *data;
+  size_t len;
+
+  while (*running && Capture_read(c, &nanos, &data, &len)) {
+    if (speed > 0 && prev_ns > 0 && nanos > prev_ns) {
+      uint64_t delay_ns = (nanos - prev_ns) / speed;
+
+      while (*running && delay_ns > 0) {
+        const long sleep_ns =
+            delay_ns < (uint64_t)max_sleep_ns ? (long)delay_ns : max_sleep_ns;
+        const struct timespec delay = {.tv_sec = 0, .tv_nsec = sleep_ns};
+
+        thread_sleep(&delay);
+        delay_ns -= (uint64_t)sleep_ns;
+      }
+    }
+
+    prev_ns = nanos;
+    handler(data, len, arg);
+  }
+}
+
+uint64_t capture_nanos(void) {
+  struct timespec ts;
+  time_now(&ts);
+  return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
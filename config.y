@@ -262,6 +262,10 @@ exchangeconf  : conf_exchange
               | conf_exchange exchangeconf
               ;
 
+optexchangeconf : exchangeconf
+                | /* empty */
+                ;
+
 conf_exchange : CDP STRING {
 #define CDP_SIZE_MAX 4096
                 if (e_cnf->jwt_kid != NULL || e_cnf->jwt_key != NULL) {
@@ -474,7 +478,7 @@ exchange  : EXCHANGE STRING {
             }
 
             String_delete($2);
-          } exchangeconf {
+          } optexchangeconf {
             e_cnf = NULL;
           }
           ;
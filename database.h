@@ -35,6 +35,7 @@
 #define DATABASE_TRADE_STATUS_MAX_LENGTH (size_t)7
 #define DATABASE_CANDLE_TREND_MAX_LENGTH (size_t)4
 #define DATABASE_TREND_MARKER_TYPE_MAX_LENGTH (size_t)5
+#define DATABASE_SAMPLES_FETCH_ROWS (size_t)1024
 
 struct db_sample_rec {
   struct Numeric *nanos;
@@ -48,6 +49,8 @@ struct db_stats_rec {
   bool sd_min_null;
   bool sd_max_null;
   bool sd_avg_null;
+  char e_id[DATABASE_UUID_MAX_LENGTH + 1];
+  char m_id[DATABASE_UUID_MAX_LENGTH + 1];
   struct Numeric *bd_min;
   struct Numeric *bd_max;
   struct Numeric *bd_avg;
@@ -165,6 +168,13 @@ struct db_trend_state_rec {
 void *db_connect(const char *const);
 void db_disconnect(void *const);
 
+struct db_pool;
+
+struct db_pool *db_pool_new(const char *const, const size_t);
+void db_pool_delete(struct db_pool *const);
+void *db_pool_acquire(struct db_pool *const);
+void db_pool_release(struct db_pool *const, void *const);
+
 void db_tx_begin(const void *const);
 void db_tx_commit(const void *const);
 void db_tx_rollback(const void *const);
@@ -186,6 +196,7 @@ void db_sample_create(const void *const, const char *const, const char *const,
 void db_samples_open(const void *const, const char *const, const char *const,
                      const struct Numeric *const);
 bool db_samples_next(struct db_sample_rec *const, const void *const);
+size_t db_samples_fetch(struct db_sample_rec *const, const void *const);
 void db_samples_close(const void *const);
 
 void db_volatility_open(const void *const, const char *const, const char *const,
@@ -196,6 +207,9 @@ void db_volatility_close(const void *const);
 
 bool db_stats(struct db_stats_rec *const, const void *const, const char *const,
               const char *const);
+void db_stats_open(const void *const);
+bool db_stats_next(struct db_stats_rec *const, const void *const);
+void db_stats_close(const void *const);
 void db_stats_bcl_factor(const void *const, const char *const,
                          const char *const, struct Numeric *const);
 void db_stats_scl_factor(const void *const, const char *const,
@@ -291,13 +305,13 @@ bool db_position_state_restore(struct db_position_state_rec *const,
                                const void *const, const char *const,
                                const char *const, const char *const,
                                const char *const);
-void db_position_state_persist(const void *const, const char *const,
-                               const char *const, const char *const,
-                               const char *const,
-                               const struct db_position_state_rec *const);
+void db_tx_position_state_persist(const void *const, const char *const,
+                                  const char *const, const char *const,
+                                  const char *const,
+                                  const struct db_position_state_rec *const);
 bool db_trade_state_restore(struct db_trade_state_rec *const, const void *const,
                             const char *const, const char *const);
-void db_trade_state_persist(const void *const, const char *const,
-                            const char *const,
-                            const struct db_trade_state_rec *const);
+void db_tx_trade_state_persist(const void *const, const char *const,
+                               const char *const,
+                               const struct db_trade_state_rec *const);
 #endif
@@ -20,6 +20,7 @@
 #include "host.h"
 #endif
 
+#include "capture.h"
 #include "database.h"
 #include "exchange.h"
 #include "heap.h"
@@ -41,6 +42,7 @@
 
 #define URI_MAX (size_t)512
 #define JSON_BODY_MAX (size_t)32767
+#define BITVAVO_ORDERS_LIMIT (size_t)1000
 
 #ifndef BITVAVO_TICKER_SIZE
 #define BITVAVO_TICKER_SIZE (2 ^ 8)
@@ -82,6 +84,10 @@
 #define DEFAULT_BITVAVO_ORDER_PATH "/v2/order"
 #endif
 
+#ifndef DEFAULT_BITVAVO_ORDERS_PATH
+#define DEFAULT_BITVAVO_ORDERS_PATH "/v2/orders"
+#endif
+
 #ifndef DEFAULT_BITVAVO_ORDER_CREATE_PATH
 #define DEFAULT_BITVAVO_ORDER_CREATE_PATH "/v2/order"
 #endif
@@ -103,6 +109,22 @@
 #define DEFAULT_BITVAVO_WS_RETRY_SECONDS 3
 #endif
 
+#ifndef DEFAULT_BITVAVO_WS_TICKER_CONNECTIONS
+#define DEFAULT_BITVAVO_WS_TICKER_CONNECTIONS 1
+#endif
+
+#ifndef DEFAULT_BITVAVO_WS_CAPTURE
+#define DEFAULT_BITVAVO_WS_CAPTURE ""
+#endif
+
+#ifndef DEFAULT_BITVAVO_WS_REPLAY
+#define DEFAULT_BITVAVO_WS_REPLAY ""
+#endif
+
+#ifndef DEFAULT_BITVAVO_WS_REPLAY_SPEED
+#define DEFAULT_BITVAVO_WS_REPLAY_SPEED 0
+#endif
+
 #ifndef nitems
 #define nitems(_a) (sizeof((_a)) / sizeof((_a)[0]))
 #endif
@@ -112,6 +134,7 @@ extern const bool verbose;
 extern const struct Numeric *restrict const zero;
 extern const struct Numeric *restrict const one;
 extern const struct Numeric *restrict const hundred;
+extern const struct Numeric *restrict const milli_nanos;
 
 static void bitvavo_init(void);
 static void bitvavo_configure(const struct ExchangeConfig *restrict const);
@@ -119,12 +142,15 @@ static void bitvavo_destroy(void);
 static void bitvavo_start(void);
 static void bitvavo_stop(void);
 static struct Array *bitvavo_markets(void);
+static uintmax_t bitvavo_markets_version(void);
 static struct Market *bitvavo_market(const struct String *restrict const);
 static struct Market *bitvavo_market_by_symbol(struct String *restrict const);
 static struct Array *bitvavo_accounts(void);
 static struct Account *bitvavo_account(const struct String *restrict const);
 static struct Account *bitvavo_account_by_symbol(struct String *restrict const);
 static struct Pricing *bitvavo_pricing(const struct Market *restrict const);
+static struct Array *bitvavo_orders(const struct Market *restrict const,
+                                    const struct Numeric *restrict const);
 static struct Order *bitvavo_order(const struct Market *restrict const,
                                    const struct String *restrict const);
 static struct Order *bitvavo_order_await(void);
@@ -147,14 +173,17 @@ struct Exchange exchange_bitvavo = {
     .start = bitvavo_start,
     .stop = bitvavo_stop,
     .markets = bitvavo_markets,
+    .markets_version = bitvavo_markets_version,
     .market = bitvavo_market,
     .accounts = bitvavo_accounts,
     .account = bitvavo_account,
     .order = bitvavo_order,
+    .orders = bitvavo_orders,
     .order_await = bitvavo_order_await,
     .pricing = bitvavo_pricing,
     .sample_await = bitvavo_sample_await,
     .order_cancel = bitvavo_order_cancel,
+    .orders_cancel = NULL,
     .order_demand = bitvavo_order_demand,
     .order_supply = bitvavo_order_supply,
 };
@@ -172,6 +201,9 @@ struct bitvavo_tls {
   struct bitvavo_order_vars {
     struct wcjson_document *restrict rsp_doc;
   } bitvavo_order;
+  struct bitvavo_orders_vars {
+    struct wcjson_document *restrict rsp_doc;
+  } bitvavo_orders;
   struct bitvavo_order_post_vars {
     struct wcjson_document *restrict rsp_doc;
   } bitvavo_order_post;
@@ -206,8 +238,15 @@ static const struct {
     {"partiallyFilled", ORDER_STATUS_OPEN},
 };
 
+struct bitvavo_ws_connection;
+
 static int bitvavo_ws_worker_func(void *restrict const);
+static int bitvavo_ws_replay_func(void *restrict const);
 static void bitvavo_ws_evt_handler(struct mg_connection *, int, void *);
+static void bitvavo_ws_connect_timer(void *restrict const);
+static void bitvavo_ws_stall_timer(void *restrict const);
+static void
+bitvavo_ws_wakeup(const struct bitvavo_ws_connection *restrict const);
 
 static int
 bitvavo_ws_auth_evt_handler(struct mg_connection *restrict const,
@@ -229,9 +268,8 @@ bitvavo_ws_subscribed_evt_handler(struct mg_connection *restrict const,
                                   const struct wcjson_document *restrict const,
                                   const struct wcjson_value *restrict const);
 
-static struct {
+static const struct {
   const char *restrict evt;
-  uint64_t evt_ms;
   const bool may_stall;
   int (*evt_handler)(struct mg_connection *restrict const,
                      const struct wcjson_document *restrict const,
@@ -239,43 +277,41 @@ static struct {
 } bitvavo_ws_msg_handlers[] = {
     {
         .evt = "authenticate",
-        .evt_ms = 0,
         .evt_handler = bitvavo_ws_auth_evt_handler,
         .may_stall = false,
     },
     {
         .evt = "ticker",
-        .evt_ms = 0,
         .evt_handler = bitvavo_ws_ticker_evt_handler,
         .may_stall = true,
     },
     {
         .evt = "order",
-        .evt_ms = 0,
         .evt_handler = bitvavo_ws_account_evt_handler,
         .may_stall = true,
     },
     {
         .evt = "fill",
-        .evt_ms = 0,
         .evt_handler = bitvavo_ws_account_evt_handler,
         .may_stall = false,
     },
     {
         .evt = "subscribed",
-        .evt_ms = 0,
         .evt_handler = bitvavo_ws_subscribed_evt_handler,
         .may_stall = false,
     },
 };
 
 static const struct ExchangeConfig *restrict bitvavo_cnf;
+static mg_sha256_ctx bitvavo_hmac_inner;
+static mg_sha256_ctx bitvavo_hmac_outer;
 static void *restrict bitvavo_db;
 static char bitvavo_rest_uri[URI_MAX + 1];
 static char bitvavo_rest_accounts_path[URI_MAX + 1];
 static char bitvavo_rest_fees_path[URI_MAX + 1];
 static char bitvavo_rest_markets_path[URI_MAX + 1];
 static char bitvavo_rest_order_path[URI_MAX + 1];
+static char bitvavo_rest_orders_path[URI_MAX + 1];
 static char bitvavo_rest_order_create_path[URI_MAX + 1];
 static char bitvavo_rest_order_cancel_path[URI_MAX + 1];
 static struct timespec bitvavo_request_rate;
@@ -284,6 +320,33 @@ static char bitvavo_ws_path[URI_MAX + 1];
 static char bitvavo_ws_authenticate_path[URI_MAX + 1];
 static unsigned long bitvavo_ws_stall_ms;
 static struct timespec bitvavo_ws_retry_rate;
+static unsigned long bitvavo_ws_ticker_connections;
+static const char *restrict bitvavo_ws_capture_path;
+static const char *restrict bitvavo_ws_replay_path;
+static unsigned long bitvavo_ws_replay_speed;
+static struct Capture *restrict bitvavo_ws_capture;
+static struct Capture *restrict bitvavo_ws_replay;
+static thrd_t bitvavo_ws_replay_thrd;
+
+/*
+ * A websocket connection polled by its own worker thread. Ticker
+ * subscriptions are split across connections by market, the account channel is
+ * subscribed on a connection of its own so that order events never wait behind
+ * tickers.
+ */
+static struct bitvavo_ws_connection {
+  struct mg_mgr *restrict mgr;
+  struct mg_timer *restrict stall_timer;
+  thrd_t thrd;
+  size_t shard;
+  size_t shards;
+  bool account;
+  bool idle;
+  _Atomic unsigned long c_id;
+  _Atomic bool reconnect;
+  _Atomic uint64_t evt_ms[nitems(bitvavo_ws_msg_handlers)];
+} *restrict bitvavo_ws_connections;
+static size_t bitvavo_ws_connections_nitems;
 
 static struct String *restrict bitvavo_access_key;
 static struct String *restrict bitvavo_access_timestamp;
@@ -295,6 +358,7 @@ static struct Array *restrict markets;
 static struct Map *restrict markets_by_id;
 static struct Map *restrict markets_by_symbol;
 static _Atomic bool markets_reload;
+static _Atomic uintmax_t markets_version;
 
 static struct Array *restrict accounts;
 static struct Map *restrict accounts_by_id;
@@ -306,7 +370,6 @@ static struct Map *restrict pricings_by_id;
 static _Atomic bool running;
 static struct Queue *restrict orders;
 static struct Queue *restrict samples;
-static thrd_t mg_mgr_worker;
 
 static inline void tls_doc_free(struct wcjson_document *restrict const wc_doc) {
   heap_free(wc_doc->values);
@@ -327,6 +390,8 @@ static struct bitvavo_tls *const bitvavo_tls(void) {
     tls->bitvavo_pricing.rsp_doc =
         heap_calloc(1, sizeof(struct wcjson_document));
     tls->bitvavo_order.rsp_doc = heap_calloc(1, sizeof(struct wcjson_document));
+    tls->bitvavo_orders.rsp_doc =
+        heap_calloc(1, sizeof(struct wcjson_document));
     tls->bitvavo_order_post.rsp_doc =
         heap_calloc(1, sizeof(struct wcjson_document));
     tls->bitvavo_order_cancel.rsp_doc =
@@ -345,6 +410,7 @@ static void bitvavo_tls_dtor(void *e) {
   tls_doc_free(tls->bitvavo_query_markets.rsp_doc);
   tls_doc_free(tls->bitvavo_pricing.rsp_doc);
   tls_doc_free(tls->bitvavo_order.rsp_doc);
+  tls_doc_free(tls->bitvavo_orders.rsp_doc);
   tls_doc_free(tls->bitvavo_order_post.rsp_doc);
   tls_doc_free(tls->bitvavo_order_cancel.rsp_doc);
   tls_doc_free(tls->bitvavo_ws_msg_handler.msg_doc);
@@ -407,6 +473,9 @@ static void bitvavo_init(void) {
   envurl(bitvavo_rest_order_path, sizeof(bitvavo_rest_order_path) - 1,
          "BITVAVO_ORDER_PATH", DEFAULT_BITVAVO_ORDER_PATH);
 
+  envurl(bitvavo_rest_orders_path, sizeof(bitvavo_rest_orders_path) - 1,
+         "BITVAVO_ORDERS_PATH", DEFAULT_BITVAVO_ORDERS_PATH);
+
   envurl(bitvavo_rest_order_create_path,
          sizeof(bitvavo_rest_order_create_path) - 1,
          "BITVAVO_ORDER_CREATE_PATH", DEFAULT_BITVAVO_ORDER_CREATE_PATH);
@@ -439,12 +508,25 @@ static void bitvavo_init(void) {
   bitvavo_ws_retry_rate.tv_sec = ret_s;
   bitvavo_ws_retry_rate.tv_nsec = 0;
 
+  bitvavo_ws_ticker_connections = envul("BITVAVO_WS_TICKER_CONNECTIONS",
+                                        DEFAULT_BITVAVO_WS_TICKER_CONNECTIONS);
+
+  if (bitvavo_ws_ticker_connections == 0)
+    fatal("%s == 0", "BITVAVO_WS_TICKER_CONNECTIONS");
+
+  bitvavo_ws_capture_path =
+      envs("BITVAVO_WS_CAPTURE", DEFAULT_BITVAVO_WS_CAPTURE);
+  bitvavo_ws_replay_path = envs("BITVAVO_WS_REPLAY", DEFAULT_BITVAVO_WS_REPLAY);
+  bitvavo_ws_replay_speed =
+      envul("BITVAVO_WS_REPLAY_SPEED", DEFAULT_BITVAVO_WS_REPLAY_SPEED);
+
   if (verbose) {
     wout("\tBITVAVO_REST_URI=%s\n", bitvavo_rest_uri);
     wout("\tBITVAVO_ACCOUNTS_PATH=%s\n", bitvavo_rest_accounts_path);
     wout("\tBITVAVO_FEES_PATH=%s\n", bitvavo_rest_fees_path);
     wout("\tBITVAVO_MARKETS_PATH=%s\n", bitvavo_rest_markets_path);
     wout("\tBITVAVO_ORDER_PATH=%s\n", bitvavo_rest_order_path);
+    wout("\tBITVAVO_ORDERS_PATH=%s\n", bitvavo_rest_orders_path);
     wout("\tBITVAVO_ORDER_CREATE_PATH=%s\n", bitvavo_rest_order_create_path);
     wout("\tBITVAVO_ORDER_CANCEL_PATH=%s\n", bitvavo_rest_order_cancel_path);
     wout("\tBITVAVO_REQUESTS_PER_SECOND=%lu\n", req_s);
@@ -453,6 +535,11 @@ static void bitvavo_init(void) {
     wout("\tBITVAVO_WS_AUTHENTICATE_PATH=%s\n", bitvavo_ws_authenticate_path);
     wout("\tBITVAVO_WS_STALL_MILLIS=%lu\n", bitvavo_ws_stall_ms);
     wout("\tBITVAVO_WS_RETRY_SECONDS=%lu\n", ret_s);
+    wout("\tBITVAVO_WS_TICKER_CONNECTIONS=%lu\n",
+         bitvavo_ws_ticker_connections);
+    wout("\tBITVAVO_WS_CAPTURE=%s\n", bitvavo_ws_capture_path);
+    wout("\tBITVAVO_WS_REPLAY=%s\n", bitvavo_ws_replay_path);
+    wout("\tBITVAVO_WS_REPLAY_SPEED=%lu\n", bitvavo_ws_replay_speed);
   }
 
   tss_create(&bitvavo_tls_key, bitvavo_tls_dtor);
@@ -473,14 +560,48 @@ static void bitvavo_init(void) {
   samples = Queue_new(BITVAVO_TICKERS_DAY,
                       (time_t)(bitvavo_ws_stall_ms / 1000L)); // 1MB/2MB
 
-  for (size_t i = nitems(bitvavo_ws_msg_handlers); i-- > 0;)
-    bitvavo_ws_msg_handlers[i].evt_ms = mg_millis();
-
   running = false;
 }
 
+/*
+ * Hashes the padded API secret once. Signing then resumes from the inner
+ * and outer hash states instead of starting over with the key every time.
+ */
+static void bitvavo_hmac_init(const struct String *restrict const secret) {
+  uint8_t k[64] = {0};
+  uint8_t i_pad[64];
+  uint8_t o_pad[64];
+
+  if (String_length(secret) > sizeof(k)) {
+    mg_sha256_init(&bitvavo_hmac_inner);
+    mg_sha256_update(&bitvavo_hmac_inner,
+                     (const unsigned char *)String_chars(secret),
+                     String_length(secret));
+    mg_sha256_final(k, &bitvavo_hmac_inner);
+  } else
+    memcpy(k, String_chars(secret), String_length(secret));
+
+  for (size_t i = 0; i < sizeof(k); i++) {
+    i_pad[i] = k[i] ^ 0x36;
+    o_pad[i] = k[i] ^ 0x5c;
+  }
+
+  mg_sha256_init(&bitvavo_hmac_inner);
+  mg_sha256_update(&bitvavo_hmac_inner, i_pad, sizeof(i_pad));
+  mg_sha256_init(&bitvavo_hmac_outer);
+  mg_sha256_update(&bitvavo_hmac_outer, o_pad, sizeof(o_pad));
+
+  memset(k, 0, sizeof(k));
+  memset(i_pad, 0, sizeof(i_pad));
+  memset(o_pad, 0, sizeof(o_pad));
+}
+
 static void bitvavo_configure(const struct ExchangeConfig *restrict const c) {
   bitvavo_cnf = c;
+
+  if (c->api_secret != NULL)
+    bitvavo_hmac_init(c->api_secret);
+
   bitvavo_db = db_connect(BITVAVO_DBCON);
 }
 
@@ -489,6 +610,8 @@ static void bitvavo_destroy(void) {
     db_disconnect(bitvavo_db);
 
   bitvavo_cnf = NULL;
+  memset(&bitvavo_hmac_inner, 0, sizeof(bitvavo_hmac_inner));
+  memset(&bitvavo_hmac_outer, 0, sizeof(bitvavo_hmac_outer));
   String_delete(exchange_bitvavo.id);
   String_delete(exchange_bitvavo.nm);
   String_delete(bitvavo_access_key);
@@ -513,31 +636,109 @@ static void bitvavo_start(void) {
   if (r < 0 || (size_t)r >= sizeof(url))
     panic();
 
-  struct mg_mgr *restrict const mgr = heap_calloc(1, sizeof(struct mg_mgr));
-  mg_mgr_init(mgr);
-  mg_mgr_config(mgr);
-  mgr->userdata = String_cnew(url);
+  if (*bitvavo_ws_replay_path) {
+    bitvavo_ws_replay = Capture_new(bitvavo_ws_replay_path, false);
+
+    Queue_start(orders);
+    Queue_start(samples);
+
+    running = true;
+    thread_create(&bitvavo_ws_replay_thrd, bitvavo_ws_replay_func,
+                  String_cnew(url));
+    return;
+  }
+
+  if (*bitvavo_ws_capture_path)
+    bitvavo_ws_capture = Capture_new(bitvavo_ws_capture_path, true);
+
+  // The last connection is the account connection.
+  bitvavo_ws_connections_nitems = bitvavo_ws_ticker_connections + 1;
+  bitvavo_ws_connections = heap_calloc(bitvavo_ws_connections_nitems,
+                                       sizeof(struct bitvavo_ws_connection));
 
   Queue_start(orders);
   Queue_start(samples);
 
   running = true;
 
-  struct mg_connection *restrict const c =
-      mg_ws_connect(mgr, url, bitvavo_ws_evt_handler, NULL,
-                    "User-Agent: Abagnale; %s\r\n", ABAG_REVISION);
+  for (size_t i = bitvavo_ws_connections_nitems; i-- > 0;) {
+    struct bitvavo_ws_connection *restrict const conn =
+        &bitvavo_ws_connections[i];
+
+    conn->mgr = heap_calloc(1, sizeof(struct mg_mgr));
+    mg_mgr_init(conn->mgr);
+    mg_mgr_config(conn->mgr);
+    conn->mgr->userdata = String_cnew(url);
+
+    if (!mg_wakeup_init(conn->mgr))
+      fatal("%s: Failure initializing websocket wakeup\n", url);
+
+    conn->stall_timer = mg_timer_add(conn->mgr, bitvavo_ws_stall_ms,
+                                     MG_TIMER_REPEAT, bitvavo_ws_stall_timer,
+                                     conn);
+    conn->reconnect = false;
+    conn->idle = false;
+    conn->account = i == bitvavo_ws_ticker_connections;
+    conn->shard = conn->account ? 0 : i;
+    conn->shards = conn->account ? 1 : bitvavo_ws_ticker_connections;
+
+    // Account and ticker events are only ever received by their connections.
+    for (size_t j = nitems(bitvavo_ws_msg_handlers); j-- > 0;) {
+      const bool account_evt = bitvavo_ws_msg_handlers[j].evt_handler ==
+                               bitvavo_ws_account_evt_handler;
+      const bool ticker_evt = bitvavo_ws_msg_handlers[j].evt_handler ==
+                              bitvavo_ws_ticker_evt_handler;
+
+      conn->evt_ms[j] =
+          (conn->account ? !ticker_evt : !account_evt) ? mg_millis() : 0;
+    }
+
+    struct mg_connection *restrict const c =
+        mg_ws_connect(conn->mgr, url, bitvavo_ws_evt_handler, conn,
+                      "User-Agent: Abagnale; %s\r\n", ABAG_REVISION);
 
-  if (!c)
-    fatal("%s: Failure starting websocket\n", url);
+    if (!c)
+      fatal("%s: Failure starting websocket\n", url);
 
-  thread_create(&mg_mgr_worker, bitvavo_ws_worker_func, mgr);
+    conn->c_id = c->id;
+  }
+
+  for (size_t i = bitvavo_ws_connections_nitems; i-- > 0;)
+    thread_create(&bitvavo_ws_connections[i].thrd, bitvavo_ws_worker_func,
+                  &bitvavo_ws_connections[i]);
 }
 
 static void bitvavo_stop(void) {
   running = false;
   Queue_stop(orders);
   Queue_stop(samples);
-  thread_join(mg_mgr_worker, NULL);
+
+  if (bitvavo_ws_replay != NULL) {
+    thread_join(bitvavo_ws_replay_thrd, NULL);
+    Capture_delete(bitvavo_ws_replay);
+    bitvavo_ws_replay = NULL;
+    return;
+  }
+
+  for (size_t i = bitvavo_ws_connections_nitems; i-- > 0;)
+    bitvavo_ws_wakeup(&bitvavo_ws_connections[i]);
+
+  for (size_t i = bitvavo_ws_connections_nitems; i-- > 0;)
+    thread_join(bitvavo_ws_connections[i].thrd, NULL);
+
+  // Managers are released after all workers stopped polling them.
+  for (size_t i = bitvavo_ws_connections_nitems; i-- > 0;) {
+    String_delete(bitvavo_ws_connections[i].mgr->userdata);
+    mg_mgr_free(bitvavo_ws_connections[i].mgr);
+    heap_free(bitvavo_ws_connections[i].mgr);
+  }
+
+  heap_free(bitvavo_ws_connections);
+  bitvavo_ws_connections = NULL;
+  bitvavo_ws_connections_nitems = 0;
+
+  Capture_delete(bitvavo_ws_capture);
+  bitvavo_ws_capture = NULL;
 }
 
 static void bitvavo_signature(char signature[65], const uintmax_t timestamp,
@@ -553,8 +754,13 @@ static void bitvavo_signature(char signature[65], const uintmax_t timestamp,
   if (r < 0 || (size_t)r >= sizeof(data))
     panic();
 
-  mg_hmac_sha256(digest, (uint8_t *)String_chars(bitvavo_cnf->api_secret),
-                 String_length(bitvavo_cnf->api_secret), (uint8_t *)data, r);
+  mg_sha256_ctx ctx = bitvavo_hmac_inner;
+  mg_sha256_update(&ctx, (const unsigned char *)data, (size_t)r);
+  mg_sha256_final(digest, &ctx);
+
+  ctx = bitvavo_hmac_outer;
+  mg_sha256_update(&ctx, digest, sizeof(digest));
+  mg_sha256_final(digest, &ctx);
 
   char *restrict sp = signature;
 
@@ -1168,12 +1374,15 @@ static struct Array *bitvavo_markets(void) {
               bitvavo_rest_uri, String_chars(((struct Market *)items[i])->id));
     }
 
+    markets_version++;
     markets_reload = false;
   }
 ret:
   return markets;
 }
 
+static uintmax_t bitvavo_markets_version(void) { return markets_version; }
+
 static struct Market *bitvavo_market(const struct String *restrict const m_id) {
   struct Array *restrict const m_array = bitvavo_markets();
   struct Market *restrict m = Map_get(markets_by_id, m_id);
@@ -1368,6 +1577,88 @@ static struct Order *bitvavo_order(const struct Market *restrict const m,
   return bitvavo_parse_order(rsp_doc, rsp_doc->values);
 }
 
+static void *
+bitvavo_parse_order_entity(const struct wcjson_document *restrict const doc,
+                           const struct wcjson_value *restrict const order) {
+  return bitvavo_parse_order(doc, order);
+}
+
+static struct Array *
+bitvavo_orders(const struct Market *restrict const m,
+               const struct Numeric *restrict const since) {
+  const struct bitvavo_tls *restrict const tls = bitvavo_tls();
+  struct wcjson_document *restrict rsp_doc = tls->bitvavo_orders.rsp_doc;
+  struct Numeric *restrict const ms = Numeric_div(since, milli_nanos);
+  char *restrict const start = Numeric_to_char(ms, 0);
+  struct Array *restrict o = Array_new(BITVAVO_ORDERS_LIMIT);
+  struct Array *restrict const page = Array_new(BITVAVO_ORDERS_LIMIT);
+  struct String *restrict o_id_to = NULL;
+  bool success = false;
+  char url[URI_MAX];
+  int r;
+
+  do {
+    if (o_id_to != NULL)
+      r = snprintf(url, sizeof(url),
+                   "%s%s?market=%s&start=%s&limit=%zu&orderIdTo=%s",
+                   bitvavo_rest_uri, bitvavo_rest_orders_path,
+                   String_chars(m->sym), start, BITVAVO_ORDERS_LIMIT,
+                   String_chars(o_id_to));
+    else
+      r = snprintf(url, sizeof(url), "%s%s?market=%s&start=%s&limit=%zu",
+                   bitvavo_rest_uri, bitvavo_rest_orders_path,
+                   String_chars(m->sym), start, BITVAVO_ORDERS_LIMIT);
+
+    if (r < 0 || (size_t)r >= sizeof(url))
+      panic();
+
+    // Rate limit weight points: 5
+    thread_sleep(&bitvavo_request_rate);
+    thread_sleep(&bitvavo_request_rate);
+    thread_sleep(&bitvavo_request_rate);
+    thread_sleep(&bitvavo_request_rate);
+    thread_sleep(&bitvavo_request_rate);
+
+    if (bitvavo_rest_query(rsp_doc, url, "GET", mg_url_uri(url), NULL, 0) < 0)
+      goto ret;
+
+    if (bitvavo_rest_parse_entities(page, "orders", rsp_doc,
+                                    bitvavo_parse_order_entity) < 0)
+      goto ret;
+
+    const bool has_next = Array_size(page) == BITVAVO_ORDERS_LIMIT;
+
+    // Orders are returned newest first; the next page ends with the oldest.
+    void *const *restrict const items = Array_items(page);
+    for (size_t i = 0; i < Array_size(page); i++) {
+      struct Order *restrict const order = items[i];
+
+      if (o_id_to != NULL && String_equals(order->id, o_id_to))
+        Order_delete(order);
+      else
+        Array_add_tail(o, order);
+    }
+
+    String_delete(o_id_to);
+    o_id_to =
+        has_next ? String_copy(((struct Order *)Array_tail(o))->id) : NULL;
+    Array_clear(page, NULL);
+  } while (o_id_to != NULL);
+
+  success = true;
+ret:
+  if (!success) {
+    Array_delete(o, Order_delete);
+    o = NULL;
+  }
+
+  Array_delete(page, Order_delete);
+  String_delete(o_id_to);
+  Numeric_char_free(start);
+  Numeric_delete(ms);
+  return o;
+}
+
 static int bitvavo_order_create_request(
     char *restrict const mb, size_t *restrict const mb_len,
     const char *restrict const url, const struct String *restrict const m_sym,
@@ -1455,6 +1746,11 @@ static struct String *bitvavo_order_post(const char *restrict const m_sym,
 
   errno = 0;
 
+  if (*bitvavo_ws_replay_path) {
+    werr("%s: create: Replaying %s\n", url, bitvavo_ws_replay_path);
+    goto ret;
+  }
+
   if (bitvavo_order_create_request(mb, &mb_len, url, sym, sd, base_amount,
                                    strlen(base_amount), price,
                                    strlen(price)) < 0)
@@ -1517,6 +1813,13 @@ static bool bitvavo_order_cancel(const struct Market *restrict const m,
   if (r < 0 || (size_t)r >= sizeof(url))
     panic();
 
+  errno = 0;
+
+  if (*bitvavo_ws_replay_path) {
+    werr("%s: cancel: Replaying %s\n", url, bitvavo_ws_replay_path);
+    goto ret;
+  }
+
   if (bitvavo_rest_query(rsp_doc, url, "DELETE", mg_url_uri(url), NULL, 0) < 0)
     goto ret;
 
@@ -1555,15 +1858,76 @@ static struct Order *bitvavo_order_await(void) {
   return Queue_dequeue_await(orders);
 }
 
+static void
+bitvavo_ws_wakeup(const struct bitvavo_ws_connection *restrict const conn) {
+  if (conn->c_id != 0)
+    mg_wakeup(conn->mgr, conn->c_id, "", 0);
+}
+
+static void bitvavo_ws_connect_timer(void *restrict const arg) {
+  struct bitvavo_ws_connection *restrict const conn = arg;
+
+  if (!running)
+    return;
+
+  struct mg_connection *restrict const c = mg_ws_connect(
+      conn->mgr, String_chars(conn->mgr->userdata), bitvavo_ws_evt_handler,
+      conn, "User-Agent: Abagnale; %s\r\n", ABAG_REVISION);
+
+  if (c == NULL) {
+    werr("%s: Failure reconnecting\n", String_chars(conn->mgr->userdata));
+
+    mg_timer_add(conn->mgr, bitvavo_ws_retry_rate.tv_sec * 1000UL,
+                 MG_TIMER_ONCE, bitvavo_ws_connect_timer, conn);
+
+    return;
+  }
+
+  conn->c_id = c->id;
+  conn->reconnect = false;
+}
+
+/*
+ * Closes a stalled connection and re-arms itself to expire when the next
+ * event of the connection would be considered stalled.
+ */
+static void bitvavo_ws_stall_timer(void *restrict const arg) {
+  struct bitvavo_ws_connection *restrict const conn = arg;
+  const uint64_t now = mg_millis();
+  uint64_t next = now + bitvavo_ws_stall_ms;
+
+  for (size_t i = nitems(bitvavo_ws_msg_handlers); i-- > 0;) {
+    if (!bitvavo_ws_msg_handlers[i].may_stall || !conn->evt_ms[i])
+      continue;
+
+    // Shards without markets never receive tickers.
+    if (conn->idle && bitvavo_ws_msg_handlers[i].evt_handler ==
+                          bitvavo_ws_ticker_evt_handler)
+      continue;
+
+    if (now - conn->evt_ms[i] > bitvavo_ws_stall_ms) {
+      conn->reconnect = true;
+      conn->evt_ms[i] = now;
+      bitvavo_ws_wakeup(conn);
+
+      if (verbose)
+        wout("%s: %s: No events\n", String_chars(conn->mgr->userdata),
+             bitvavo_ws_msg_handlers[i].evt);
+    }
+
+    if (conn->evt_ms[i] + bitvavo_ws_stall_ms + 1 < next)
+      next = conn->evt_ms[i] + bitvavo_ws_stall_ms + 1;
+  }
+
+  conn->stall_timer->expire = next;
+}
+
 static int bitvavo_ws_worker_func(void *restrict const arg) {
-  struct mg_mgr *restrict const mgr = arg;
+  struct bitvavo_ws_connection *restrict const conn = arg;
 
   while (running)
-    mg_mgr_poll(mgr, bitvavo_ws_stall_ms / 4);
+    mg_mgr_poll(conn->mgr, mg_mgr_timeout(conn->mgr, bitvavo_ws_stall_ms / 4));
 
-  String_delete(mgr->userdata);
-  mg_mgr_free(mgr);
-  heap_free(mgr);
   thread_exit(EXIT_SUCCESS);
 }
 
@@ -1643,10 +2007,12 @@ ret:
 }
 
 static int bitvavo_ws_subscribe(struct mg_connection *restrict const c) {
+  struct bitvavo_ws_connection *restrict const conn = c->fn_data;
   void *const *restrict items;
   const int saved_errno = errno;
   struct wcjson wc_json = WCJSON_INITIALIZER;
   struct wcjson_document req_doc = WCJSON_DOCUMENT_INITIALIZER;
+  size_t t_cnt = 0;
   int ret = -1;
 
   markets_reload = true;
@@ -1654,43 +2020,83 @@ static int bitvavo_ws_subscribe(struct mg_connection *restrict const c) {
 
   req_doc.v_nitems = 16;
 
-  if (req_doc.v_nitems > SIZE_MAX - Array_size(m_array))
+  if (req_doc.v_nitems > SIZE_MAX - 2 * Array_size(m_array))
     panic();
 
-  req_doc.v_nitems += Array_size(m_array);
+  req_doc.v_nitems += 2 * Array_size(m_array);
   req_doc.values = heap_reallocarray(req_doc.values, req_doc.v_nitems,
                                      sizeof(struct wcjson_value));
 
   errno = 0;
 
   struct wcjson_value *restrict const j_action = wcjson_value_object(&req_doc);
-  struct wcjson_value *restrict const j_markets = wcjson_value_array(&req_doc);
+  struct wcjson_value *restrict const j_t_markets =
+      wcjson_value_array(&req_doc);
+  struct wcjson_value *restrict const j_a_markets =
+      wcjson_value_array(&req_doc);
   struct wcjson_value *restrict const j_channels = wcjson_value_array(&req_doc);
 
   items = Array_items(m_array);
   for (size_t i = Array_size(m_array); i-- > 0;) {
     const struct Market *restrict const m = items[i];
-    wcjson_array_add_tail(&req_doc, j_markets,
+
+    if (conn->account) {
+      wcjson_array_add_tail(
+          &req_doc, j_a_markets,
+          wcjson_value_mbstring(&req_doc, String_chars(m->sym),
+                                String_length(m->sym)));
+      continue;
+    }
+
+    if (conn->shards > 1 && String_hash(m->sym) % conn->shards != conn->shard)
+      continue;
+
+    wcjson_array_add_tail(&req_doc, j_t_markets,
                           wcjson_value_mbstring(&req_doc, String_chars(m->sym),
                                                 String_length(m->sym)));
+    t_cnt++;
   }
   Array_unlock(m_array);
 
-  struct wcjson_value *restrict const j_ticker = wcjson_value_object(&req_doc);
-  struct wcjson_value *restrict const j_account = wcjson_value_object(&req_doc);
+  if (!conn->account) {
+    // Restart the stall clock of an idle shard getting markets.
+    if (conn->idle && t_cnt > 0)
+      for (size_t i = nitems(bitvavo_ws_msg_handlers); i-- > 0;)
+        if (bitvavo_ws_msg_handlers[i].evt_handler ==
+            bitvavo_ws_ticker_evt_handler)
+          conn->evt_ms[i] = mg_millis();
+
+    conn->idle = t_cnt == 0;
+  }
+
+  if (t_cnt > 0) {
+    struct wcjson_value *restrict const j_ticker =
+        wcjson_value_object(&req_doc);
+
+    wcjson_object_add_tail(&req_doc, j_ticker, L"name", 4,
+                           wcjson_value_string(&req_doc, L"ticker", 6));
 
-  wcjson_object_add_tail(&req_doc, j_ticker, L"name", 4,
-                         wcjson_value_string(&req_doc, L"ticker", 6));
+    wcjson_object_add_tail(&req_doc, j_ticker, L"markets", 7, j_t_markets);
 
-  wcjson_object_add_tail(&req_doc, j_ticker, L"markets", 7, j_markets);
+    wcjson_array_add_tail(&req_doc, j_channels, j_ticker);
+  }
 
-  wcjson_object_add_tail(&req_doc, j_account, L"name", 4,
-                         wcjson_value_string(&req_doc, L"account", 7));
+  if (conn->account) {
+    struct wcjson_value *restrict const j_account =
+        wcjson_value_object(&req_doc);
 
-  wcjson_object_add_tail(&req_doc, j_account, L"markets", 7, j_markets);
+    wcjson_object_add_tail(&req_doc, j_account, L"name", 4,
+                           wcjson_value_string(&req_doc, L"account", 7));
 
-  wcjson_array_add_tail(&req_doc, j_channels, j_ticker);
-  wcjson_array_add_tail(&req_doc, j_channels, j_account);
+    wcjson_object_add_tail(&req_doc, j_account, L"markets", 7, j_a_markets);
+
+    wcjson_array_add_tail(&req_doc, j_channels, j_account);
+  } else if (t_cnt == 0) {
+    // Nothing to subscribe to on this shard.
+    errno = 0;
+    ret = 0;
+    goto ret;
+  }
 
   wcjson_object_add_tail(&req_doc, j_action, L"action", 6,
                          wcjson_value_string(&req_doc, L"subscribe", 9));
@@ -1741,6 +2147,7 @@ bitvavo_ws_msg_handler(struct mg_connection *restrict const c,
   const struct bitvavo_tls *restrict const tls = bitvavo_tls();
   struct wcjson_document *restrict const msg_doc =
       tls->bitvavo_ws_msg_handler.msg_doc;
+  struct bitvavo_ws_connection *restrict const conn = c->fn_data;
 
   const int saved_errno = errno;
   int ret = -1;
@@ -1765,7 +2172,7 @@ bitvavo_ws_msg_handler(struct mg_connection *restrict const c,
   for (size_t i = nitems(bitvavo_ws_msg_handlers); i-- > 0;)
     if (strcmp(evt, bitvavo_ws_msg_handlers[i].evt) == 0) {
       handled = true;
-      bitvavo_ws_msg_handlers[i].evt_ms = mg_millis();
+      conn->evt_ms[i] = mg_millis();
       if (bitvavo_ws_msg_handlers[i].evt_handler(c, msg_doc, msg_doc->values) <
           0)
         goto ret;
@@ -1788,8 +2195,45 @@ ret:
   return ret;
 }
 
+static void bitvavo_ws_replay_message(const char *restrict const data,
+                                      const size_t len,
+                                      void *restrict const arg) {
+  struct mg_ws_message msg = {0};
+  msg.data = mg_str_n(data, len);
+  msg.flags = WEBSOCKET_OP_TEXT;
+  bitvavo_ws_msg_handler(arg, &msg);
+}
+
+/*
+ * Feeds captured frames to the message handler instead of connecting to the
+ * exchange. The handlers get passed a detached connection only carrying the
+ * state they access.
+ */
+static int bitvavo_ws_replay_func(void *restrict const arg) {
+  struct bitvavo_ws_connection conn = {0};
+  struct mg_mgr mgr = {0};
+  struct mg_connection c = {0};
+
+  mgr.userdata = arg;
+  c.mgr = &mgr;
+  c.fn_data = &conn;
+  conn.mgr = &mgr;
+  conn.shards = 1;
+
+  Capture_replay(bitvavo_ws_replay, bitvavo_ws_replay_speed, &running,
+                 bitvavo_ws_replay_message, &c);
+
+  if (verbose && running)
+    wout("%s: Replay finished\n", bitvavo_ws_replay_path);
+
+  String_delete(arg);
+  thread_exit(EXIT_SUCCESS);
+}
+
 static void bitvavo_ws_evt_handler(struct mg_connection *c, int ev,
                                    void *ev_data) {
+  struct bitvavo_ws_connection *restrict const conn = c->fn_data;
+
   switch (ev) {
   case MG_EV_CONNECT: {
 #ifdef ABAG_BITVAVO_DEBUG
@@ -1824,6 +2268,10 @@ static void bitvavo_ws_evt_handler(struct mg_connection *c, int ev,
 
     if (running) {
       if (type == WEBSOCKET_OP_TEXT) {
+        if (bitvavo_ws_capture != NULL)
+          Capture_write(bitvavo_ws_capture, capture_nanos(), msg->data.buf,
+                        msg->data.len);
+
         if (bitvavo_ws_msg_handler(c, msg) < 0)
           c->is_closing = 1;
 
@@ -1846,37 +2294,20 @@ static void bitvavo_ws_evt_handler(struct mg_connection *c, int ev,
 #ifdef ABAG_BITVAVO_DEBUG
     wout("%s: %lu MG_EV_CLOSE\n", String_chars(c->mgr->userdata), c->id);
 #endif
-    if (running) {
-      struct mg_mgr *restrict const mgr = c->mgr;
+    conn->c_id = 0;
 
-      do {
-        thread_sleep(&bitvavo_ws_retry_rate);
-        c = mg_ws_connect(mgr, String_chars(mgr->userdata),
-                          bitvavo_ws_evt_handler, NULL,
-                          "User-Agent: Abagnale; %s\r\n", ABAG_REVISION);
-        if (!c)
-          werr("%s: Failure reconnecting\n", String_chars(mgr->userdata));
+    if (running)
+      mg_timer_add(c->mgr, bitvavo_ws_retry_rate.tv_sec * 1000UL,
+                   MG_TIMER_ONCE, bitvavo_ws_connect_timer, conn);
 
-      } while (!c);
-    }
     break;
   }
   }
 
-  const uint64_t now = mg_millis();
-  for (size_t i = nitems(bitvavo_ws_msg_handlers); i-- > 0;)
-    if (bitvavo_ws_msg_handlers[i].may_stall &&
-        bitvavo_ws_msg_handlers[i].evt_ms &&
-        now - bitvavo_ws_msg_handlers[i].evt_ms > bitvavo_ws_stall_ms) {
-      c->is_closing = 1;
-      bitvavo_ws_msg_handlers[i].evt_ms = now;
-
-      if (verbose)
-        wout("%s: %s: No events\n", String_chars(c->mgr->userdata),
-             bitvavo_ws_msg_handlers[i].evt);
-
-      break;
-    }
+  if (conn->reconnect) {
+    conn->reconnect = false;
+    c->is_closing = 1;
+  }
 }
 
 static int
@@ -1900,6 +2331,13 @@ bitvavo_ws_auth_evt_handler(struct mg_connection *restrict const c,
     goto ret;
   }
 
+  // Captured sessions contain the subscription responses already.
+  if (bitvavo_ws_replay != NULL) {
+    errno = 0;
+    ret = 0;
+    goto ret;
+  }
+
   if (bitvavo_ws_subscribe(c) < 0)
     goto ret;
 
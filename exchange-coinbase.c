@@ -21,6 +21,7 @@
 #include "host.h"
 #endif
 
+#include "capture.h"
 #include "charset.h"
 #include "config.h"
 #include "database.h"
@@ -43,6 +44,8 @@
 
 #define URL_MAX_LENGTH (size_t)512
 #define JSON_BODY_MAX (size_t)32767
+#define CANCEL_BATCH_MAX (size_t)100
+#define JWT_LIFETIME_SECONDS 120
 
 #ifndef COINBASE_TICKER_SIZE
 #define COINBASE_TICKER_SIZE (2 ^ 10)
@@ -104,6 +107,30 @@
 #define DEFAULT_CDP_HTTP_TIMEOUT_MILLIS 60000L
 #endif
 
+#ifndef DEFAULT_CDP_MARKETS_RELOAD_SECONDS
+#define DEFAULT_CDP_MARKETS_RELOAD_SECONDS 3600
+#endif
+
+#ifndef DEFAULT_CDP_JWT_REUSE_SECONDS
+#define DEFAULT_CDP_JWT_REUSE_SECONDS 60
+#endif
+
+#ifndef DEFAULT_CDP_WS_TICKER_CONNECTIONS
+#define DEFAULT_CDP_WS_TICKER_CONNECTIONS 1
+#endif
+
+#ifndef DEFAULT_CDP_WS_CAPTURE
+#define DEFAULT_CDP_WS_CAPTURE ""
+#endif
+
+#ifndef DEFAULT_CDP_WS_REPLAY
+#define DEFAULT_CDP_WS_REPLAY ""
+#endif
+
+#ifndef DEFAULT_CDP_WS_REPLAY_SPEED
+#define DEFAULT_CDP_WS_REPLAY_SPEED 0
+#endif
+
 #ifndef nitems
 #define nitems(_a) (sizeof((_a)) / sizeof((_a)[0]))
 #endif
@@ -112,9 +139,9 @@ struct coinbase_tls {
   struct ws_handle_message_vars {
     struct wcjson_document *restrict ws_doc;
   } ws_handle_message;
-  struct coinbase_markets_vars {
+  struct markets_load_vars {
     struct wcjson_document *restrict rsp_doc;
-  } coinbase_markets;
+  } markets_load;
   struct accounts_with_cursor_vars {
     struct wcjson_document *restrict rsp_doc;
   } accounts_with_cursor;
@@ -124,6 +151,9 @@ struct coinbase_tls {
   struct coinbase_order_vars {
     struct wcjson_document *restrict rsp_doc;
   } coinbase_order;
+  struct coinbase_orders_vars {
+    struct wcjson_document *restrict rsp_doc;
+  } coinbase_orders;
   struct coinbase_order_cancel_vars {
     struct wcjson_document *restrict rsp_doc;
   } coinbase_order_cancel;
@@ -181,6 +211,8 @@ static const struct {
 extern const struct Numeric *restrict const zero;
 extern const struct Numeric *restrict const hundred;
 extern const bool verbose;
+extern const bool ticker_exporter;
+extern const struct Config *restrict const cnf;
 
 static const struct ExchangeConfig *restrict coinbase_cnf;
 static char coinbase_ws_uri[URL_MAX_LENGTH + 1];
@@ -195,6 +227,19 @@ static char coinbase_order_cancel_path[URL_MAX_LENGTH + 1];
 static char coinbase_order_create_path[URL_MAX_LENGTH + 1];
 static char coinbase_products_path[URL_MAX_LENGTH + 1];
 static unsigned long coinbase_stall_ms;
+static unsigned long coinbase_markets_reload_s;
+static unsigned long coinbase_jwt_reuse_s;
+static uint8_t coinbase_ec_key[32];
+static size_t coinbase_ec_key_len;
+static struct Map *restrict jwts;
+static time_t jwts_sweep;
+static unsigned long coinbase_ws_ticker_connections;
+static const char *restrict coinbase_ws_capture_path;
+static const char *restrict coinbase_ws_replay_path;
+static unsigned long coinbase_ws_replay_speed;
+static struct Capture *restrict coinbase_ws_capture;
+static struct Capture *restrict coinbase_ws_replay;
+static thrd_t coinbase_ws_replay_thrd;
 static void *restrict coinbase_db;
 static struct String *restrict coinbase_authorization;
 
@@ -202,6 +247,12 @@ static struct Array *restrict markets;
 static struct Map *restrict markets_by_id;
 static struct Map *restrict markets_by_symbol;
 static _Atomic bool markets_reload;
+static _Atomic uintmax_t markets_version;
+static _Atomic bool markets_refreshing;
+static mtx_t markets_mtx;
+static cnd_t markets_cnd;
+static mtx_t markets_load_mtx;
+static thrd_t markets_thrd;
 
 static struct Array *restrict accounts;
 static struct Map *restrict accounts_by_id;
@@ -215,7 +266,6 @@ static _Atomic bool running;
 static struct Queue *restrict orders;
 static struct Queue *restrict samples;
 static tss_t coinbase_tls_key;
-static thrd_t mg_mgr_worker;
 
 static void coinbase_init(void);
 static void coinbase_configure(const struct ExchangeConfig *restrict const);
@@ -226,6 +276,7 @@ static struct Order *coinbase_order_await(void);
 static struct Sample *coinbase_sample_await(void);
 static struct Pricing *coinbase_pricing(const struct Market *restrict const);
 static struct Array *coinbase_markets(void);
+static uintmax_t coinbase_markets_version(void);
 static struct Market *coinbase_market(const struct String *restrict const);
 static struct Market *
 coinbase_market_by_symbol(const struct String *restrict const);
@@ -235,8 +286,11 @@ coinbase_account_by_symbol(const struct String *restrict const);
 static struct Account *coinbase_account(const struct String *restrict const);
 static struct Order *coinbase_order(const struct Market *restrict const,
                                     const struct String *restrict const);
+static struct Array *coinbase_orders(const struct Market *restrict const,
+                                     const struct Numeric *restrict const);
 static bool coinbase_order_cancel(const struct Market *restrict const,
                                   const struct String *restrict const);
+static bool coinbase_orders_cancel(struct Array *restrict const);
 static struct String *coinbase_order_demand(const struct Market *restrict const,
                                             const char *restrict const,
                                             const char *restrict const);
@@ -253,6 +307,7 @@ static void ws_ticker_update(const struct wcjson_document *restrict const,
 static void ws_user_update(const struct wcjson_document *restrict const,
                            const struct wcjson_value *restrict const,
                            const struct Numeric *restrict const);
+static int markets_refresh_func(void *restrict const);
 
 struct Exchange exchange_coinbase = {
     .id = NULL,
@@ -264,24 +319,28 @@ struct Exchange exchange_coinbase = {
     .stop = coinbase_stop,
     .order_await = coinbase_order_await,
     .order_cancel = coinbase_order_cancel,
+    .orders_cancel = coinbase_orders_cancel,
     .sample_await = coinbase_sample_await,
     .pricing = coinbase_pricing,
     .markets = coinbase_markets,
+    .markets_version = coinbase_markets_version,
     .market = coinbase_market,
     .accounts = coinbase_accounts,
     .account = coinbase_account,
     .order = coinbase_order,
+    .orders = coinbase_orders,
     .order_demand = coinbase_order_demand,
     .order_supply = coinbase_order_supply,
 };
 
-static struct ws_channel {
+static const struct ws_channel {
   const char *restrict const name;
   const wchar_t *restrict const items;
   const size_t items_len;
-  uint64_t last_message;
-  bool debug;
-  bool _Atomic reconnect;
+  const bool debug;
+  const bool sharded;
+  const bool dedicated;
+  const bool configured;
   void (*update)(const struct wcjson_document *restrict const,
                  const struct wcjson_value *restrict const,
                  const struct Numeric *restrict const);
@@ -293,9 +352,8 @@ static struct ws_channel {
         .name = "heartbeats",
         .items = NULL,
         .items_len = 0,
-        .last_message = 0,
         .debug = false,
-        .reconnect = false,
+        .sharded = false,
         .update = NULL,
         .snapshot = NULL,
     },
@@ -303,9 +361,8 @@ static struct ws_channel {
         .name = "status",
         .items = L"products",
         .items_len = 8,
-        .last_message = 0,
         .debug = true,
-        .reconnect = false,
+        .sharded = false,
         .update = ws_status_update,
         .snapshot = NULL,
     },
@@ -313,9 +370,8 @@ static struct ws_channel {
         .name = "subscriptions",
         .items = NULL,
         .items_len = 0,
-        .last_message = 0,
         .debug = true,
-        .reconnect = false,
+        .sharded = false,
         .update = NULL,
         .snapshot = NULL,
     },
@@ -323,9 +379,9 @@ static struct ws_channel {
         .name = "ticker",
         .items = L"tickers",
         .items_len = 7,
-        .last_message = 0,
         .debug = false,
-        .reconnect = false,
+        .sharded = true,
+        .configured = true,
         .update = ws_ticker_update,
         .snapshot = NULL,
     },
@@ -333,14 +389,46 @@ static struct ws_channel {
         .name = "user",
         .items = L"orders",
         .items_len = 6,
-        .last_message = 0,
         .debug = true,
-        .reconnect = false,
+        .sharded = false,
+        .dedicated = true,
         .update = ws_user_update,
         .snapshot = NULL,
     },
 };
 
+/*
+ * A websocket connection subscribing a channel. Sharded channels are split
+ * across multiple connections by product id, each connection being polled by
+ * its own worker thread. Dedicated channels get a worker of their own so that
+ * their events never wait behind market data. Configured channels only
+ * subscribe markets traded or exported, the products subscribed being kept
+ * up to date whenever the markets change.
+ */
+struct ws_connection {
+  const struct ws_channel *restrict channel;
+  size_t shard;
+  size_t shards;
+  struct ws_worker *restrict worker;
+  struct Map *restrict products;
+  size_t p_cnt;
+  _Atomic unsigned long c_id;
+  _Atomic uint64_t last_message;
+  _Atomic bool reconnect;
+  _Atomic bool resubscribe;
+};
+
+struct ws_worker {
+  struct mg_mgr *restrict mgr;
+  struct mg_timer *restrict stall_timer;
+  thrd_t thrd;
+};
+
+static struct ws_connection *restrict ws_connections;
+static size_t ws_connections_nitems;
+static struct ws_worker *restrict ws_workers;
+static size_t ws_workers_nitems;
+
 static inline void tls_doc_free(struct wcjson_document *restrict const wc_doc) {
   heap_free(wc_doc->values);
   heap_free(wc_doc->strings);
@@ -355,7 +443,7 @@ static struct coinbase_tls *const coinbase_tls(void) {
     tls = heap_malloc(sizeof(struct coinbase_tls));
     tls->ws_handle_message.ws_doc =
         heap_calloc(1, sizeof(struct wcjson_document));
-    tls->coinbase_markets.rsp_doc =
+    tls->markets_load.rsp_doc =
         heap_calloc(1, sizeof(struct wcjson_document));
     tls->accounts_with_cursor.rsp_doc =
         heap_calloc(1, sizeof(struct wcjson_document));
@@ -363,6 +451,8 @@ static struct coinbase_tls *const coinbase_tls(void) {
         heap_calloc(1, sizeof(struct wcjson_document));
     tls->coinbase_order.rsp_doc =
         heap_calloc(1, sizeof(struct wcjson_document));
+    tls->coinbase_orders.rsp_doc =
+        heap_calloc(1, sizeof(struct wcjson_document));
     tls->coinbase_order_cancel.rsp_doc =
         heap_calloc(1, sizeof(struct wcjson_document));
     tls->coinbase_order_post.rsp_doc =
@@ -378,10 +468,11 @@ static struct coinbase_tls *const coinbase_tls(void) {
 static void coinbase_tls_dtor(void *e) {
   struct coinbase_tls *restrict const tls = e;
   tls_doc_free(tls->ws_handle_message.ws_doc);
-  tls_doc_free(tls->coinbase_markets.rsp_doc);
+  tls_doc_free(tls->markets_load.rsp_doc);
   tls_doc_free(tls->accounts_with_cursor.rsp_doc);
   tls_doc_free(tls->coinbase_account.rsp_doc);
   tls_doc_free(tls->coinbase_order.rsp_doc);
+  tls_doc_free(tls->coinbase_orders.rsp_doc);
   tls_doc_free(tls->coinbase_order_cancel.rsp_doc);
   tls_doc_free(tls->coinbase_order_post.rsp_doc);
   tls_doc_free(tls->coinbase_pricing.rsp_doc);
@@ -421,7 +512,7 @@ static enum account_type account_type(const char *restrict const type) {
   return ACCOUNT_TYPE_UNKNOWN;
 }
 
-static struct ws_channel *ws_channel(const char *restrict const name) {
+static const struct ws_channel *ws_channel(const char *restrict const name) {
   for (size_t i = nitems(ws_channels); i-- > 0;)
     if (!strcmp(ws_channels[i].name, name))
       return &ws_channels[i];
@@ -429,36 +520,243 @@ static struct ws_channel *ws_channel(const char *restrict const name) {
   return NULL;
 }
 
+/*
+ * Wakes up the worker polling a connection. The connection receives a
+ * MG_EV_WAKEUP event so that flags set from other threads are acted upon
+ * immediately instead of on the next poll timeout.
+ */
+static void ws_wakeup(const struct ws_connection *restrict const conn) {
+  if (conn->c_id != 0)
+    mg_wakeup(conn->worker->mgr, conn->c_id, "", 0);
+}
+
+static void ws_reconnect(void) {
+  for (size_t i = ws_connections_nitems; i-- > 0;) {
+    ws_connections[i].reconnect = true;
+    ws_wakeup(&ws_connections[i]);
+  }
+}
+
+static void ws_resubscribe(void) {
+  for (size_t i = ws_connections_nitems; i-- > 0;)
+    if (ws_connections[i].channel->configured) {
+      ws_connections[i].resubscribe = true;
+      ws_wakeup(&ws_connections[i]);
+    }
+}
+
+/*
+ * Requests the product catalogue to get reloaded. When refreshing in the
+ * background, the reload happens there without blocking anyone looking up
+ * markets. Otherwise the next caller of coinbase_markets reloads.
+ */
+static void markets_reload_request(void) {
+  mutex_lock(&markets_mtx);
+  markets_reload = true;
+  condition_signal(&markets_cnd);
+  mutex_unlock(&markets_mtx);
+}
+
+static inline bool
+ws_shard_matches(const struct ws_connection *restrict const c,
+                 const struct String *restrict const sym) {
+  return c->shards < 2 || String_hash(sym) % c->shards == c->shard;
+}
+
+/*
+ * Provides the configuration of a tradeable market, if any.
+ */
+static const struct MarketConfig *
+ws_market_config(const struct Market *restrict const m) {
+  void *const *restrict items;
+
+  if (!m->is_tradeable)
+    return NULL;
+
+  items = Array_items(cnf->m_cnf);
+  for (size_t i = Array_size(cnf->m_cnf); i-- > 0;) {
+    const struct MarketConfig *restrict const m_cnf = items[i];
+
+    if (String_equals(m_cnf->e_nm, exchange_coinbase.nm) &&
+        MarketConfig_matches(m_cnf, m->nm))
+      return m_cnf;
+  }
+
+  return NULL;
+}
+
+/*
+ * Tests a market to bridge one of the quote and reference currency pairs.
+ */
+static bool ws_market_bridges(const struct Market *restrict const m,
+                              const struct Array *restrict const bridges) {
+  void *const *restrict const items = Array_items(bridges);
+
+  for (size_t i = Array_size(bridges); i > 1; i -= 2) {
+    const struct String *restrict const q_id = items[i - 2];
+    const struct String *restrict const r_id = items[i - 1];
+
+    if ((String_equals(m->b_id, q_id) && String_equals(m->q_id, r_id)) ||
+        (String_equals(m->b_id, r_id) && String_equals(m->q_id, q_id)))
+      return true;
+  }
+
+  return false;
+}
+
+/*
+ * Tests a market to be of interest to a connection. Exporting samples needs
+ * the tickers of all markets, trading only those of tradeable markets with a
+ * configuration and of the markets bridging their quote currencies to the
+ * reference currencies.
+ */
+static bool ws_market_matches(const struct ws_connection *restrict const c,
+                              const struct Market *restrict const m,
+                              const struct Array *restrict const bridges) {
+  if (!ws_shard_matches(c, m->sym))
+    return false;
+
+  if (!c->channel->configured || ticker_exporter)
+    return true;
+
+  return ws_market_config(m) != NULL || ws_market_bridges(m, bridges);
+}
+
+/*
+ * Provides the symbols of the products a connection is to subscribe.
+ */
+static struct Array *ws_products(const struct ws_connection *restrict const c) {
+  struct Array *restrict const m_array = coinbase_markets();
+  struct Array *restrict const products = Array_new(Array_size(m_array) + 1);
+  struct Array *restrict const bridges = Array_new(64);
+  void *const *restrict items = Array_items(m_array);
+
+  if (c->channel->configured && !ticker_exporter)
+    for (size_t i = Array_size(m_array); i-- > 0;) {
+      const struct Market *restrict const m = items[i];
+      const struct MarketConfig *restrict const m_cnf = ws_market_config(m);
+
+      if (m_cnf != NULL && !String_equals(m->q_id, m_cnf->r_id)) {
+        Array_add_tail(bridges, m->q_id);
+        Array_add_tail(bridges, m_cnf->r_id);
+      }
+    }
+
+  for (size_t i = Array_size(m_array); i-- > 0;) {
+    const struct Market *restrict const m = items[i];
+
+    if (ws_market_matches(c, m, bridges))
+      Array_add_tail(products, String_copy(m->sym));
+  }
+  Array_unlock(m_array);
+  Array_delete(bridges, NULL);
+
+  return products;
+}
+
+/*
+ * Signed tokens by the uri they have been signed for. A token is handed out
+ * again for CDP_JWT_REUSE_SECONDS, well within its lifetime.
+ */
+struct jwt_entry {
+  char *restrict jwt;
+  size_t len;
+  time_t reuse;
+};
+
+static void jwt_entry_delete(void *restrict const entry) {
+  if (entry == NULL)
+    return;
+
+  struct jwt_entry *restrict const e = entry;
+  heap_free(e->jwt);
+  heap_free(e);
+}
+
+static bool jwt_cached(char *restrict const jwt, size_t *restrict jwt_lenp,
+                       const struct String *restrict const key,
+                       const time_t now) {
+  bool found = false;
+
+  Map_lock(jwts);
+  const struct jwt_entry *restrict const e = Map_get(jwts, key);
+
+  if (e != NULL && now < e->reuse && e->len < *jwt_lenp) {
+    memcpy(jwt, e->jwt, e->len + 1);
+    *jwt_lenp = e->len;
+    found = true;
+  }
+
+  Map_unlock(jwts);
+  return found;
+}
+
+static void jwt_cache(const char *restrict const jwt, const size_t jwt_len,
+                      struct String *restrict const key,
+                      const time_t now) {
+  struct jwt_entry *restrict const e = heap_malloc(sizeof(struct jwt_entry));
+
+  e->jwt = heap_malloc(jwt_len + 1);
+  memcpy(e->jwt, jwt, jwt_len);
+  e->jwt[jwt_len] = '\0';
+  e->len = jwt_len;
+  e->reuse = now + (time_t)coinbase_jwt_reuse_s;
+
+  Map_lock(jwts);
+  jwt_entry_delete(Map_put(jwts, key, e));
+
+  // Uris carrying order ids are signed once, so expired tokens are dropped
+  // every reuse interval to keep the cache from growing without bounds.
+  if (now >= jwts_sweep) {
+    struct MapIterator *restrict const it = MapIterator_new(jwts);
+
+    while (MapIterator_next(it))
+      if (now >= ((const struct jwt_entry *)MapIterator_value(it))->reuse)
+        jwt_entry_delete(MapIterator_remove(it));
+
+    MapIterator_delete(it);
+    jwts_sweep = now + (time_t)coinbase_jwt_reuse_s;
+  }
+
+  Map_unlock(jwts);
+}
+
 static int jwt_encode_cdp(char *restrict const jwt, size_t *restrict jwt_lenp,
                           const char *restrict const uri) {
-  int r;
-  uint8_t ec_key[32];
+  int r = -1;
   char claims[JSON_BODY_MAX + 1] = {0};
-  const struct mg_str cnf_key = mg_str(String_chars(coinbase_cnf->jwt_key));
-  const size_t key_len =
-      mg_uecc_parse_private_key(cnf_key, ec_key, sizeof(ec_key));
+  struct String *restrict key = NULL;
 
-  if (key_len == 0) {
+  if (coinbase_ec_key_len == 0) {
     werr("%s: cdp-api-key: Unsupported private key\n", coinbase_rest_uri);
     return -1;
   }
 
   const time_t now = time(NULL);
 
+  if (coinbase_jwt_reuse_s > 0) {
+    key = String_cnew(uri != NULL ? uri : "");
+
+    if (jwt_cached(jwt, jwt_lenp, key, now)) {
+      r = 0;
+      goto ret;
+    }
+  }
+
   if (uri) {
     r = snprintf(
         claims, sizeof(claims),
         "{\"iss\":\"cdp\",\"sub\":\"%s\",\"uri\":\"%s\",\"nbf\":%" PRIdMAX
         ",\"exp\":%" PRIdMAX "}",
         String_chars(coinbase_cnf->jwt_kid), uri, (intmax_t)now - 1,
-        (intmax_t)now + 120);
+        (intmax_t)now + JWT_LIFETIME_SECONDS);
 
   } else {
     r = snprintf(claims, sizeof(claims),
                  "{\"iss\":\"cdp\",\"sub\":\"%s\",\"nbf\":%" PRIdMAX
                  ",\"exp\":%" PRIdMAX "}",
                  String_chars(coinbase_cnf->jwt_kid), (intmax_t)now - 1,
-                 (intmax_t)now + 120);
+                 (intmax_t)now + JWT_LIFETIME_SECONDS);
   }
 
   if (r < 0 || (size_t)r >= sizeof(claims))
@@ -466,29 +764,124 @@ static int jwt_encode_cdp(char *restrict const jwt, size_t *restrict jwt_lenp,
 
   struct mg_jwt_opts jwt_opts = {0};
   jwt_opts.claims = mg_str(claims);
-  jwt_opts.private_key = ec_key;
+  jwt_opts.private_key = coinbase_ec_key;
   jwt_opts.kid = mg_str(String_chars(coinbase_cnf->jwt_kid));
 
   const size_t jwt_len = mg_jwt_sign_es256(&jwt_opts, jwt, *jwt_lenp);
 
-  if (jwt_len == 0)
-    goto err_range;
+  if (jwt_len == 0) {
+    errno = ERANGE;
+    goto ret;
+  }
+
+  if (key != NULL)
+    jwt_cache(jwt, jwt_len, key, now);
 
   *jwt_lenp = jwt_len;
-  return 0;
-err_range:
-  errno = ERANGE;
-  return -1;
+  r = 0;
+ret:
+  String_delete(key);
+  return r;
+}
+
+static void ws_evt_handler(struct mg_connection *, int, void *);
+static void ws_handle_message(struct ws_connection *restrict const,
+                              const struct mg_ws_message *restrict const);
+
+static void ws_connect_timer(void *restrict const arg) {
+  struct ws_connection *restrict const conn = arg;
+
+  if (!running)
+    return;
+
+  struct mg_connection *restrict const c =
+      mg_ws_connect(conn->worker->mgr, coinbase_ws_uri, ws_evt_handler, conn,
+                    "User-Agent: Abagnale; %s\r\n", ABAG_REVISION);
+
+  if (c == NULL) {
+    werr("%s: %s: Failure reconnecting\n", coinbase_ws_uri,
+         conn->channel->name);
+
+    mg_timer_add(conn->worker->mgr, coinbase_retry_rate.tv_sec * 1000UL,
+                 MG_TIMER_ONCE, ws_connect_timer, conn);
+
+    return;
+  }
+
+  conn->c_id = c->id;
+  conn->last_message = mg_millis();
+  conn->reconnect = false;
+}
+
+/*
+ * Checks the connections of a worker for stalls and re-arms itself to expire
+ * when the next connection would stall.
+ */
+static void ws_stall_timer(void *restrict const arg) {
+  struct ws_worker *restrict const w = arg;
+  const uint64_t now = mg_millis();
+  uint64_t next = now + coinbase_stall_ms;
+
+  for (size_t i = ws_connections_nitems; i-- > 0;) {
+    struct ws_connection *restrict const conn = &ws_connections[i];
+
+    if (conn->worker != w || !conn->last_message)
+      continue;
+
+    // Connections without products only receive heartbeats.
+    if (conn->channel->configured && conn->products != NULL &&
+        conn->p_cnt == 0) {
+      conn->last_message = now;
+      continue;
+    }
+
+    if (now - conn->last_message > coinbase_stall_ms) {
+      conn->reconnect = true;
+      conn->last_message = now;
+      ws_wakeup(conn);
+
+      if (verbose)
+        wout("%s: %s: No events\n", coinbase_ws_uri, conn->channel->name);
+    }
+
+    if (conn->last_message + coinbase_stall_ms + 1 < next)
+      next = conn->last_message + coinbase_stall_ms + 1;
+  }
+
+  w->stall_timer->expire = next;
 }
 
 static int mg_mgr_worker_func(void *restrict const arg) {
-  struct mg_mgr *restrict const mgr = arg;
+  struct ws_worker *restrict const w = arg;
 
   while (running)
-    mg_mgr_poll(mgr, coinbase_stall_ms / 4);
+    mg_mgr_poll(w->mgr, mg_mgr_timeout(w->mgr, coinbase_stall_ms / 4));
+
+  thread_exit(EXIT_SUCCESS);
+}
+
+static void ws_replay_message(const char *restrict const data,
+                              const size_t len, void *restrict const arg) {
+  struct mg_ws_message wm = {0};
+  wm.data = mg_str_n(data, len);
+  wm.flags = WEBSOCKET_OP_TEXT;
+  ws_handle_message(arg, &wm);
+}
+
+/*
+ * Feeds captured frames to the message handler instead of connecting to the
+ * exchange.
+ */
+static int ws_replay_func(void *restrict const arg) {
+  struct ws_connection conn = {0};
+  conn.last_message = mg_millis();
+
+  Capture_replay(coinbase_ws_replay, coinbase_ws_replay_speed, &running,
+                 ws_replay_message, &conn);
+
+  if (verbose && running)
+    wout("%s: Replay finished\n", coinbase_ws_replay_path);
 
-  mg_mgr_free(mgr);
-  heap_free(mgr);
   thread_exit(EXIT_SUCCESS);
 }
 
@@ -513,8 +906,7 @@ static void ws_ticker_update(const struct wcjson_document *restrict const doc,
   m = coinbase_market_by_symbol(j_product_id);
 
   if (m == NULL) {
-    for (size_t i = nitems(ws_channels); i-- > 0;)
-      ws_channels[i].reconnect = true;
+    markets_reload_request();
     goto ret;
   }
 
@@ -548,11 +940,67 @@ ret:
   errno = saved_errno;
 }
 
+/*
+ * Applies a status update to the market it refers to. The status channel only
+ * provides a subset of a product's attributes. Markets going offline are
+ * deactivated in place. Markets coming back online and products not known yet
+ * are left to a reload of the product catalogue.
+ */
 static void ws_status_update(const struct wcjson_document *restrict const doc,
                              const struct wcjson_value *restrict const product,
                              const struct Numeric *restrict const nanos) {
-  for (size_t i = nitems(ws_channels); i-- > 0;)
-    ws_channels[i].reconnect = true;
+  const int saved_errno = errno;
+  bool reload = false;
+  (void)nanos;
+
+  errno = 0;
+
+  struct String *restrict const j_id =
+      json_obj_get_optional_string(doc, product, L"id", 2);
+
+  struct String *restrict const j_status =
+      json_obj_get_optional_string(doc, product, L"status", 6);
+
+  if (errno || j_id == NULL || j_status == NULL)
+    goto ret;
+
+  const enum market_status status = market_status(String_chars(j_status));
+
+  Array_lock(markets);
+
+  struct Market *restrict const m = Map_get(markets_by_symbol, j_id);
+
+  if (m == NULL)
+    reload = true;
+  else if (m->status != status) {
+#ifdef ABAG_COINBASE_DEBUG
+    wout("%s: status: %s: %s\n", coinbase_ws_uri, String_chars(m->nm),
+         String_chars(j_status));
+#endif
+    m->status = status;
+
+    if (status == MARKET_STATUS_ONLINE)
+      reload = true;
+    else
+      m->is_active = false;
+
+    markets_version++;
+  }
+
+  Array_unlock(markets);
+
+  if (reload)
+    markets_reload_request();
+
+  errno = 0;
+ret:
+  String_delete(j_id);
+  String_delete(j_status);
+
+  if (errno)
+    werr("%s: status: %s\n", coinbase_ws_uri, strerror(errno));
+
+  errno = saved_errno;
 }
 
 static void ws_user_update(const struct wcjson_document *restrict const doc,
@@ -630,9 +1078,7 @@ static void ws_user_update(const struct wcjson_document *restrict const doc,
     werr("%s: user: Market not available: %s %s\n", coinbase_ws_uri,
          String_chars(j_order_id), String_chars(j_product_id));
 
-    for (size_t i = nitems(ws_channels); i-- > 0;)
-      ws_channels[i].reconnect = true;
-
+    markets_reload_request();
     goto ret;
   }
 
@@ -696,7 +1142,8 @@ ret:
   errno = saved_errno;
 }
 
-static void ws_handle_message(const struct mg_ws_message *restrict const msg) {
+static void ws_handle_message(struct ws_connection *restrict const conn,
+                              const struct mg_ws_message *restrict const msg) {
   const struct coinbase_tls *restrict const tls = coinbase_tls();
   struct wcjson_document *restrict ws_doc = tls->ws_handle_message.ws_doc;
   const int saved_errno = errno;
@@ -729,7 +1176,7 @@ static void ws_handle_message(const struct mg_ws_message *restrict const msg) {
   if (j_channel == NULL)
     goto ret;
 
-  struct ws_channel *restrict const channel =
+  const struct ws_channel *restrict const channel =
       ws_channel(String_chars(j_channel));
 
   if (channel == NULL) {
@@ -790,7 +1237,7 @@ static void ws_handle_message(const struct mg_ws_message *restrict const msg) {
       goto ret;
     }
 
-    channel->last_message = mg_millis();
+    conn->last_message = mg_millis();
 
     if (String_length(j_evt_type) == 6 &&
         !strcmp("update", String_chars(j_evt_type))) {
@@ -827,60 +1274,137 @@ ret:
   errno = saved_errno;
 }
 
-static void ws_subscribe(struct mg_connection *restrict const c,
-                         const struct ws_channel *restrict const channel) {
+/*
+ * Sends a subscribe or unsubscribe message for the products of a connection.
+ */
+static int ws_products_send(struct mg_connection *restrict const c,
+                            const struct ws_connection *restrict const conn,
+                            const wchar_t *restrict const type,
+                            const size_t type_len,
+                            const struct Array *restrict const products) {
+  const struct ws_channel *restrict const channel = conn->channel;
   void *const *restrict items;
   char jwt[JSON_BODY_MAX + 1] = {0};
   size_t jwt_len = nitems(jwt);
   const int saved_errno = errno;
+  int ret = -1;
   struct wcjson wc_json = WCJSON_INITIALIZER;
-  struct wcjson_document hb_doc = WCJSON_DOCUMENT_INITIALIZER;
   struct wcjson_document ch_doc = WCJSON_DOCUMENT_INITIALIZER;
-  struct Array *restrict const m_array = coinbase_markets();
 
-  hb_doc.v_nitems = 16;
   ch_doc.v_nitems = 16;
 
-  if (ch_doc.v_nitems > SIZE_MAX - Array_size(m_array))
+  if (ch_doc.v_nitems > SIZE_MAX - Array_size(products))
     panic();
 
-  hb_doc.values = heap_reallocarray(hb_doc.values, hb_doc.v_nitems,
-                                    sizeof(struct wcjson_value));
-
-  ch_doc.v_nitems += Array_size(m_array);
+  ch_doc.v_nitems += Array_size(products);
   ch_doc.values = heap_reallocarray(ch_doc.values, ch_doc.v_nitems,
                                     sizeof(struct wcjson_value));
 
   errno = 0;
 
-  struct wcjson_value *restrict const j_hb_msg = wcjson_value_object(&hb_doc);
   struct wcjson_value *restrict const j_ch_msg = wcjson_value_object(&ch_doc);
   struct wcjson_value *restrict const j_ch_arr = wcjson_value_array(&ch_doc);
 
-  if (errno) {
-    Array_unlock(m_array);
+  if (errno)
     goto ret;
-  }
 
-  items = Array_items(m_array);
-  for (size_t i = Array_size(m_array); i-- > 0;) {
-    const struct Market *restrict const m = items[i];
-    wcjson_array_add_tail(&ch_doc, j_ch_arr,
-                          wcjson_value_mbstring(&ch_doc, String_chars(m->sym),
-                                                String_length(m->sym)));
+  items = Array_items(products);
+  for (size_t i = Array_size(products); i-- > 0;)
+    wcjson_array_add_tail(
+        &ch_doc, j_ch_arr,
+        wcjson_value_mbstring(&ch_doc, String_chars(items[i]),
+                              String_length(items[i])));
+
+  wcjson_object_add_tail(&ch_doc, j_ch_msg, L"type", 4,
+                         wcjson_value_string(&ch_doc, type, type_len));
+
+  wcjson_object_add_tail(&ch_doc, j_ch_msg, L"product_ids", 11, j_ch_arr);
+
+  if (errno || jwt_encode_cdp(jwt, &jwt_len, NULL) < 0)
+    goto ret;
+
+  errno = 0;
+
+  wcjson_object_add_tail(&ch_doc, j_ch_msg, L"jwt", 3,
+                         wcjson_value_mbstring(&ch_doc, jwt, strlen(jwt)));
+
+  wcjson_object_add_tail(
+      &ch_doc, j_ch_msg, L"channel", 7,
+      wcjson_value_mbstring(&ch_doc, channel->name, strlen(channel->name)));
+
+  if (wcjson_document_build(&wc_json, &ch_doc) < 0) {
+    werr("%s: %s: %ls: %s\n", coinbase_ws_uri, channel->name, type,
+         json_mbserror(&wc_json));
+    goto ret;
   }
-  Array_unlock(m_array);
+
+  char ch_body[JSON_BODY_MAX + 1] = {0};
+  size_t ch_len = sizeof(ch_body);
+
+  json_mbsprint(ch_body, &ch_len, &ch_doc, ch_doc.values);
 
   if (errno)
     goto ret;
 
-  wcjson_object_add_tail(&hb_doc, j_hb_msg, L"type", 4,
-                         wcjson_value_string(&hb_doc, L"subscribe", 9));
+  if (!mg_ws_send(c, ch_body, ch_len, WEBSOCKET_OP_TEXT))
+    goto ret;
 
-  wcjson_object_add_tail(&ch_doc, j_ch_msg, L"type", 4,
-                         wcjson_value_string(&ch_doc, L"subscribe", 9));
+  errno = 0;
+  ret = 0;
+ret:
+  heap_free(ch_doc.values);
+  heap_free(ch_doc.strings);
+  heap_free(ch_doc.mbstrings);
+  heap_free(ch_doc.esc);
 
-  wcjson_object_add_tail(&ch_doc, j_ch_msg, L"product_ids", 11, j_ch_arr);
+  if (errno)
+    werr("%s: %s: %ls: %s\n", coinbase_ws_uri, channel->name, type,
+         strerror(errno));
+
+  errno = saved_errno;
+  return ret;
+}
+
+static void ws_products_reset(struct ws_connection *restrict const conn,
+                              const struct Array *restrict const products) {
+  void *const *restrict const items = Array_items(products);
+
+  if (conn->products != NULL)
+    Map_delete(conn->products, String_delete);
+
+  conn->products = Map_new(StringMapOps, Array_size(products) + 1);
+  conn->p_cnt = Array_size(products);
+
+  for (size_t i = Array_size(products); i-- > 0;)
+    Map_put(conn->products, items[i], String_copy(items[i]));
+}
+
+static void ws_subscribe(struct mg_connection *restrict const c,
+                         struct ws_connection *restrict const conn) {
+  const struct ws_channel *restrict const channel = conn->channel;
+  char jwt[JSON_BODY_MAX + 1] = {0};
+  size_t jwt_len = nitems(jwt);
+  const int saved_errno = errno;
+  struct wcjson wc_json = WCJSON_INITIALIZER;
+  struct wcjson_document hb_doc = WCJSON_DOCUMENT_INITIALIZER;
+  struct Array *restrict const products = ws_products(conn);
+
+  ws_products_reset(conn, products);
+
+  // Nothing to subscribe to on this shard.
+  if (channel->sharded && !channel->configured && Array_size(products) == 0)
+    goto ret;
+
+  hb_doc.v_nitems = 16;
+  hb_doc.values = heap_reallocarray(hb_doc.values, hb_doc.v_nitems,
+                                    sizeof(struct wcjson_value));
+
+  errno = 0;
+
+  struct wcjson_value *restrict const j_hb_msg = wcjson_value_object(&hb_doc);
+
+  wcjson_object_add_tail(&hb_doc, j_hb_msg, L"type", 4,
+                         wcjson_value_string(&hb_doc, L"subscribe", 9));
 
   if (errno || jwt_encode_cdp(jwt, &jwt_len, NULL) < 0)
     goto ret;
@@ -893,45 +1417,37 @@ static void ws_subscribe(struct mg_connection *restrict const c,
   wcjson_object_add_tail(&hb_doc, j_hb_msg, L"channel", 7,
                          wcjson_value_string(&hb_doc, L"heartbeats", 10));
 
-  wcjson_object_add_tail(&ch_doc, j_ch_msg, L"jwt", 3,
-                         wcjson_value_mbstring(&ch_doc, jwt, strlen(jwt)));
-
-  wcjson_object_add_tail(
-      &ch_doc, j_ch_msg, L"channel", 7,
-      wcjson_value_mbstring(&ch_doc, channel->name, strlen(channel->name)));
-
-  if (wcjson_document_build(&wc_json, &ch_doc) < 0 ||
-      wcjson_document_build(&wc_json, &hb_doc) < 0) {
+  if (wcjson_document_build(&wc_json, &hb_doc) < 0) {
     werr("%s: %s: subscribe: %s\n", coinbase_ws_uri, channel->name,
          json_mbserror(&wc_json));
     goto ret;
   }
 
   char hb_body[JSON_BODY_MAX + 1] = {0};
-  char ch_body[JSON_BODY_MAX + 1] = {0};
   size_t hb_len = sizeof(hb_body);
-  size_t ch_len = sizeof(ch_body);
 
   json_mbsprint(hb_body, &hb_len, &hb_doc, hb_doc.values);
-  json_mbsprint(ch_body, &ch_len, &ch_doc, ch_doc.values);
 
   if (errno)
     goto ret;
 
-  if (!mg_ws_send(c, hb_body, hb_len, WEBSOCKET_OP_TEXT) ||
-      !mg_ws_send(c, ch_body, ch_len, WEBSOCKET_OP_TEXT))
+  if (!mg_ws_send(c, hb_body, hb_len, WEBSOCKET_OP_TEXT))
     goto ret;
 
+  /*
+   * Configured channels without any products keep the connection open
+   * subscribing heartbeats only, so that products can be subscribed later.
+   */
+  if (!channel->sharded || Array_size(products) > 0)
+    ws_products_send(c, conn, L"subscribe", 9, products);
+
   errno = 0;
 ret:
   heap_free(hb_doc.values);
   heap_free(hb_doc.strings);
   heap_free(hb_doc.mbstrings);
   heap_free(hb_doc.esc);
-  heap_free(ch_doc.values);
-  heap_free(ch_doc.strings);
-  heap_free(ch_doc.mbstrings);
-  heap_free(ch_doc.esc);
+  Array_delete(products, String_delete);
 
   if (errno)
     werr("%s: %s: subscribe: %s\n", coinbase_ws_uri, channel->name,
@@ -940,8 +1456,54 @@ ret:
   errno = saved_errno;
 }
 
+/*
+ * Subscribes the products of a connection not subscribed yet and unsubscribes
+ * the products no longer of interest.
+ */
+static void ws_products_update(struct mg_connection *restrict const c,
+                               struct ws_connection *restrict const conn) {
+  if (conn->products == NULL)
+    return;
+
+  struct Array *restrict const products = ws_products(conn);
+  struct Array *restrict const added = Array_new(Array_size(products) + 1);
+  struct Array *restrict const removed = Array_new(conn->p_cnt + 1);
+  void *const *restrict items = Array_items(products);
+  struct Map *restrict const current = conn->products;
+
+  for (size_t i = Array_size(products); i-- > 0;)
+    if (!Map_exists(current, items[i]))
+      Array_add_tail(added, items[i]);
+
+  conn->products = NULL;
+  ws_products_reset(conn, products);
+
+  struct MapIterator *restrict const it = MapIterator_new(current);
+  while (MapIterator_next(it))
+    if (!Map_exists(conn->products, MapIterator_key(it)))
+      Array_add_tail(removed, Map_get(current, MapIterator_key(it)));
+  MapIterator_delete(it);
+
+  if (verbose && (Array_size(added) > 0 || Array_size(removed) > 0))
+    wout("%s: %s: Products: %zu subscribed, %zu unsubscribed\n",
+         coinbase_ws_uri, conn->channel->name, Array_size(added),
+         Array_size(removed));
+
+  if (Array_size(removed) > 0)
+    ws_products_send(c, conn, L"unsubscribe", 11, removed);
+
+  if (Array_size(added) > 0)
+    ws_products_send(c, conn, L"subscribe", 9, added);
+
+  Array_delete(added, NULL);
+  Array_delete(removed, NULL);
+  Array_delete(products, String_delete);
+  Map_delete(current, String_delete);
+}
+
 static void ws_evt_handler(struct mg_connection *c, int ev, void *ev_data) {
-  struct ws_channel *restrict const channel = c->fn_data;
+  struct ws_connection *restrict const conn = c->fn_data;
+  const struct ws_channel *restrict const channel = conn->channel;
 
   switch (ev) {
   case MG_EV_CONNECT: {
@@ -965,9 +1527,9 @@ static void ws_evt_handler(struct mg_connection *c, int ev, void *ev_data) {
     wout("%s: %s: %lu MG_EV_WS_OPEN\n", coinbase_ws_uri, channel->name, c->id);
 #endif
     if (running) {
-      markets_reload = true;
+      markets_reload_request();
       accounts_reload = true;
-      ws_subscribe(c, channel);
+      ws_subscribe(c, conn);
     } else
       c->is_closing = 1;
 
@@ -979,7 +1541,11 @@ static void ws_evt_handler(struct mg_connection *c, int ev, void *ev_data) {
 
     if (running) {
       if (type == WEBSOCKET_OP_TEXT) {
-        ws_handle_message(wm);
+        if (coinbase_ws_capture != NULL)
+          Capture_write(coinbase_ws_capture, capture_nanos(), wm->data.buf,
+                        wm->data.len);
+
+        ws_handle_message(conn, wm);
       } else if (type == WEBSOCKET_OP_CLOSE) {
 #ifdef ABAG_COINBASE_DEBUG
         wout("%s: %s: %lu WEBSOCKET_OP_CLOSE\n", coinbase_ws_uri, channel->name,
@@ -999,35 +1565,22 @@ static void ws_evt_handler(struct mg_connection *c, int ev, void *ev_data) {
 #ifdef ABAG_COINBASE_DEBUG
     wout("%s: %s: %lu MG_EV_CLOSE\n", coinbase_ws_uri, channel->name, c->id);
 #endif
-    if (running) {
-      struct mg_mgr *restrict const mgr = c->mgr;
-
-      do {
-        thread_sleep(&coinbase_retry_rate);
-        c = mg_ws_connect(mgr, coinbase_ws_uri, ws_evt_handler, channel,
-                          "User-Agent: Abagnale; %s\r\n", ABAG_REVISION);
+    conn->c_id = 0;
 
-        if (!c)
-          werr("%s: %s: Failure reconnecting\n", coinbase_ws_uri,
-               channel->name);
+    if (running)
+      mg_timer_add(c->mgr, coinbase_retry_rate.tv_sec * 1000UL, MG_TIMER_ONCE,
+                   ws_connect_timer, conn);
 
-      } while (!c);
-    }
     break;
   }
   }
 
-  if (channel->last_message &&
-      mg_millis() - channel->last_message > coinbase_stall_ms) {
-    channel->reconnect = true;
-    channel->last_message = mg_millis();
-    if (verbose)
-      wout("%s: %s: No events\n", coinbase_ws_uri, channel->name);
-  }
-
-  if (channel->reconnect) {
-    channel->reconnect = false;
+  if (conn->reconnect) {
+    conn->reconnect = false;
     c->is_closing = 1;
+  } else if (conn->resubscribe && !c->is_closing && running) {
+    conn->resubscribe = false;
+    ws_products_update(c, conn);
   }
 }
 
@@ -1135,6 +1688,29 @@ static void coinbase_init(void) {
   coinbase_stall_ms =
       envul("CDP_HTTP_STALL_MILLIS", DEFAULT_CDP_HTTP_STALL_MILLIS);
 
+  coinbase_markets_reload_s =
+      envul("CDP_MARKETS_RELOAD_SECONDS", DEFAULT_CDP_MARKETS_RELOAD_SECONDS);
+
+  if (coinbase_markets_reload_s == 0)
+    fatal("%s == 0", "CDP_MARKETS_RELOAD_SECONDS");
+
+  coinbase_ws_ticker_connections =
+      envul("CDP_WS_TICKER_CONNECTIONS", DEFAULT_CDP_WS_TICKER_CONNECTIONS);
+
+  if (coinbase_ws_ticker_connections == 0)
+    fatal("%s == 0", "CDP_WS_TICKER_CONNECTIONS");
+
+  coinbase_jwt_reuse_s =
+      envul("CDP_JWT_REUSE_SECONDS", DEFAULT_CDP_JWT_REUSE_SECONDS);
+
+  if (coinbase_jwt_reuse_s >= JWT_LIFETIME_SECONDS)
+    fatal("%s >= %d", "CDP_JWT_REUSE_SECONDS", JWT_LIFETIME_SECONDS);
+
+  coinbase_ws_capture_path = envs("CDP_WS_CAPTURE", DEFAULT_CDP_WS_CAPTURE);
+  coinbase_ws_replay_path = envs("CDP_WS_REPLAY", DEFAULT_CDP_WS_REPLAY);
+  coinbase_ws_replay_speed =
+      envul("CDP_WS_REPLAY_SPEED", DEFAULT_CDP_WS_REPLAY_SPEED);
+
   if (verbose) {
     wout("\tCDP_REST_URI=%s\n", coinbase_rest_uri);
     wout("\tCDP_WS_URI=%s\n", coinbase_ws_uri);
@@ -1148,6 +1724,12 @@ static void coinbase_init(void) {
     wout("\tCDP_HTTP_REQUESTS_PER_SECOND=%lu\n", req_s);
     wout("\tCDP_HTTP_RETRY_SECONDS=%lu\n", ret_s);
     wout("\tCDP_HTTP_STALL_MILLIS=%lu\n", coinbase_stall_ms);
+    wout("\tCDP_MARKETS_RELOAD_SECONDS=%lu\n", coinbase_markets_reload_s);
+    wout("\tCDP_WS_TICKER_CONNECTIONS=%lu\n", coinbase_ws_ticker_connections);
+    wout("\tCDP_JWT_REUSE_SECONDS=%lu\n", coinbase_jwt_reuse_s);
+    wout("\tCDP_WS_CAPTURE=%s\n", coinbase_ws_capture_path);
+    wout("\tCDP_WS_REPLAY=%s\n", coinbase_ws_replay_path);
+    wout("\tCDP_WS_REPLAY_SPEED=%lu\n", coinbase_ws_replay_speed);
   }
 
   running = false;
@@ -1162,6 +1744,10 @@ static void coinbase_init(void) {
   markets_by_symbol = Map_new(StringMapOps, 1024);
 
   markets_reload = true;
+  markets_refreshing = false;
+  mutex_init(&markets_mtx);
+  condition_init(&markets_cnd);
+  mutex_init(&markets_load_mtx);
   accounts = Array_new(256);
   accounts_by_id = Map_new(StringMapOps, 256);
   accounts_by_symbol = Map_new(StringMapOps, 256);
@@ -1169,11 +1755,19 @@ static void coinbase_init(void) {
   accounts_reload = true;
   pricing = NULL;
   mutex_init(&pricing_mutex);
+  jwts = Map_new(StringMapOps, 64);
+  coinbase_ec_key_len = 0;
   tls_create(&coinbase_tls_key, coinbase_tls_dtor);
 }
 
 static void coinbase_configure(const struct ExchangeConfig *restrict const c) {
   coinbase_cnf = c;
+
+  if (c->jwt_key != NULL)
+    coinbase_ec_key_len =
+        mg_uecc_parse_private_key(mg_str(String_chars(c->jwt_key)),
+                                  coinbase_ec_key, sizeof(coinbase_ec_key));
+
   coinbase_db = db_connect(COINBASE_DBCON);
 }
 
@@ -1182,6 +1776,8 @@ static void coinbase_destroy(void) {
     db_disconnect(coinbase_db);
 
   coinbase_cnf = NULL;
+  memset(coinbase_ec_key, 0, sizeof(coinbase_ec_key));
+  coinbase_ec_key_len = 0;
   String_delete(exchange_coinbase.id);
   String_delete(exchange_coinbase.nm);
   String_delete(coinbase_authorization);
@@ -1190,45 +1786,154 @@ static void coinbase_destroy(void) {
   Array_delete(markets, Market_delete);
   Map_delete(markets_by_id, NULL);
   Map_delete(markets_by_symbol, NULL);
+  mutex_destroy(&markets_mtx);
+  condition_destroy(&markets_cnd);
+  mutex_destroy(&markets_load_mtx);
   Array_delete(accounts, Account_delete);
   Map_delete(accounts_by_id, NULL);
   Map_delete(accounts_by_symbol, NULL);
   Pricing_delete(pricing);
   mutex_destroy(&pricing_mutex);
+  Map_delete(jwts, jwt_entry_delete);
   tls_delete(coinbase_tls_key);
 }
 
 static void coinbase_start(void) {
-  struct mg_mgr *restrict const mgr = heap_calloc(1, sizeof(struct mg_mgr));
-  mg_mgr_init(mgr);
-  mg_mgr_config(mgr);
+  size_t c_idx = 0;
+  size_t w_idx = coinbase_ws_ticker_connections;
+
+  if (*coinbase_ws_replay_path) {
+    coinbase_ws_replay = Capture_new(coinbase_ws_replay_path, false);
+
+    Queue_start(orders);
+    Queue_start(samples);
+
+    running = true;
+    thread_create(&coinbase_ws_replay_thrd, ws_replay_func, NULL);
+    return;
+  }
+
+  if (*coinbase_ws_capture_path)
+    coinbase_ws_capture = Capture_new(coinbase_ws_capture_path, true);
+
+  /*
+   * Unsharded channels share the first worker with the first shard of every
+   * sharded channel. Each additional shard and each dedicated channel gets a
+   * worker of its own.
+   */
+  ws_workers_nitems = coinbase_ws_ticker_connections;
+  for (size_t i = nitems(ws_channels); i-- > 0;)
+    if (ws_channels[i].items != NULL && ws_channels[i].dedicated)
+      ws_workers_nitems++;
+
+  ws_workers = heap_calloc(ws_workers_nitems, sizeof(struct ws_worker));
+
+  for (size_t i = ws_workers_nitems; i-- > 0;) {
+    ws_workers[i].mgr = heap_calloc(1, sizeof(struct mg_mgr));
+    mg_mgr_init(ws_workers[i].mgr);
+    mg_mgr_config(ws_workers[i].mgr);
+
+    if (!mg_wakeup_init(ws_workers[i].mgr))
+      fatal("%s: Failure initializing websocket wakeup\n", coinbase_ws_uri);
+
+    ws_workers[i].stall_timer =
+        mg_timer_add(ws_workers[i].mgr, coinbase_stall_ms, MG_TIMER_REPEAT,
+                     ws_stall_timer, &ws_workers[i]);
+  }
+
+  ws_connections_nitems = 0;
+  for (size_t i = nitems(ws_channels); i-- > 0;)
+    if (ws_channels[i].items != NULL)
+      ws_connections_nitems +=
+          ws_channels[i].sharded ? coinbase_ws_ticker_connections : 1;
+
+  ws_connections =
+      heap_calloc(ws_connections_nitems, sizeof(struct ws_connection));
+
+  for (size_t i = nitems(ws_channels); i-- > 0;) {
+    if (ws_channels[i].items == NULL)
+      continue;
+
+    const size_t shards =
+        ws_channels[i].sharded ? coinbase_ws_ticker_connections : 1;
+
+    for (size_t j = 0; j < shards; j++, c_idx++) {
+      ws_connections[c_idx].channel = &ws_channels[i];
+      ws_connections[c_idx].shard = j;
+      ws_connections[c_idx].shards = shards;
+      ws_connections[c_idx].worker =
+          ws_channels[i].dedicated ? &ws_workers[w_idx++] : &ws_workers[j];
+      ws_connections[c_idx].last_message = mg_millis();
+      ws_connections[c_idx].reconnect = false;
+    }
+  }
 
   Queue_start(orders);
   Queue_start(samples);
 
   running = true;
-  for (size_t i = nitems(ws_channels); i-- > 0;) {
-    if (ws_channels[i].items != NULL) {
-      struct mg_connection *restrict const c =
-          mg_ws_connect(mgr, coinbase_ws_uri, ws_evt_handler, &ws_channels[i],
-                        "User-Agent: Abagnale; %s\r\n", ABAG_REVISION);
+  for (size_t i = ws_connections_nitems; i-- > 0;) {
+    struct mg_connection *restrict const c = mg_ws_connect(
+        ws_connections[i].worker->mgr, coinbase_ws_uri, ws_evt_handler,
+        &ws_connections[i], "User-Agent: Abagnale; %s\r\n", ABAG_REVISION);
 
-      ws_channels[i].last_message = mg_millis();
+    if (!c)
+      fatal("%s: %s: Failure starting websocket\n", coinbase_ws_uri,
+            ws_connections[i].channel->name);
 
-      if (!c)
-        fatal("%s: %s: Failure starting websocket\n", coinbase_ws_uri,
-              ws_channels[i].name);
-    }
+    ws_connections[i].c_id = c->id;
   }
 
-  thread_create(&mg_mgr_worker, mg_mgr_worker_func, mgr);
+  for (size_t i = ws_workers_nitems; i-- > 0;)
+    thread_create(&ws_workers[i].thrd, mg_mgr_worker_func, &ws_workers[i]);
+
+  markets_refreshing = true;
+  thread_create(&markets_thrd, markets_refresh_func, NULL);
 }
 
 static void coinbase_stop(void) {
   running = false;
   Queue_stop(orders);
   Queue_stop(samples);
-  thread_join(mg_mgr_worker, NULL);
+
+  if (coinbase_ws_replay != NULL) {
+    thread_join(coinbase_ws_replay_thrd, NULL);
+    Capture_delete(coinbase_ws_replay);
+    coinbase_ws_replay = NULL;
+    return;
+  }
+
+  mutex_lock(&markets_mtx);
+  condition_broadcast(&markets_cnd);
+  mutex_unlock(&markets_mtx);
+  thread_join(markets_thrd, NULL);
+  markets_refreshing = false;
+
+  for (size_t i = ws_connections_nitems; i-- > 0;)
+    ws_wakeup(&ws_connections[i]);
+
+  for (size_t i = ws_workers_nitems; i-- > 0;)
+    thread_join(ws_workers[i].thrd, NULL);
+
+  // Managers are released after all workers stopped polling them.
+  for (size_t i = ws_workers_nitems; i-- > 0;) {
+    mg_mgr_free(ws_workers[i].mgr);
+    heap_free(ws_workers[i].mgr);
+  }
+
+  for (size_t i = ws_connections_nitems; i-- > 0;)
+    if (ws_connections[i].products != NULL)
+      Map_delete(ws_connections[i].products, String_delete);
+
+  heap_free(ws_connections);
+  heap_free(ws_workers);
+  ws_connections = NULL;
+  ws_connections_nitems = 0;
+  ws_workers = NULL;
+  ws_workers_nitems = 0;
+
+  Capture_delete(coinbase_ws_capture);
+  coinbase_ws_capture = NULL;
 }
 
 static struct Sample *coinbase_sample_await(void) {
@@ -1238,8 +1943,7 @@ static struct Sample *coinbase_sample_await(void) {
     werr("%s: Dequeuing ticker timed out after %" PRIdMAX " seconds\n",
          coinbase_ws_uri, (intmax_t)(coinbase_stall_ms / 1000L));
 
-    for (size_t i = nitems(ws_channels); i-- > 0;)
-      ws_channels[i].reconnect = true;
+    ws_reconnect();
   }
 
   return s;
@@ -1475,57 +2179,129 @@ ret:
   return p;
 }
 
-static struct Array *coinbase_markets(void) {
+/*
+ * Reloads the product catalogue if requested. Products are fetched and parsed
+ * without holding the markets lock, which is taken for swapping in the result
+ * only. Reloads are serialized, so that concurrent requests are served by a
+ * single fetch.
+ */
+static bool markets_load(void) {
   const struct coinbase_tls *restrict const tls = coinbase_tls();
-  struct wcjson_document *restrict rsp_doc = tls->coinbase_markets.rsp_doc;
+  struct wcjson_document *restrict rsp_doc = tls->markets_load.rsp_doc;
   char url[URL_MAX_LENGTH + 1] = {0};
   void *const *restrict items;
+  bool loaded = false;
+
+  mutex_lock(&markets_load_mtx);
+
+  if (!markets_reload) {
+    loaded = true;
+    goto ret;
+  }
+
+  markets_reload = false;
+  accounts_reload = true;
+  int r = snprintf(url, sizeof(url), "%s%s", coinbase_rest_uri,
+                   coinbase_products_path);
+
+  if (r < 0 || (size_t)r >= sizeof(url))
+    panic();
+
+  if (coinbase_rest_query(rsp_doc, url, "GET", coinbase_products_path, NULL,
+                          0) < 0) {
+    markets_reload = true;
+    goto ret;
+  }
+
+  struct Array *restrict const parsed = Array_new(Array_size(markets) + 1);
+  parse_products(parsed, rsp_doc);
+
+  struct Map *restrict by_symbol = Map_new(StringMapOps, Array_size(parsed));
+  struct Map *restrict by_id = Map_new(StringMapOps, Array_size(parsed));
+
+  items = Array_items(parsed);
+  for (size_t i = Array_size(parsed); i-- > 0;) {
+    if (Map_put(by_symbol, ((struct Market *)items[i])->sym, items[i]))
+      fatal("%s: products: Market symbol uniqueness constraint: %s", url,
+            String_chars(((struct Market *)items[i])->sym));
 
+    if (Map_put(by_id, ((struct Market *)items[i])->id, items[i]))
+      fatal("%s: products: Market id uniqueness constraint: %s", url,
+            String_chars(((struct Market *)items[i])->id));
+  }
+
+  // Callers hold the mutex of the markets array, so that array is kept.
   Array_lock(markets);
+  Array_clear(markets, Market_delete);
 
-  if (markets_reload) {
-    accounts_reload = true;
-    int r = snprintf(url, sizeof(url), "%s%s", coinbase_rest_uri,
-                     coinbase_products_path);
+  for (size_t i = 0; i < Array_size(parsed); i++)
+    Array_add_tail(markets, items[i]);
 
-    if (r < 0 || (size_t)r >= sizeof(url))
-      panic();
+  Array_compact(markets);
 
-    if (coinbase_rest_query(rsp_doc, url, "GET", coinbase_products_path, NULL,
-                            0) < 0) {
+  struct Map *restrict const old_by_symbol = markets_by_symbol;
+  struct Map *restrict const old_by_id = markets_by_id;
+  markets_by_symbol = by_symbol;
+  markets_by_id = by_id;
+  markets_version++;
+  Array_unlock(markets);
 
-      for (size_t i = nitems(ws_channels); i-- > 0;)
-        ws_channels[i].reconnect = true;
+  Array_delete(parsed, NULL);
+  Map_delete(old_by_symbol, NULL);
+  Map_delete(old_by_id, NULL);
+  ws_resubscribe();
+  loaded = true;
+ret:
+  mutex_unlock(&markets_load_mtx);
+  return loaded;
+}
 
-      goto ret;
-    }
+/*
+ * Reloads the product catalogue on request and reconciles it with the
+ * exchange periodically. Failed reloads are retried.
+ */
+static int markets_refresh_func(void *restrict const arg) {
+  (void)arg;
+  struct timespec to;
+
+  mutex_lock(&markets_mtx);
 
-    Array_clear(markets, Market_delete);
-    parse_products(markets, rsp_doc);
-    Array_compact(markets);
-    Map_delete(markets_by_symbol, NULL);
-    Map_delete(markets_by_id, NULL);
-    markets_by_symbol = Map_new(StringMapOps, Array_size(markets));
-    markets_by_id = Map_new(StringMapOps, Array_size(markets));
-
-    items = Array_items(markets);
-    for (size_t i = Array_size(markets); i-- > 0;) {
-      if (Map_put(markets_by_symbol, ((struct Market *)items[i])->sym,
-                  items[i]))
-        fatal("%s: products: Market symbol uniqueness constraint: %s", url,
-              String_chars(((struct Market *)items[i])->sym));
-
-      if (Map_put(markets_by_id, ((struct Market *)items[i])->id, items[i]))
-        fatal("%s: products: Market id uniqueness constraint: %s", url,
-              String_chars(((struct Market *)items[i])->id));
+  while (running) {
+    if (!markets_reload) {
+      time_now(&to);
+      to.tv_sec += (time_t)coinbase_markets_reload_s;
+
+      if (!condition_timedwait(&markets_cnd, &markets_mtx, &to))
+        markets_reload = true;
+
+      continue;
     }
 
-    markets_reload = false;
+    mutex_unlock(&markets_mtx);
+    const bool loaded = markets_load();
+    mutex_lock(&markets_mtx);
+
+    if (!loaded && running) {
+      time_now(&to);
+      to.tv_sec += coinbase_retry_rate.tv_sec;
+      condition_timedwait(&markets_cnd, &markets_mtx, &to);
+    }
   }
-ret:
+
+  mutex_unlock(&markets_mtx);
+  thread_exit(EXIT_SUCCESS);
+}
+
+static struct Array *coinbase_markets(void) {
+  if (markets_reload && (!markets_refreshing || markets_version == 0))
+    markets_load();
+
+  Array_lock(markets);
   return markets;
 }
 
+static uintmax_t coinbase_markets_version(void) { return markets_version; }
+
 static struct Market *coinbase_market(const struct String *restrict const id) {
   struct Array *restrict const m_array = coinbase_markets();
   struct Market *restrict m = Map_get(markets_by_id, id);
@@ -1752,8 +2528,7 @@ static struct Array *coinbase_accounts(void) {
     if (accounts_with_cursor(accounts, NULL) == 0)
       accounts_reload = false;
     else
-      for (size_t i = nitems(ws_channels); i > 0; i--)
-        ws_channels[i - 1].reconnect = true;
+      ws_reconnect();
 
     Array_compact(accounts);
 
@@ -2030,12 +2805,100 @@ ret:
   return o;
 }
 
-static bool coinbase_order_cancel(const struct Market *restrict const m,
-                                  const struct String *restrict const id) {
+static struct Array *
+coinbase_orders(const struct Market *restrict const m,
+                const struct Numeric *restrict const since) {
+  const struct coinbase_tls *restrict const tls = coinbase_tls();
+  struct wcjson_document *restrict rsp_doc = tls->coinbase_orders.rsp_doc;
+  const int saved_errno = errno;
+  char path[URL_MAX_LENGTH + 1] = {0};
+  char url[URL_MAX_LENGTH + 1] = {0};
+  char *restrict const start = nanos_to_iso8601_utc(since);
+  struct String *restrict j_cursor = NULL;
+  struct Array *restrict o = Array_new(128);
+  bool success = false;
+  int r = snprintf(path, sizeof(path), "%sbatch", coinbase_order_path);
+
+  if (r < 0 || (size_t)r >= sizeof(path))
+    panic();
+
+  errno = 0;
+
+  do {
+    if (j_cursor != NULL)
+      r = snprintf(url, sizeof(url),
+                   "%s%s?product_ids=%s&start_date=%s&limit=%d&cursor=%s",
+                   coinbase_rest_uri, path, String_chars(m->sym), start, 1000,
+                   String_chars(j_cursor));
+    else
+      r = snprintf(url, sizeof(url),
+                   "%s%s?product_ids=%s&start_date=%s&limit=%d",
+                   coinbase_rest_uri, path, String_chars(m->sym), start, 1000);
+
+    if (r < 0 || (size_t)r >= sizeof(url))
+      panic();
+
+    String_delete(j_cursor);
+    j_cursor = NULL;
+
+    if (coinbase_rest_query(rsp_doc, url, "GET", path, NULL, 0) < 0)
+      goto ret;
+
+    const struct wcjson_value *restrict const j_orders =
+        wcjson_object_get(rsp_doc, rsp_doc->values, L"orders", 6);
+
+    if (j_orders == NULL || !j_orders->is_array) {
+      werr("%s: orders: No 'orders' array item\n", url);
+      goto ret;
+    }
+
+    // Orders not parsed are looked up individually later on.
+    const struct wcjson_value *restrict j_order = NULL;
+    wcjson_value_foreach(j_order, rsp_doc, j_orders) {
+      struct Order *restrict const order = parse_order(rsp_doc, j_order);
+
+      if (order != NULL)
+        Array_add_tail(o, order);
+    }
+
+    errno = 0;
+    const struct wcjson_value *restrict const j_has_next =
+        json_obj_get_optional_bool(rsp_doc, rsp_doc->values, L"has_next", 8);
+
+    if (errno)
+      goto ret;
+
+    if (j_has_next && j_has_next->is_true) {
+      j_cursor = json_obj_get_string(rsp_doc, rsp_doc->values, L"cursor", 6);
+
+      if (errno)
+        goto ret;
+    }
+  } while (j_cursor != NULL);
+
+  success = true;
+  errno = 0;
+ret:
+  if (!success) {
+    Array_delete(o, Order_delete);
+    o = NULL;
+  }
+
+  String_delete(j_cursor);
+  heap_free(start);
+
+  if (errno)
+    werr("%s: orders: %s\n", url, strerror(errno));
+
+  errno = saved_errno;
+  return o;
+}
+
+static bool orders_cancel_batch(struct Order *const *restrict const o,
+                                const size_t o_nitems) {
   const struct coinbase_tls *restrict const tls = coinbase_tls();
   struct wcjson_document *restrict rsp_doc = tls->coinbase_order_cancel.rsp_doc;
   bool success = false;
-  bool found = false;
   char url[URL_MAX_LENGTH + 1] = {0};
   char err[JSON_BODY_MAX + 1] = {0};
   size_t err_nitems = nitems(err);
@@ -2043,12 +2906,12 @@ static bool coinbase_order_cancel(const struct Market *restrict const m,
   struct wcjson wc_json = WCJSON_INITIALIZER;
   // Request Values
   //  j_req
-  //  id
+  //  ids
   //  ids pair
-  //  1 + 1 + 2
+  //  1 + o_nitems + 2
   struct wcjson_document req_doc = {
-      .values = (struct wcjson_value[4]){{0}},
-      .v_nitems = 4,
+      .values = heap_calloc(o_nitems + 3, sizeof(struct wcjson_value)),
+      .v_nitems = o_nitems + 3,
   };
 
   int r = snprintf(url, sizeof(url), "%s%s", coinbase_rest_uri,
@@ -2059,12 +2922,19 @@ static bool coinbase_order_cancel(const struct Market *restrict const m,
 
   errno = 0;
 
+  if (*coinbase_ws_replay_path) {
+    werr("%s: cancel: Replaying %s\n", url, coinbase_ws_replay_path);
+    goto ret;
+  }
+
   struct wcjson_value *restrict const j_req = wcjson_value_object(&req_doc);
   struct wcjson_value *restrict const j_ids = wcjson_value_array(&req_doc);
 
-  wcjson_array_add_tail(
-      &req_doc, j_ids,
-      wcjson_value_mbstring(&req_doc, String_chars(id), String_length(id)));
+  for (size_t i = 0; i < o_nitems; i++)
+    wcjson_array_add_tail(
+        &req_doc, j_ids,
+        wcjson_value_mbstring(&req_doc, String_chars(o[i]->id),
+                              String_length(o[i]->id)));
 
   wcjson_object_add_tail(&req_doc, j_req, L"order_ids", 9, j_ids);
 
@@ -2101,42 +2971,76 @@ static bool coinbase_order_cancel(const struct Market *restrict const m,
   const struct wcjson_value *restrict j_result = NULL;
   wcjson_value_foreach(j_result, rsp_doc, j_results) {
     errno = 0;
-    const struct String *restrict const j_order_id =
+    struct String *restrict const j_order_id =
         json_obj_get_string(rsp_doc, j_result, L"order_id", 8);
 
     const bool j_success = json_obj_get_bool(rsp_doc, j_result, L"success", 7);
 
-    if (errno)
+    if (errno) {
+      String_delete(j_order_id);
       goto ret;
-
-    if (String_equals(id, j_order_id)) {
-      found = true;
-      success = j_success;
-      break;
     }
-  }
 
-  if (!(found && success)) {
-    err_nitems = nitems(err);
-    if (json_mbsprint(err, &err_nitems, rsp_doc, rsp_doc->values) < 0) {
-      r = snprintf(err, err_nitems, "%s", strerror(errno));
-      if (r < 0 || (size_t)r >= err_nitems)
-        panic();
+    for (size_t i = 0; i < o_nitems; i++) {
+      if (!String_equals(o[i]->id, j_order_id))
+        continue;
+
+      if (j_success)
+        o[i]->status = ORDER_STATUS_CANCELLED;
+      else {
+        err_nitems = nitems(err);
+        if (json_mbsprint(err, &err_nitems, rsp_doc, j_result) < 0) {
+          r = snprintf(err, err_nitems, "%s", strerror(errno));
+          if (r < 0 || (size_t)r >= err_nitems)
+            panic();
+        }
+
+        werr("%s: cancel: %s %s\n", url, String_chars(j_order_id), err);
+      }
+      break;
     }
 
-    werr("%s: cancel: %s %s\n", url, String_chars(id), err);
-    goto ret;
+    String_delete(j_order_id);
   }
 
+  success = true;
   errno = 0;
 ret:
   if (errno)
     werr("%s: cancel: %s\n", url, strerror(errno));
 
+  heap_free(req_doc.values);
   errno = saved_errno;
   return success;
 }
 
+static bool coinbase_order_cancel(const struct Market *restrict const m,
+                                  const struct String *restrict const id) {
+  struct Order o = {
+      .id = (struct String *)id,
+      .m_id = m->id,
+      .status = ORDER_STATUS_UNKNOWN,
+  };
+  struct Order *const o_ptr = &o;
+
+  return orders_cancel_batch(&o_ptr, 1) && o.status == ORDER_STATUS_CANCELLED;
+}
+
+static bool coinbase_orders_cancel(struct Array *restrict const cancels) {
+  struct Order *const *restrict const o =
+      (struct Order *const *)Array_items(cancels);
+  const size_t o_nitems = Array_size(cancels);
+  bool ret = true;
+
+  for (size_t i = 0; i < o_nitems; i += CANCEL_BATCH_MAX)
+    if (!orders_cancel_batch(o + i, o_nitems - i < CANCEL_BATCH_MAX
+                                        ? o_nitems - i
+                                        : CANCEL_BATCH_MAX))
+      ret = false;
+
+  return ret;
+}
+
 static int
 order_create_body(char *restrict const mb, size_t *restrict const mb_len,
                   const char *restrict const url,
@@ -2233,6 +3137,11 @@ static struct String *coinbase_order_post(
 
   errno = 0;
 
+  if (*coinbase_ws_replay_path) {
+    werr("%s: create: Replaying %s\n", url, coinbase_ws_replay_path);
+    goto ret;
+  }
+
   if (order_create_body(mb, &mb_len, url, sym, sd, base_amount,
                         strlen(base_amount), price, strlen(price)) < 0)
     goto ret;
@@ -0,0 +1,929 @@
+/* $JDTAUS$ */
+
+/*
+ * Copyright (c) 2026 Christian Schulte <cs@schulte.it>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Simulated exchange replaying samples recorded for another exchange. Orders
+ * are matched against the replayed prices and filled completely at their
+ * limit price as soon as a sample crosses it.
+ */
+
+#ifdef HAVE_HOST_H
+#include "host.h"
+#endif
+
+#include "database.h"
+#include "exchange.h"
+#include "heap.h"
+#include "map.h"
+#include "proc.h"
+#include "queue.h"
+#include "thread.h"
+#include "time.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SIMULATOR_UUID "0f4e5c1a-6a53-4c34-9d0e-5b0c9f3e7a21"
+#define SIMULATOR_DBCON "simulator"
+#define SIMULATOR_REPLAY_DBCON "simulator-replay"
+
+#ifndef SIMULATOR_TICKERS_DAY
+#define SIMULATOR_TICKERS_DAY (2 ^ 18)
+#endif
+
+#ifndef DEFAULT_SIMULATOR_SOURCE_ID
+// Coinbase
+#define DEFAULT_SIMULATOR_SOURCE_ID "74cc13c5-4835-491b-95f2-6af672ad141a"
+#endif
+
+#ifndef DEFAULT_SIMULATOR_MARKETS
+#define DEFAULT_SIMULATOR_MARKETS "BTC-EUR"
+#endif
+
+#ifndef DEFAULT_SIMULATOR_REPLAY_SECONDS
+#define DEFAULT_SIMULATOR_REPLAY_SECONDS 86400L
+#endif
+
+#ifndef DEFAULT_SIMULATOR_SPEED
+#define DEFAULT_SIMULATOR_SPEED 1
+#endif
+
+#ifndef DEFAULT_SIMULATOR_BASE_INCREMENT
+#define DEFAULT_SIMULATOR_BASE_INCREMENT "0.00000001"
+#endif
+
+#ifndef DEFAULT_SIMULATOR_PRICE_INCREMENT
+#define DEFAULT_SIMULATOR_PRICE_INCREMENT "0.01"
+#endif
+
+#ifndef DEFAULT_SIMULATOR_QUOTE_INCREMENT
+#define DEFAULT_SIMULATOR_QUOTE_INCREMENT "0.01"
+#endif
+
+#ifndef DEFAULT_SIMULATOR_BALANCE
+#define DEFAULT_SIMULATOR_BALANCE "10000"
+#endif
+
+#ifndef DEFAULT_SIMULATOR_FEE_PERCENT
+#define DEFAULT_SIMULATOR_FEE_PERCENT "0.25"
+#endif
+
+#ifndef nitems
+#define nitems(_a) (sizeof((_a)) / sizeof((_a)[0]))
+#endif
+
+extern const bool verbose;
+
+extern const struct Numeric *restrict const zero;
+extern const struct Numeric *restrict const one;
+extern const struct Numeric *restrict const hundred;
+
+static void simulator_init(void);
+static void simulator_configure(const struct ExchangeConfig *restrict const);
+static void simulator_destroy(void);
+static void simulator_start(void);
+static void simulator_stop(void);
+static struct Array *simulator_markets(void);
+static uintmax_t simulator_markets_version(void);
+static struct Market *simulator_market(const struct String *restrict const);
+static struct Array *simulator_accounts(void);
+static struct Account *simulator_account(const struct String *restrict const);
+static struct Pricing *simulator_pricing(const struct Market *restrict const);
+static struct Order *simulator_order(const struct Market *restrict const,
+                                     const struct String *restrict const);
+static struct Order *simulator_order_await(void);
+static struct Sample *simulator_sample_await(void);
+static bool simulator_order_cancel(const struct Market *restrict const,
+                                   const struct String *restrict const);
+static struct String *
+simulator_order_demand(const struct Market *restrict const,
+                       const char *restrict const, const char *restrict const);
+static struct String *
+simulator_order_supply(const struct Market *restrict const,
+                       const char *restrict const, const char *restrict const);
+
+struct Exchange exchange_simulator = {
+    .id = NULL,
+    .nm = NULL,
+    .init = simulator_init,
+    .configure = simulator_configure,
+    .destroy = simulator_destroy,
+    .start = simulator_start,
+    .stop = simulator_stop,
+    .markets = simulator_markets,
+    .markets_version = simulator_markets_version,
+    .market = simulator_market,
+    .accounts = simulator_accounts,
+    .account = simulator_account,
+    .order = simulator_order,
+    .orders = NULL,
+    .order_await = simulator_order_await,
+    .pricing = simulator_pricing,
+    .sample_await = simulator_sample_await,
+    .order_cancel = simulator_order_cancel,
+    .orders_cancel = NULL,
+    .order_demand = simulator_order_demand,
+    .order_supply = simulator_order_supply,
+};
+
+struct simulator_order {
+  struct Order *restrict o;
+  struct String *restrict ba_id;
+  struct String *restrict qa_id;
+  uintmax_t b_sc;
+  uintmax_t q_sc;
+  bool buy;
+};
+
+static int simulator_replay_func(void *restrict const);
+
+static void *restrict simulator_db;
+static const char *restrict simulator_source_id;
+static const char *restrict simulator_market_symbols;
+static unsigned long simulator_replay_secs;
+static unsigned long simulator_speed;
+static struct Numeric *restrict simulator_b_inc;
+static struct Numeric *restrict simulator_p_inc;
+static struct Numeric *restrict simulator_q_inc;
+static struct Numeric *restrict simulator_balance;
+static struct Numeric *restrict simulator_fee_pc;
+static thrd_t simulator_replay_thrd;
+static uintmax_t simulator_epoch;
+static _Atomic uintmax_t simulator_order_seq;
+
+static struct Array *restrict markets;
+static struct Map *restrict markets_by_id;
+static _Atomic bool markets_reload;
+static _Atomic uintmax_t markets_version;
+
+static struct Array *restrict accounts;
+static struct Map *restrict accounts_by_id;
+
+static struct Map *restrict pricings_by_id;
+
+static struct Map *restrict orders_by_id;
+static struct Array *restrict orders_open;
+static struct Array *restrict order_events;
+
+static _Atomic bool running;
+static struct Queue *restrict orders;
+static struct Queue *restrict samples;
+
+static uintmax_t scale(const char *restrict const inc) {
+  const char *restrict const dot = strchr(inc, '.');
+  return dot ? strlen(dot + 1) : 0;
+}
+
+static void avail_add(struct Account *restrict const a,
+                      const struct Numeric *restrict const n) {
+  struct Numeric *restrict const avail = Numeric_add(a->avail, n);
+  Numeric_delete(a->avail);
+  a->avail = avail;
+}
+
+static void avail_sub(struct Account *restrict const a,
+                      const struct Numeric *restrict const n) {
+  struct Numeric *restrict const avail = Numeric_sub(a->avail, n);
+  Numeric_delete(a->avail);
+  a->avail = avail;
+}
+
+static void simulator_init(void) {
+  struct timespec now;
+
+  exchange_simulator.id = String_cnew(SIMULATOR_UUID);
+  exchange_simulator.nm = String_cnew("simulator");
+
+  simulator_source_id =
+      envs("SIMULATOR_SOURCE_ID", DEFAULT_SIMULATOR_SOURCE_ID);
+
+  simulator_market_symbols =
+      envs("SIMULATOR_MARKETS", DEFAULT_SIMULATOR_MARKETS);
+
+  simulator_replay_secs =
+      envul("SIMULATOR_REPLAY_SECONDS", DEFAULT_SIMULATOR_REPLAY_SECONDS);
+
+  simulator_speed = envul("SIMULATOR_SPEED", DEFAULT_SIMULATOR_SPEED);
+
+  const char *restrict const b_inc =
+      envs("SIMULATOR_BASE_INCREMENT", DEFAULT_SIMULATOR_BASE_INCREMENT);
+  const char *restrict const p_inc =
+      envs("SIMULATOR_PRICE_INCREMENT", DEFAULT_SIMULATOR_PRICE_INCREMENT);
+  const char *restrict const q_inc =
+      envs("SIMULATOR_QUOTE_INCREMENT", DEFAULT_SIMULATOR_QUOTE_INCREMENT);
+  const char *restrict const balance =
+      envs("SIMULATOR_BALANCE", DEFAULT_SIMULATOR_BALANCE);
+  const char *restrict const fee_pc =
+      envs("SIMULATOR_FEE_PERCENT", DEFAULT_SIMULATOR_FEE_PERCENT);
+
+  simulator_b_inc = Numeric_from_char(b_inc);
+  simulator_p_inc = Numeric_from_char(p_inc);
+  simulator_q_inc = Numeric_from_char(q_inc);
+  simulator_balance = Numeric_from_char(balance);
+  simulator_fee_pc = Numeric_from_char(fee_pc);
+
+  if (Numeric_cmp(simulator_b_inc, zero) <= 0)
+    fatal("%s <= 0", "SIMULATOR_BASE_INCREMENT");
+
+  if (Numeric_cmp(simulator_p_inc, zero) <= 0)
+    fatal("%s <= 0", "SIMULATOR_PRICE_INCREMENT");
+
+  if (Numeric_cmp(simulator_q_inc, zero) <= 0)
+    fatal("%s <= 0", "SIMULATOR_QUOTE_INCREMENT");
+
+  if (Numeric_cmp(simulator_balance, zero) < 0)
+    fatal("%s < 0", "SIMULATOR_BALANCE");
+
+  if (Numeric_cmp(simulator_fee_pc, zero) < 0)
+    fatal("%s < 0", "SIMULATOR_FEE_PERCENT");
+
+  if (verbose) {
+    wout("\tSIMULATOR_SOURCE_ID=%s\n", simulator_source_id);
+    wout("\tSIMULATOR_MARKETS=%s\n", simulator_market_symbols);
+    wout("\tSIMULATOR_REPLAY_SECONDS=%lu\n", simulator_replay_secs);
+    wout("\tSIMULATOR_SPEED=%lu\n", simulator_speed);
+    wout("\tSIMULATOR_BASE_INCREMENT=%s\n", b_inc);
+    wout("\tSIMULATOR_PRICE_INCREMENT=%s\n", p_inc);
+    wout("\tSIMULATOR_QUOTE_INCREMENT=%s\n", q_inc);
+    wout("\tSIMULATOR_BALANCE=%s\n", balance);
+    wout("\tSIMULATOR_FEE_PERCENT=%s\n", fee_pc);
+  }
+
+  // Order identifiers must not collide with orders of previous runs.
+  time_now(&now);
+  simulator_epoch = (uintmax_t)now.tv_sec;
+  simulator_order_seq = 0;
+
+  markets = Array_new(64);
+  markets_by_id = Map_new(StringMapOps, 64);
+  markets_reload = true;
+
+  accounts = Array_new(64);
+  accounts_by_id = Map_new(StringMapOps, 64);
+
+  pricings_by_id = Map_new(StringMapOps, 64);
+
+  orders_by_id = Map_new(StringMapOps, 1024);
+  orders_open = Array_new(128);
+  order_events = Array_new(128);
+
+  orders = Queue_new(128, (time_t)0);
+  samples = Queue_new(SIMULATOR_TICKERS_DAY, (time_t)0);
+
+  running = false;
+}
+
+static void simulator_configure(const struct ExchangeConfig *restrict const c) {
+  simulator_db = db_connect(SIMULATOR_DBCON);
+}
+
+static void simulator_order_delete(void *restrict const so) {
+  if (so == NULL)
+    return;
+
+  struct simulator_order *restrict const order = so;
+  Order_delete(order->o);
+  String_delete(order->ba_id);
+  String_delete(order->qa_id);
+  heap_free(order);
+}
+
+static void simulator_destroy(void) {
+  if (simulator_db)
+    db_disconnect(simulator_db);
+
+  String_delete(exchange_simulator.id);
+  String_delete(exchange_simulator.nm);
+  Numeric_delete(simulator_b_inc);
+  Numeric_delete(simulator_p_inc);
+  Numeric_delete(simulator_q_inc);
+  Numeric_delete(simulator_balance);
+  Numeric_delete(simulator_fee_pc);
+  Array_delete(markets, Market_delete);
+  Map_delete(markets_by_id, NULL);
+  Array_delete(accounts, Account_delete);
+  Map_delete(accounts_by_id, NULL);
+  Map_delete(pricings_by_id, Pricing_delete);
+  Map_delete(orders_by_id, simulator_order_delete);
+  Array_delete(orders_open, NULL);
+  Array_delete(order_events, Order_delete);
+  Queue_delete(orders, Order_delete);
+  Queue_delete(samples, Sample_delete);
+}
+
+static void simulator_start(void) {
+  Queue_start(orders);
+  Queue_start(samples);
+
+  running = true;
+
+  thread_create(&simulator_replay_thrd, simulator_replay_func, NULL);
+}
+
+static void simulator_stop(void) {
+  running = false;
+  Queue_stop(orders);
+  Queue_stop(samples);
+  thread_join(simulator_replay_thrd, NULL);
+}
+
+static struct Account *simulator_account_create(const char *restrict const sym,
+                                                const size_t len) {
+  char a_id[DATABASE_UUID_MAX_LENGTH + 1] = {0};
+  struct String *restrict const a_sym = String_cnnew(sym, len);
+  struct Account *restrict a = NULL;
+  void *const *restrict items = Array_items(accounts);
+
+  for (size_t i = Array_size(accounts); i-- > 0;)
+    if (String_equals(((struct Account *)items[i])->sym, a_sym)) {
+      a = items[i];
+      String_delete(a_sym);
+      return a;
+    }
+
+  db_symbol_to_id(a_id, simulator_db, SIMULATOR_UUID, String_chars(a_sym));
+
+  a = Account_new();
+  a->id = String_cnew(a_id);
+  a->nm = String_copy(a_sym);
+  a->sym = a_sym;
+  a->type = ACCOUNT_TYPE_NONE;
+  a->avail = Numeric_copy(simulator_balance);
+  a->is_active = true;
+  a->is_ready = true;
+
+  Array_add_tail(accounts, a);
+
+  if (Map_put(accounts_by_id, a->id, a) != NULL)
+    fatal("%s: accounts: Account id uniqueness constraint: %s",
+          String_chars(exchange_simulator.nm), a_id);
+
+  return a;
+}
+
+static struct Market *simulator_market_create(const char *restrict const sym,
+                                              const size_t len) {
+  char m_id[DATABASE_UUID_MAX_LENGTH + 1] = {0};
+  const char *restrict const sep = memchr(sym, '-', len);
+
+  if (sep == NULL || sep == sym || sep == sym + len - 1)
+    fatal("%s: %.*s", "SIMULATOR_MARKETS", (int)len, sym);
+
+  const struct Account *restrict const ba =
+      simulator_account_create(sym, (size_t)(sep - sym));
+  const struct Account *restrict const qa =
+      simulator_account_create(sep + 1, len - (size_t)(sep - sym) - 1);
+
+  struct Market *restrict const m = Market_new();
+  m->sym = String_cnnew(sym, len);
+
+  // Simulated markets have identifiers of their own, so that their state does
+  // not mix with the state of the source exchange's markets.
+  db_symbol_to_id(m_id, simulator_db, SIMULATOR_UUID, String_chars(m->sym));
+
+  m->id = String_cnew(m_id);
+  m->nm = String_copy(m->sym);
+  m->b_id = String_copy(ba->sym);
+  m->ba_id = String_copy(ba->id);
+  m->q_id = String_copy(qa->sym);
+  m->qa_id = String_copy(qa->id);
+  m->b_inc = Numeric_copy(simulator_b_inc);
+  m->p_inc = Numeric_copy(simulator_p_inc);
+  m->q_inc = Numeric_copy(simulator_q_inc);
+  m->b_sc = scale(envs("SIMULATOR_BASE_INCREMENT",
+                       DEFAULT_SIMULATOR_BASE_INCREMENT));
+  m->p_sc = scale(envs("SIMULATOR_PRICE_INCREMENT",
+                       DEFAULT_SIMULATOR_PRICE_INCREMENT));
+  m->q_sc = scale(envs("SIMULATOR_QUOTE_INCREMENT",
+                       DEFAULT_SIMULATOR_QUOTE_INCREMENT));
+  m->type = MARKET_TYPE_SPOT;
+  m->status = MARKET_STATUS_ONLINE;
+  m->is_tradeable = true;
+  m->is_active = true;
+  return m;
+}
+
+static struct Array *simulator_markets(void) {
+  const char *restrict p = simulator_market_symbols;
+
+  Array_lock(markets);
+
+  if (markets_reload) {
+    Array_lock(accounts);
+
+    while (*p) {
+      const size_t len = strcspn(p, ",");
+
+      if (len > 0) {
+        struct Market *restrict const m = simulator_market_create(p, len);
+
+        if (Map_put(markets_by_id, m->id, m) != NULL)
+          fatal("%s: markets: Market id uniqueness constraint: %s",
+                String_chars(exchange_simulator.nm), String_chars(m->id));
+
+        Array_add_tail(markets, m);
+      }
+
+      p += len;
+
+      if (*p == ',')
+        p++;
+    }
+
+    Array_unlock(accounts);
+
+    Array_compact(markets);
+    markets_version++;
+    markets_reload = false;
+  }
+
+  return markets;
+}
+
+static uintmax_t simulator_markets_version(void) { return markets_version; }
+
+static struct Market *
+simulator_market(const struct String *restrict const m_id) {
+  struct Array *restrict const m_array = simulator_markets();
+  struct Market *restrict const m = Map_get(markets_by_id, m_id);
+
+  if (m != NULL) {
+    m->mtx = Array_mutex(m_array);
+    return m;
+  }
+
+  Array_unlock(m_array);
+  return NULL;
+}
+
+static struct Array *simulator_accounts(void) {
+  Array_unlock(simulator_markets());
+  Array_lock(accounts);
+  return accounts;
+}
+
+static struct Account *
+simulator_account(const struct String *restrict const a_id) {
+  struct Array *restrict const a_array = simulator_accounts();
+  const struct Account *restrict const a = Map_get(accounts_by_id, a_id);
+  struct Account *restrict const ac = a != NULL ? Account_copy(a) : NULL;
+
+  Array_unlock(a_array);
+  return ac;
+}
+
+static struct Pricing *
+simulator_pricing(const struct Market *restrict const m) {
+  Map_lock(pricings_by_id);
+  struct Pricing *restrict p = Map_get(pricings_by_id, m->id);
+
+  if (p == NULL) {
+    p = Pricing_new();
+    p->nm = String_cnew("simulator");
+    p->tf_pc = Numeric_copy(simulator_fee_pc);
+    p->mf_pc = Numeric_copy(simulator_fee_pc);
+    p->ef_pc = Numeric_copy(simulator_fee_pc);
+    Map_put(pricings_by_id, m->id, p);
+  }
+
+  p->mtx = Map_mutex(pricings_by_id);
+  return p;
+}
+
+static struct Order *
+simulator_order_copy(const struct Order *restrict const o) {
+  struct Order *restrict const oc = Order_new();
+  oc->id = String_copy(o->id);
+  oc->m_id = String_copy(o->m_id);
+  oc->cnanos = Numeric_copy(o->cnanos);
+  oc->dnanos = Numeric_copy(o->dnanos);
+  oc->b_ordered = Numeric_copy(o->b_ordered);
+  oc->p_ordered = Numeric_copy(o->p_ordered);
+  oc->b_filled = Numeric_copy(o->b_filled);
+  oc->q_filled = Numeric_copy(o->q_filled);
+  oc->q_fees = Numeric_copy(o->q_fees);
+  oc->msg = o->msg != NULL ? String_copy(o->msg) : NULL;
+  oc->status = o->status;
+  oc->settled = o->settled;
+  return oc;
+}
+
+static struct Order *simulator_order(const struct Market *restrict const m,
+                                     const struct String *restrict const o_id) {
+  struct Order *restrict o = NULL;
+
+  Map_lock(orders_by_id);
+  const struct simulator_order *restrict const so = Map_get(orders_by_id, o_id);
+
+  if (so != NULL && String_equals(so->o->m_id, m->id))
+    o = simulator_order_copy(so->o);
+
+  Map_unlock(orders_by_id);
+  return o;
+}
+
+static void simulator_order_close(const struct simulator_order *restrict so) {
+  void *const *restrict const items = Array_items(orders_open);
+
+  for (size_t i = Array_size(orders_open); i-- > 0;)
+    if (items[i] == so) {
+      Array_remove_idx(orders_open, i);
+      break;
+    }
+}
+
+/*
+ * Amount of the account an order holds. Buy orders hold the ordered quote
+ * amount including fees, sell orders hold the ordered base amount.
+ */
+static struct Numeric *
+simulator_order_hold(const struct simulator_order *restrict const so) {
+  struct Numeric *restrict hold;
+
+  if (so->buy) {
+    struct Numeric *restrict const q = Numeric_mul(so->o->b_ordered,
+                                                   so->o->p_ordered);
+    struct Numeric *restrict const fee_pc =
+        Numeric_div(simulator_fee_pc, hundred);
+    struct Numeric *restrict const fees = Numeric_mul(q, fee_pc);
+    hold = Numeric_add(q, fees);
+    Numeric_scale(hold, so->q_sc);
+    Numeric_delete(q);
+    Numeric_delete(fee_pc);
+    Numeric_delete(fees);
+  } else
+    hold = Numeric_copy(so->o->b_ordered);
+
+  return hold;
+}
+
+static struct String *
+simulator_order_post(const struct Market *restrict const m, const bool buy,
+                     const char *restrict const base,
+                     const char *restrict const price) {
+  char o_id[DATABASE_UUID_MAX_LENGTH + 1];
+  struct String *restrict ret = NULL;
+  struct simulator_order *restrict const so =
+      heap_calloc(1, sizeof(struct simulator_order));
+
+  int r = snprintf(o_id, sizeof(o_id),
+                   "%08" PRIxMAX "-0000-4000-8000-%012" PRIxMAX,
+                   simulator_epoch & UINTMAX_C(0xffffffff),
+                   ++simulator_order_seq & UINTMAX_C(0xffffffffffff));
+
+  if (r < 0 || (size_t)r >= sizeof(o_id))
+    panic();
+
+  so->buy = buy;
+  so->ba_id = String_copy(m->ba_id);
+  so->qa_id = String_copy(m->qa_id);
+  so->b_sc = m->b_sc;
+  so->q_sc = m->q_sc;
+  so->o = Order_new();
+  so->o->id = String_cnew(o_id);
+  so->o->m_id = String_copy(m->id);
+  so->o->cnanos = Numeric_new();
+  nanos_now(so->o->cnanos);
+  so->o->dnanos = Numeric_copy(so->o->cnanos);
+  so->o->b_ordered = Numeric_from_char(base);
+  so->o->p_ordered = Numeric_from_char(price);
+  so->o->b_filled = Numeric_copy(zero);
+  so->o->q_filled = Numeric_copy(zero);
+  so->o->q_fees = Numeric_copy(zero);
+  so->o->status = ORDER_STATUS_OPEN;
+  so->o->settled = false;
+
+  struct Numeric *restrict const hold = simulator_order_hold(so);
+
+  Map_lock(orders_by_id);
+  Array_lock(accounts);
+
+  struct Account *restrict const a =
+      Map_get(accounts_by_id, buy ? so->qa_id : so->ba_id);
+
+  if (a == NULL || Numeric_cmp(a->avail, hold) < 0) {
+    werr("%s: %s: order: Insufficient funds: %s %s@%s\n",
+         String_chars(exchange_simulator.nm), String_chars(m->nm),
+         buy ? "buy" : "sell", base, price);
+
+    Array_unlock(accounts);
+    Map_unlock(orders_by_id);
+    simulator_order_delete(so);
+    goto ret;
+  }
+
+  avail_sub(a, hold);
+  Array_unlock(accounts);
+
+  Map_put(orders_by_id, so->o->id, so);
+  Array_add_tail(orders_open, so);
+  ret = String_copy(so->o->id);
+
+  Array_lock(order_events);
+  Array_add_tail(order_events, simulator_order_copy(so->o));
+  Array_unlock(order_events);
+  Map_unlock(orders_by_id);
+ret:
+  Numeric_delete(hold);
+  return ret;
+}
+
+static struct String *
+simulator_order_demand(const struct Market *restrict const m,
+                       const char *restrict const base,
+                       const char *restrict const price) {
+  return simulator_order_post(m, true, base, price);
+}
+
+static struct String *
+simulator_order_supply(const struct Market *restrict const m,
+                       const char *restrict const base,
+                       const char *restrict const price) {
+  return simulator_order_post(m, false, base, price);
+}
+
+static bool simulator_order_cancel(const struct Market *restrict const m,
+                                   const struct String *restrict const o_id) {
+  bool ret = false;
+
+  Map_lock(orders_by_id);
+  struct simulator_order *restrict const so = Map_get(orders_by_id, o_id);
+
+  if (so == NULL || !String_equals(so->o->m_id, m->id))
+    goto ret;
+
+  if (so->o->status != ORDER_STATUS_OPEN)
+    goto ret;
+
+  struct Numeric *restrict const hold = simulator_order_hold(so);
+
+  Array_lock(accounts);
+  struct Account *restrict const a =
+      Map_get(accounts_by_id, so->buy ? so->qa_id : so->ba_id);
+
+  if (a != NULL)
+    avail_add(a, hold);
+
+  Array_unlock(accounts);
+  Numeric_delete(hold);
+
+  so->o->status = ORDER_STATUS_CANCELLED;
+  so->o->settled = true;
+  nanos_now(so->o->dnanos);
+  simulator_order_close(so);
+
+  Array_lock(order_events);
+  Array_add_tail(order_events, simulator_order_copy(so->o));
+  Array_unlock(order_events);
+  ret = true;
+ret:
+  Map_unlock(orders_by_id);
+  return ret;
+}
+
+/*
+ * Fills all open orders of the sample's market the sample's price crosses.
+ * Called by the replay thread only, so that order events are enqueued by a
+ * single producer in the same way the websocket workers of the other
+ * exchanges do.
+ */
+static void simulator_orders_match(const struct Sample *restrict const s,
+                                   struct Array *restrict const filled) {
+  Map_lock(orders_by_id);
+
+  void *const *restrict const items = Array_items(orders_open);
+  for (size_t i = Array_size(orders_open); i-- > 0;) {
+    struct simulator_order *restrict const so = items[i];
+
+    if (!String_equals(so->o->m_id, s->m_id))
+      continue;
+
+    const int cmp = Numeric_cmp(s->price, so->o->p_ordered);
+
+    if (so->buy ? cmp > 0 : cmp < 0)
+      continue;
+
+    struct Numeric *restrict const hold = simulator_order_hold(so);
+    struct Numeric *restrict const fee_pc =
+        Numeric_div(simulator_fee_pc, hundred);
+
+    Numeric_copy_to(so->o->b_ordered, so->o->b_filled);
+    Numeric_mul_to(so->o->b_filled, so->o->p_ordered, so->o->q_filled);
+    Numeric_scale(so->o->q_filled, so->q_sc);
+    Numeric_mul_to(so->o->q_filled, fee_pc, so->o->q_fees);
+    Numeric_scale(so->o->q_fees, so->q_sc);
+    Numeric_copy_to(s->nanos, so->o->dnanos);
+    so->o->status = ORDER_STATUS_FILLED;
+    so->o->settled = true;
+
+    Array_lock(accounts);
+    struct Account *restrict const ba = Map_get(accounts_by_id, so->ba_id);
+    struct Account *restrict const qa = Map_get(accounts_by_id, so->qa_id);
+
+    if (so->buy) {
+      // Release the part of the hold not spent due to rounding.
+      avail_add(ba, so->o->b_filled);
+      avail_add(qa, hold);
+      avail_sub(qa, so->o->q_filled);
+      avail_sub(qa, so->o->q_fees);
+    } else {
+      avail_add(qa, so->o->q_filled);
+      avail_sub(qa, so->o->q_fees);
+    }
+
+    Array_unlock(accounts);
+    Numeric_delete(hold);
+    Numeric_delete(fee_pc);
+
+    Array_remove_idx(orders_open, i);
+    Array_add_tail(filled, simulator_order_copy(so->o));
+  }
+
+  Map_unlock(orders_by_id);
+}
+
+static void simulator_order_events(struct Array *restrict const events) {
+  Array_lock(order_events);
+
+  while (Array_size(order_events) > 0)
+    Array_add_tail(events, Array_remove_head(order_events));
+
+  Array_unlock(order_events);
+
+  while (Array_size(events) > 0)
+    Queue_enqueue_await(orders, Array_remove_head(events));
+}
+
+static struct Array *simulator_replay_load(void *restrict const db) {
+  struct Array *restrict const replay = Array_new(16);
+  struct Numeric *restrict const since = Numeric_new();
+  struct db_sample_rec rec = {
+      .nanos = Numeric_new(),
+      .price = Numeric_new(),
+  };
+  void *const *restrict items;
+
+  if (simulator_replay_secs > 0) {
+    struct Numeric *restrict const now = Numeric_new();
+    struct Numeric *restrict const window =
+        Numeric_from_long((long)simulator_replay_secs * 1000000000L);
+
+    nanos_now(now);
+    Numeric_sub_to(now, window, since);
+    Numeric_delete(now);
+    Numeric_delete(window);
+  } else
+    Numeric_copy_to(zero, since);
+
+  struct Array *restrict const m_array = simulator_markets();
+  struct Array *restrict const m_ids = Array_new(Array_size(m_array));
+  struct Array *restrict const m_syms = Array_new(Array_size(m_array));
+
+  items = Array_items(m_array);
+  for (size_t i = 0; i < Array_size(m_array); i++) {
+    Array_add_tail(m_ids, String_copy(((struct Market *)items[i])->id));
+    Array_add_tail(m_syms, String_copy(((struct Market *)items[i])->sym));
+  }
+
+  Array_unlock(m_array);
+
+  items = Array_items(m_ids);
+  for (size_t i = 0; running && i < Array_size(m_ids); i++) {
+    char src_id[DATABASE_UUID_MAX_LENGTH + 1] = {0};
+    struct Array *restrict const a = Array_new(4096);
+
+    // Replayed samples are stored using the identifiers of the source
+    // exchange.
+    db_symbol_to_id(src_id, db, simulator_source_id,
+                    String_chars(Array_items(m_syms)[i]));
+
+    db_samples_open(db, simulator_source_id, src_id, since);
+
+    while (running && db_samples_next(&rec, db)) {
+      struct Sample *restrict const s = Sample_new();
+      s->m_id = String_copy(items[i]);
+      s->nanos = Numeric_copy(rec.nanos);
+      s->price = Numeric_copy(rec.price);
+      Array_add_tail(a, s);
+    }
+
+    db_samples_close(db);
+
+    if (verbose)
+      wout("%s: %s: Replaying %zu samples\n",
+           String_chars(exchange_simulator.nm), String_chars(items[i]),
+           Array_size(a));
+
+    Array_add_tail(replay, a);
+  }
+
+  Array_delete(m_ids, String_delete);
+  Array_delete(m_syms, String_delete);
+  Numeric_delete(since);
+  Numeric_delete(rec.nanos);
+  Numeric_delete(rec.price);
+  return replay;
+}
+
+static void simulator_replay_delete(void *restrict const a) {
+  Array_delete(a, Sample_delete);
+}
+
+static int simulator_replay_func(void *restrict const arg) {
+  void *restrict const db = db_connect(SIMULATOR_REPLAY_DBCON);
+  struct Array *restrict const replay = simulator_replay_load(db);
+  struct Array *restrict const events = Array_new(128);
+  const struct timespec idle = {.tv_sec = 0, .tv_nsec = 100000000L};
+  void *const *restrict const items = Array_items(replay);
+  size_t *restrict const pos = heap_calloc(Array_size(replay), sizeof(size_t));
+  long prev_ns = 0;
+
+  db_disconnect(db);
+
+  while (running) {
+    const struct Sample *restrict next = NULL;
+    size_t next_idx = 0;
+    long next_ns = 0;
+
+    simulator_order_events(events);
+
+    // Merge the per market samples in the order they have been recorded.
+    for (size_t i = 0; i < Array_size(replay); i++) {
+      if (pos[i] == Array_size(items[i]))
+        continue;
+
+      const struct Sample *restrict const head = Array_items(items[i])[pos[i]];
+      const long ns = Numeric_to_long(head->nanos);
+
+      if (next == NULL || ns < next_ns) {
+        next = head;
+        next_idx = i;
+        next_ns = ns;
+      }
+    }
+
+    if (next == NULL) {
+      thread_sleep(&idle);
+      continue;
+    }
+
+    pos[next_idx]++;
+
+    if (simulator_speed > 0 && prev_ns > 0 && next_ns > prev_ns) {
+      long delay_ns = (next_ns - prev_ns) / (long)simulator_speed;
+
+      while (running && delay_ns > 0) {
+        const long sleep_ns = delay_ns < idle.tv_nsec ? delay_ns : idle.tv_nsec;
+        const struct timespec delay = {.tv_sec = 0, .tv_nsec = sleep_ns};
+
+        thread_sleep(&delay);
+        delay_ns -= sleep_ns;
+      }
+    }
+
+    prev_ns = next_ns;
+
+    // Samples are emitted as if received now.
+    struct Sample *restrict const s = Sample_new();
+    s->m_id = String_copy(next->m_id);
+    s->price = Numeric_copy(next->price);
+    s->nanos = Numeric_new();
+    nanos_now(s->nanos);
+
+    simulator_orders_match(s, events);
+
+    Queue_enqueue_await(samples, s);
+
+    while (Array_size(events) > 0)
+      Queue_enqueue_await(orders, Array_remove_head(events));
+  }
+
+  heap_free(pos);
+  Array_delete(events, Order_delete);
+  Array_delete(replay, simulator_replay_delete);
+  thread_exit(EXIT_SUCCESS);
+}
+
+static struct Sample *simulator_sample_await(void) {
+  return Queue_dequeue_await(samples);
+}
+
+static struct Order *simulator_order_await(void) {
+  return Queue_dequeue_await(orders);
+}
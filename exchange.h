@@ -147,16 +147,20 @@ struct Exchange {
   void (*start)(void);
   void (*stop)(void);
   struct Array *(*markets)(void);
+  uintmax_t (*markets_version)(void);
   struct Market *(*market)(const struct String *restrict const);
   struct Array *(*accounts)(void);
   struct Account *(*account)(const struct String *restrict const);
   struct Order *(*order)(const struct Market *restrict const,
                          const struct String *restrict const);
+  struct Array *(*orders)(const struct Market *restrict const,
+                          const struct Numeric *restrict const);
   struct Pricing *(*pricing)(const struct Market *restrict const);
   struct Sample *(*sample_await)(void);
   struct Order *(*order_await)(void);
   bool (*order_cancel)(const struct Market *restrict const,
                        const struct String *restrict const);
+  bool (*orders_cancel)(struct Array *restrict const);
   struct String *(*order_demand)(const struct Market *restrict const,
                                  const char *restrict const,
                                  const char *restrict const);
@@ -57,9 +57,11 @@ _Atomic bool terminated;
 
 extern struct Exchange exchange_bitvavo;
 extern struct Exchange exchange_coinbase;
+extern struct Exchange exchange_simulator;
 struct Exchange *restrict all_exchanges[] = {
     &exchange_coinbase,
     &exchange_bitvavo,
+    &exchange_simulator,
 };
 const size_t all_exchanges_nitems = nitems(all_exchanges);
 
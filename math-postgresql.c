@@ -25,9 +25,15 @@
 #include "math.h"
 #include "proc.h"
 
+#include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <math.h>
 #include <pgtypes_numeric.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 struct Numeric {
   numeric *restrict n;
@@ -90,6 +96,69 @@ inline char *Numeric_to_char(const struct Numeric *restrict const n,
 
 inline void Numeric_char_free(char *restrict const s) { PGTYPESchar_free(s); }
 
+/*
+ * Formats like Numeric_to_char into a caller supplied buffer by walking the
+ * decimal digits of the numeric, without allocating. Returns the length of the
+ * string or 0 if the buffer is too small.
+ */
+size_t Numeric_to_buf(const struct Numeric *restrict const n, const int d,
+                      char *restrict const buf, const size_t len) {
+  const numeric *restrict const v = n->n;
+  const int sc = d < 0 ? v->dscale : d;
+  const int hi = v->weight > 0 ? v->weight : 0;
+  const size_t cnt = (size_t)hi + (size_t)sc + 1;
+  const size_t i_len = (size_t)hi + 1;
+
+  // Sign, carry, decimal point and terminator.
+  if (v->sign == NUMERIC_NAN || len < 4 || cnt > len - 4)
+    return 0;
+
+  char *restrict const dg = buf + 2;
+
+  for (int p = hi, i = 0; p >= -sc; p--, i++) {
+    const int idx = v->weight - p;
+    dg[i] = (char)('0' + (idx >= 0 && idx < v->ndigits ? v->digits[idx] : 0));
+  }
+
+  const int r_idx = v->weight + sc + 1;
+  bool carry = r_idx >= 0 && r_idx < v->ndigits && v->digits[r_idx] >= 5;
+
+  for (size_t i = cnt; carry && i-- > 0;) {
+    if (dg[i] == '9')
+      dg[i] = '0';
+    else {
+      dg[i]++;
+      carry = false;
+    }
+  }
+
+  bool is_zero = !carry;
+  for (size_t i = 0; is_zero && i < cnt; i++)
+    is_zero = dg[i] == '0';
+
+  if (sc > 0) {
+    memmove(dg + i_len + 1, dg + i_len, (size_t)sc);
+    dg[i_len] = '.';
+  }
+
+  char *restrict p = dg;
+  size_t p_len = cnt + (sc > 0 ? 1 : 0);
+
+  if (carry) {
+    *--p = '1';
+    p_len++;
+  }
+
+  if (v->sign == NUMERIC_NEG && !is_zero) {
+    *--p = '-';
+    p_len++;
+  }
+
+  memmove(buf, p, p_len);
+  buf[p_len] = '\0';
+  return p_len;
+}
+
 inline struct Numeric *Numeric_add(const struct Numeric *restrict const n1,
                                    const struct Numeric *restrict const n2) {
   struct Numeric *restrict const res = Numeric_new();
@@ -214,6 +283,45 @@ inline void Numeric_from_long_to(const signed long int l,
 #endif
 }
 
+void Numeric_from_int64_to(const int64_t i,
+                           struct Numeric *restrict const res) {
+#if LONG_MAX >= INT64_MAX
+  Numeric_from_long_to((long)i, res);
+#else
+  char s[24] = {0};
+  const int r = snprintf(s, sizeof(s), "%" PRId64, i);
+
+  if (r < 0 || (size_t)r >= sizeof(s))
+    panic();
+
+  numeric *restrict const n = PGTYPESnumeric_from_asc(s, NULL);
+
+  if (n == NULL || PGTYPESnumeric_copy(n, res->n) < 0)
+    panic();
+
+  PGTYPESnumeric_free(n);
+#ifdef ABAG_MATH_DEBUG
+  res->s = Numeric_to_char(res, 20);
+#endif
+#endif
+}
+
+int64_t Numeric_to_int64(const struct Numeric *restrict const n) {
+  char s[32] = {0};
+  char *end = NULL;
+
+  if (Numeric_to_buf(n, 0, s, sizeof(s)) == 0)
+    panic();
+
+  errno = 0;
+  const long long res = strtoll(s, &end, 10);
+
+  if (errno != 0 || end == s || *end != '\0')
+    panic();
+
+  return (int64_t)res;
+}
+
 inline long Numeric_to_long(const struct Numeric *restrict const n) {
   long res = 0;
   const int ret = PGTYPESnumeric_to_long(n->n, &res);
@@ -263,6 +371,39 @@ inline double Numeric_to_double(const struct Numeric *restrict const n) {
   return res;
 }
 
+/*
+ * Converts like Numeric_to_double by walking the decimal digits of the
+ * numeric, without formatting and allocating. The first 19 significant digits
+ * are taken, so the result may be off by an ulp.
+ */
+double Numeric_to_double_approx(const struct Numeric *restrict const n) {
+  static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  const numeric *restrict const v = n->n;
+  uint64_t mant = 0;
+  int i = 0;
+
+  if (v->sign == NUMERIC_NAN)
+    return NAN;
+
+  for (; i < v->ndigits && i < 19; i++)
+    mant = mant * 10 + v->digits[i];
+
+  // Power of ten of the last digit taken.
+  const int exp = v->weight - i + 1;
+  const int n_pow10 = (int)(sizeof(pow10) / sizeof(pow10[0]));
+  double res = (double)mant;
+
+  if (exp >= 0)
+    res *= exp < n_pow10 ? pow10[exp] : pow(10, exp);
+  else
+    res /= -exp < n_pow10 ? pow10[-exp] : pow(10, -exp);
+
+  return v->sign == NUMERIC_NEG ? -res : res;
+}
+
 inline void Numeric_abs(struct Numeric *restrict const n) {
   if (Numeric_cmp(n, zero) < 0) {
     const int ret = PGTYPESnumeric_mul(n_one->n, n->n, n->n);
@@ -24,6 +24,9 @@
 #include "host.h"
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+
 struct Numeric;
 
 struct Numeric *Numeric_new(void);
@@ -35,6 +38,8 @@ struct Numeric *Numeric_from_char(const char *restrict const);
 
 char *Numeric_to_char(const struct Numeric *restrict const, const int);
 void Numeric_char_free(char *restrict const);
+size_t Numeric_to_buf(const struct Numeric *restrict const, const int,
+                      char *restrict const, const size_t);
 
 struct Numeric *Numeric_add(const struct Numeric *restrict const,
                             const struct Numeric *restrict const);
@@ -66,7 +71,9 @@ int Numeric_to_int(const struct Numeric *restrict const);
 struct Numeric *Numeric_from_long(const signed long int);
 void Numeric_from_long_to(const signed long int,
                           struct Numeric *restrict const);
+void Numeric_from_int64_to(const int64_t, struct Numeric *restrict const);
 long Numeric_to_long(const struct Numeric *restrict const);
+int64_t Numeric_to_int64(const struct Numeric *restrict const);
 
 struct Numeric *Numeric_copy(const struct Numeric *restrict const);
 void Numeric_copy_to(const struct Numeric *restrict const,
@@ -75,6 +82,7 @@ void Numeric_copy_to(const struct Numeric *restrict const,
 struct Numeric *Numeric_from_double(const double);
 void Numeric_from_double_to(const double, struct Numeric *restrict const);
 double Numeric_to_double(const struct Numeric *restrict const);
+double Numeric_to_double_approx(const struct Numeric *restrict const);
 
 void Numeric_abs(struct Numeric *restrict const);
 void Numeric_scale(struct Numeric *restrict const, const int);
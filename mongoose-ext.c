@@ -37,3 +37,24 @@ void mg_mgr_config(struct mg_mgr *restrict const mgr) {
     Numeric_delete(r0);
   }
 }
+
+/*
+ * Milliseconds until the next timer of a manager expires, limited to max_ms.
+ * Used as the mg_mgr_poll timeout so that timers fire on time without polling
+ * more often than necessary.
+ */
+int mg_mgr_timeout(const struct mg_mgr *restrict const mgr, const int max_ms) {
+  const uint64_t now = mg_millis();
+  int ms = max_ms;
+
+  for (const struct mg_timer *restrict t = mgr->timers; t != NULL;
+       t = t->next) {
+    if (t->expire <= now)
+      return 0;
+
+    if (t->expire - now < (uint64_t)ms)
+      ms = (int)(t->expire - now);
+  }
+
+  return ms;
+}
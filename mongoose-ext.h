@@ -22,5 +22,6 @@
 #include "mongoose.h"
 
 void mg_mgr_config(struct mg_mgr *restrict const mgr);
+int mg_mgr_timeout(const struct mg_mgr *restrict const mgr, const int max_ms);
 
 #endif
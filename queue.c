@@ -115,6 +115,25 @@ inline void Queue_enqueue_await(struct Queue *restrict const q,
   mutex_unlock(&q->mtx);
 }
 
+inline bool Queue_enqueue(struct Queue *restrict const q,
+                          void *restrict const item) {
+  bool enqueued = false;
+
+  mutex_lock(&q->mtx);
+
+  if (q->running && q->size < q->capacity) {
+    q->rear = (q->rear + 1) % q->capacity;
+    q->items[q->rear] = item;
+    q->size++;
+    enqueued = true;
+
+    condition_signal(&q->not_empty);
+  }
+
+  mutex_unlock(&q->mtx);
+  return enqueued;
+}
+
 inline void *Queue_dequeue_await(struct Queue *restrict const q) {
   void *restrict item = NULL;
   struct timespec to;
@@ -35,6 +35,7 @@ void Queue_delete(struct Queue *restrict const,
                   void (*cb)(void *restrict const));
 
 void Queue_enqueue_await(struct Queue *restrict const, void *restrict const);
+bool Queue_enqueue(struct Queue *restrict const, void *restrict const);
 void *Queue_dequeue_await(struct Queue *restrict const);
 
 void Queue_start(struct Queue *restrict const);
@@ -263,6 +263,31 @@ char *nanos_to_iso8601(const struct Numeric *restrict const nanos) {
   return r;
 }
 
+char *nanos_to_iso8601_utc(const struct Numeric *restrict const nanos) {
+  const struct time_tls *restrict const tls = time_tls();
+  struct Numeric *restrict const s = tls->nanos_to_iso8601.s;
+  struct tm t = {0};
+
+  Numeric_div_to(nanos, second_nanos, s);
+  time_t time = Numeric_to_long(s);
+
+#if defined(_MSC_VER)
+  // This is not errno_t and gmtime_s from C Annex K
+  errno_t gt_s = gmtime_s(&t, &time);
+  if (gt_s != 0)
+    fatal("%s", strerror(gt_s));
+#else
+  if (gmtime_r(&time, &t) == NULL)
+    fatal("%s", "gmtime_r");
+#endif
+
+  char *restrict const r = heap_malloc(TIME_ISO8601_MAX_LENGTH + 1);
+  if (strftime(r, TIME_ISO8601_MAX_LENGTH + 1, "%Y-%m-%dT%H:%M:%SZ", &t) == 0)
+    panic();
+
+  return r;
+}
+
 char *nanos_string(const struct Numeric *restrict const nanos) {
   const struct time_tls *restrict const tls = time_tls();
   struct Numeric *restrict const r0 = tls->nanos_string.r0;
@@ -39,5 +39,6 @@ void nanos_now(struct Numeric *restrict const);
 bool nanos_from_iso8601(const char *restrict const, const size_t,
                         struct Numeric *restrict const);
 char *nanos_to_iso8601(const struct Numeric *restrict const);
+char *nanos_to_iso8601_utc(const struct Numeric *restrict const);
 char *nanos_string(const struct Numeric *restrict const);
 #endif
@@ -0,0 +1,280 @@
+/* $JDTAUS$ */
+
+/*
+ * Copyright (c) 2026 Christian Schulte <cs@schulte.it>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Memory mapped append-only log. The file starts with a header holding a
+ * sequence number and the number of bytes in use, followed by records of a
+ * length, a checksum and the data padded to eight bytes, all in host byte
+ * order. Appending is a copy into the mapping; the data is made durable by
+ * Wal_sync, which writes back only the pages appended to since the last sync.
+ * Concurrent syncs are serialized, so a sync waiting for another one finds its
+ * records written back by that one already. Replay stops at the first record
+ * not matching its checksum, so a record torn by a crash is dropped together
+ * with everything behind it.
+ */
+
+#if !defined(_MSC_VER)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifdef HAVE_HOST_H
+#include "host.h"
+#endif
+
+#include "heap.h"
+#include "proc.h"
+#include "thread.h"
+#include "wal.h"
+
+#include <errno.h>
+#include <string.h>
+
+#if !defined(_MSC_VER)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define WAL_MAGIC UINT64_C(0x31304c4157474241)
+
+struct wal_hdr {
+  uint64_t magic;
+  uint64_t seq;
+  uint64_t used;
+};
+
+struct wal_rec {
+  uint64_t len;
+  uint64_t sum;
+};
+
+struct Wal {
+  char *restrict path;
+  char *restrict map;
+  struct wal_hdr *restrict hdr;
+  size_t map_len;
+  size_t page_len;
+  uint64_t synced;
+  int fd;
+  mtx_t mtx;
+  mtx_t sync_mtx;
+};
+
+static inline size_t wal_padded(const size_t len) {
+  return (len + 7) & ~(size_t)7;
+}
+
+static uint64_t wal_sum(const char *restrict const data, const size_t len) {
+  uint64_t h = UINT64_C(14695981039346656037);
+
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)data[i];
+    h *= UINT64_C(1099511628211);
+  }
+
+  return h ^ (uint64_t)len;
+}
+
+#if !defined(_MSC_VER)
+static void wal_msync(const struct Wal *restrict const w, size_t off,
+                      const size_t end) {
+  const int saved_errno = errno;
+
+  off -= off % w->page_len;
+
+  if (msync(w->map + off, end - off, MS_SYNC) == -1)
+    werr("%s: %s\n", w->path, strerror(errno));
+
+  errno = saved_errno;
+}
+#endif
+
+// Called with sync_mtx held. Records are written back before the header
+// accounting for them.
+static void wal_sync(struct Wal *restrict const w, const bool hdr) {
+#if !defined(_MSC_VER)
+  mutex_lock(&w->mtx);
+  const uint64_t used = w->hdr->used;
+  mutex_unlock(&w->mtx);
+
+  if (used > w->synced)
+    wal_msync(w, sizeof(struct wal_hdr) + (size_t)w->synced,
+              sizeof(struct wal_hdr) + (size_t)used);
+
+  if (hdr || used != w->synced)
+    wal_msync(w, 0, sizeof(struct wal_hdr));
+
+  w->synced = used;
+#else
+  (void)w;
+  (void)hdr;
+#endif
+}
+
+#if defined(_MSC_VER)
+struct Wal *Wal_new(const char *restrict const path, const size_t size) {
+  (void)size;
+  fatal("%s: Write-ahead logging not supported", path);
+}
+#else
+struct Wal *Wal_new(const char *restrict const path, const size_t size) {
+  struct Wal *restrict const w = heap_calloc(1, sizeof(struct Wal));
+  const size_t len = strlen(path);
+  struct stat st;
+
+  w->path = heap_malloc(len + 1);
+  memcpy(w->path, path, len + 1);
+  w->page_len = (size_t)sysconf(_SC_PAGESIZE);
+  mutex_init(&w->mtx);
+  mutex_init(&w->sync_mtx);
+  w->fd = open(path, O_RDWR | O_CREAT, 0600);
+
+  if (w->fd == -1 || fstat(w->fd, &st) == -1)
+    fatal("%s: %s", path, strerror(errno));
+
+  w->map_len = (size_t)st.st_size > size ? (size_t)st.st_size : size;
+
+  if (w->map_len < sizeof(struct wal_hdr) + sizeof(struct wal_rec))
+    fatal("%s: Size too small: %zu", path, w->map_len);
+
+  if ((size_t)st.st_size < w->map_len &&
+      ftruncate(w->fd, (off_t)w->map_len) == -1)
+    fatal("%s: %s", path, strerror(errno));
+
+  w->map =
+      mmap(NULL, w->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+
+  if (w->map == MAP_FAILED)
+    fatal("%s: %s", path, strerror(errno));
+
+  w->hdr = (struct wal_hdr *)w->map;
+
+  if (st.st_size == 0) {
+    w->hdr->magic = WAL_MAGIC;
+    w->hdr->seq = 0;
+    w->hdr->used = 0;
+    mutex_lock(&w->sync_mtx);
+    wal_sync(w, true);
+    mutex_unlock(&w->sync_mtx);
+  } else if (w->hdr->magic != WAL_MAGIC)
+    fatal("%s: Not a write-ahead log", path);
+  else if (w->hdr->used > w->map_len - sizeof(struct wal_hdr))
+    fatal("%s: Corrupt header", path);
+
+  w->synced = w->hdr->used;
+  return w;
+}
+#endif
+
+void Wal_delete(struct Wal *restrict const w) {
+  if (w == NULL)
+    return;
+
+#if !defined(_MSC_VER)
+  Wal_sync(w);
+
+  if (munmap(w->map, w->map_len) == -1 || close(w->fd) == -1)
+    werr("%s: %s\n", w->path, strerror(errno));
+#endif
+
+  mutex_destroy(&w->mtx);
+  mutex_destroy(&w->sync_mtx);
+  heap_free(w->path);
+  heap_free(w);
+}
+
+bool Wal_append(struct Wal *restrict const w, const void *restrict const data,
+                const size_t len) {
+  const size_t need = sizeof(struct wal_rec) + wal_padded(len);
+  bool ret = false;
+
+  mutex_lock(&w->mtx);
+
+  const size_t off = sizeof(struct wal_hdr) + w->hdr->used;
+
+  if (need > w->map_len - off)
+    goto ret;
+
+  const struct wal_rec rec = {
+      .len = len,
+      .sum = wal_sum(data, len),
+  };
+
+  memcpy(w->map + off, &rec, sizeof(rec));
+  memcpy(w->map + off + sizeof(rec), data, len);
+  w->hdr->used += need;
+  ret = true;
+ret:
+  mutex_unlock(&w->mtx);
+  return ret;
+}
+
+void Wal_sync(struct Wal *restrict const w) {
+  mutex_lock(&w->sync_mtx);
+  wal_sync(w, false);
+  mutex_unlock(&w->sync_mtx);
+}
+
+void Wal_reset(struct Wal *restrict const w, const uint64_t seq) {
+  mutex_lock(&w->sync_mtx);
+  mutex_lock(&w->mtx);
+  w->hdr->seq = seq;
+  w->hdr->used = 0;
+  mutex_unlock(&w->mtx);
+  w->synced = 0;
+  wal_sync(w, true);
+  mutex_unlock(&w->sync_mtx);
+}
+
+uint64_t Wal_seq(const struct Wal *restrict const w) { return w->hdr->seq; }
+
+size_t Wal_size(const struct Wal *restrict const w) { return w->hdr->used; }
+
+void Wal_replay(struct Wal *restrict const w,
+                void (*handler)(const char *restrict const, const size_t,
+                                void *restrict const),
+                void *restrict const arg) {
+  mutex_lock(&w->mtx);
+
+  const size_t end = sizeof(struct wal_hdr) + w->hdr->used;
+  size_t off = sizeof(struct wal_hdr);
+
+  while (off < end) {
+    struct wal_rec rec;
+
+    if (end - off < sizeof(rec))
+      goto corrupt;
+
+    memcpy(&rec, w->map + off, sizeof(rec));
+    off += sizeof(rec);
+
+    if (rec.len > end - off ||
+        wal_sum(w->map + off, (size_t)rec.len) != rec.sum)
+      goto corrupt;
+
+    handler(w->map + off, (size_t)rec.len, arg);
+    off += wal_padded((size_t)rec.len);
+  }
+
+  mutex_unlock(&w->mtx);
+  return;
+corrupt:
+  werr("%s: Corrupt record at offset %zu\n", w->path, off);
+  mutex_unlock(&w->mtx);
+}
@@ -0,0 +1,47 @@
+/* $JDTAUS$ */
+
+/*
+ * Copyright (c) 2026 Christian Schulte <cs@schulte.it>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef WAL_H
+#define WAL_H
+
+#ifdef HAVE_HOST_H
+#include "host.h"
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct Wal;
+
+struct Wal *Wal_new(const char *restrict const, const size_t);
+void Wal_delete(struct Wal *restrict const);
+
+bool Wal_append(struct Wal *restrict const, const void *restrict const,
+                const size_t);
+void Wal_sync(struct Wal *restrict const);
+void Wal_reset(struct Wal *restrict const, const uint64_t);
+
+uint64_t Wal_seq(const struct Wal *restrict const);
+size_t Wal_size(const struct Wal *restrict const);
+
+void Wal_replay(struct Wal *restrict const,
+                void (*)(const char *restrict const, const size_t,
+                         void *restrict const),
+                void *restrict const);
+#endif